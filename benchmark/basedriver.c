@@ -26,18 +26,18 @@ int threadcount = -1;
 ThreadInfo* threadinfos;
 
 
-inline void HRTimerStart(HRTimer* hrt)
+static inline void HRTimerStart(HRTimer* hrt)
 {
 	gettimeofday(&hrt->start, 0);
 }
 
-inline double HRTimerStopp(HRTimer* hrt)
+static inline double HRTimerStopp(HRTimer* hrt)
 {
 	gettimeofday(&hrt->stopp, 0);
 	return (hrt->stopp.tv_sec - hrt->start.tv_sec) * 1000.0 + (hrt->stopp.tv_usec - hrt->start.tv_usec) / 1000.0;
 }
 
-inline int64_t getRandomValue(RngInfo* ri, u_int64_t a, u_int64_t b)
+static inline int64_t getRandomValue(RngInfo* ri, u_int64_t a, u_int64_t b)
 {
 	if (ri->type == Uniform)
 	{
@@ -67,7 +67,7 @@ inline int64_t getRandomValue(RngInfo* ri, u_int64_t a, u_int64_t b)
 	return 0;
 }
 
-inline void KeystoreInsert(Key* key, ThreadInfo* ti)
+static inline void KeystoreInsert(Key* key, ThreadInfo* ti)
 {
 	int i;
 	for (i = 0; i < BDR_DIMENSIONS[ti->indexid]; i++)
@@ -297,36 +297,47 @@ void* PopulateIndexTask(void* params)
 		exit(-1);
 	}
 
-	// Populate
-	Record record;
+	// Populate (records are inserted in batches of BDR_POPULATE_BATCH)
+	Record* records = malloc(sizeof(Record) * BDR_POPULATE_BATCH);
+	Attribute* attrs = malloc(sizeof(Attribute) * BDR_DIMENSIONS[ti->id] * BDR_POPULATE_BATCH);
+	Attribute** ar = malloc(sizeof(Attribute*) * BDR_DIMENSIONS[ti->id] * BDR_POPULATE_BATCH);
 	void* payload = malloc(BDR_PAYLOADS[ti->id]);
-	Attribute attrs[BDR_DIMENSIONS[ti->id]];
-	Attribute* ar[BDR_DIMENSIONS[ti->id]];
-	record.payload.data = payload;
-	record.payload.size = BDR_PAYLOADS[ti->id];
-	record.key.attribute_count = BDR_DIMENSIONS[ti->id];
-	record.key.value = ar;
-	for (i = 0; i < BDR_DIMENSIONS[ti->id]; i++)
+	u_int64_t k;
+	for (k = 0; k < BDR_POPULATE_BATCH; k++)
 	{
-		record.key.value[i] = &attrs[i];
-		attrs[i].type = kInt;
+		records[k].payload.data = payload;
+		records[k].payload.size = BDR_PAYLOADS[ti->id];
+		records[k].key.attribute_count = BDR_DIMENSIONS[ti->id];
+		records[k].key.value = &ar[k * BDR_DIMENSIONS[ti->id]];
+		for (j = 0; j < BDR_DIMENSIONS[ti->id]; j++)
+		{
+			records[k].key.value[j] = &attrs[k * BDR_DIMENSIONS[ti->id] + j];
+			records[k].key.value[j]->type = kInt;
+		}
 	}
-	for (i = 0; i < BDR_DATASIZES[ti->id] / (8 * BDR_DIMENSIONS[ti->id] + BDR_PAYLOADS[ti->id]) ; i++)
+	u_int64_t count = BDR_DATASIZES[ti->id] / (8 * BDR_DIMENSIONS[ti->id] + BDR_PAYLOADS[ti->id]);
+	for (i = 0; i < count; i += k)
 	{
-		for (j = 0; j < BDR_DIMENSIONS[ti->id]; j++)
+		for (k = 0; (k < BDR_POPULATE_BATCH) && (i + k < count); k++)
 		{
-			BDR_RNG_NEXTPAIR;
-			attrs[j].int_value = getRandomValue(&BDR_RNGS[ti->id][j], rngz, rngz2);
+			for (j = 0; j < BDR_DIMENSIONS[ti->id]; j++)
+			{
+				BDR_RNG_NEXTPAIR;
+				records[k].key.value[j]->int_value = getRandomValue(&BDR_RNGS[ti->id][j], rngz, rngz2);
+			}
+			KeystoreInsert(&records[k].key, ti);
 		}
 
-		if (InsertRecord(0, idx, &record) != kOk)
+		if (InsertRecords(0, idx, records, k) != kOk)
 		{
-			printf("InsertRecord failed\n");
+			printf("InsertRecords failed\n");
 			exit(-1);
 
 		}
-		KeystoreInsert(&record.key, ti);
 	}
+	free(records);
+	free(attrs);
+	free(ar);
 	free(payload);
 	printf("!%u... ", ti->id +1);
 	fflush(stdout);
@@ -468,8 +479,25 @@ int main(int argc, char* argv[])
 		printf("Updates      : %lu\n", threadinfos[i].stat_update);
 		printf("Inserts      : %lu\n", threadinfos[i].stat_insert);
 		printf("Deletes      : %lu\n", threadinfos[i].stat_delete);
+		IndexFootprint footprint;
+		if (GetIndexFootprint(threadinfos[i].indexname, &footprint) == kOk)
+			printf("Footprint    : %llu records, keys %llu bytes (padding: %llu), payloads %llu bytes, tree %llu bytes (overhead: %llu)\n",
+			       (unsigned long long) footprint.records, (unsigned long long) footprint.key_bytes,
+			       (unsigned long long) footprint.key_padding, (unsigned long long) footprint.payload_bytes,
+			       (unsigned long long) footprint.tree_bytes, (unsigned long long) footprint.tree_overhead);
 		printf("\n");
 	}
+	TransactionStats txstats;
+	if (GetTransactionStats(&txstats) == kOk)
+		printf("Deadlock retries: %llu (failed: %llu)\n", (unsigned long long) txstats.deadlock_retries,
+		       (unsigned long long) txstats.deadlock_failures);
+	MemoryUsage memusage;
+	if (GetMemoryUsage(&memusage) == kOk)
+		printf("Memory: %llu bytes (peak: %llu, limit: %llu, refused: %llu)\n", (unsigned long long) memusage.used,
+		       (unsigned long long) memusage.peak, (unsigned long long) memusage.limit,
+		       (unsigned long long) memusage.failures);
+	if (WriteLockReport(BDR_LOCK_REPORT) == kOk)
+		printf("Lock contention report written to %s\n", BDR_LOCK_REPORT);
 	fflush(stdout);
 #endif
 
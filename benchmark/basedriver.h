@@ -23,6 +23,7 @@
 #ifndef _BASEDRIVER_H
 
 #include <contest_interface.h>
+#include <contest_extensions.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
@@ -62,6 +63,9 @@ RngInfo* BDR_RNGS[] = {BDR_IDX_0, BDR_IDX_1, BDR_IDX_2, BDR_IDX_3};
 
 #define BDR_KEY_PROVISIONING (1024 * 1024 * 2)
 
+// The number of records that are inserted at once while populating an index
+#define BDR_POPULATE_BATCH 1024
+
 #define BDR_RANGE_PROB 10
 #define BDR_POINT_PROB 40
 #define BDR_UPDATE_PROB 20
@@ -72,6 +76,9 @@ RngInfo* BDR_RNGS[] = {BDR_IDX_0, BDR_IDX_1, BDR_IDX_2, BDR_IDX_3};
 #define BDR_TESTRUN 30
 #define BDR_STATS
 
+// The file the lock contention report is written to (see WriteLockReport())
+#define BDR_LOCK_REPORT "locks.txt"
+
 #define BDR_RNG_VARS  \
 		unsigned long rngx=rand(), rngy=362436069, rngz=521288629; \
 		unsigned long rngt, rngz2;
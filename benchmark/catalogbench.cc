@@ -0,0 +1,138 @@
+/**
+* Measures the cost of looking up indices in the catalog with a growing number
+* of threads.
+*
+* Every round runs an increasing number of threads for CAT_SECONDS seconds.
+* Each thread searches random names of CAT_INDICES indices, once in the
+* lock-free catalog and once in a std::map protected by a mutex (the catalog
+* used before), and the average time of a lookup is printed for both.
+*
+* Usage: catalogbench [max threads]
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+
+#include "example/Catalog.h"
+#include "example/Mutex.h"
+
+// The number of indices inside the catalog
+#define CAT_INDICES 64
+
+// The duration of every round in seconds
+#define CAT_SECONDS 2
+
+typedef struct CatalogThread
+{
+	pthread_t pid;
+	int id;
+	bool locked;
+	unsigned long long lookups;
+} CatalogThread;
+
+static Catalog<int> catalog;
+static std::map<std::string, int*> locked_map;
+static Mutex mutex;
+static char names[CAT_INDICES][16];
+static int values[CAT_INDICES];
+static volatile int running;
+
+void* LookupTask(void* params)
+{
+	CatalogThread* ct = (CatalogThread*) params;
+	unsigned int seed = ct->id + 1;
+	int* value = NULL;
+	Catalog<int>::Pin pin;
+
+	while (running)
+	{
+		// Do a few lookups between checks of the flag
+		for (int i = 0; i < 64; i++)
+		{
+			const char* name = names[rand_r(&seed) % CAT_INDICES];
+			if (ct->locked)
+			{
+				lock(mutex)
+				{
+					value = locked_map.find(name)->second;
+				}
+			}
+			else
+			{
+				value = catalog.Find(name, &pin);
+			}
+			if (value == NULL)
+				abort();
+		}
+		ct->lookups += 64;
+	}
+	return 0;
+}
+
+// Run one round and return the average duration of a lookup in nanoseconds
+static double Round(CatalogThread* cts, int count, bool locked)
+{
+	running = 1;
+	for (int i = 0; i < count; i++)
+	{
+		cts[i].id = i;
+		cts[i].locked = locked;
+		cts[i].lookups = 0;
+		if (pthread_create(&cts[i].pid, 0, LookupTask, (void*) &cts[i]) != 0)
+		{
+			printf("pthread_create failed\n");
+			exit(-1);
+		}
+	}
+	sleep(CAT_SECONDS);
+	running = 0;
+
+	unsigned long long lookups = 0;
+	for (int i = 0; i < count; i++)
+	{
+		pthread_join(cts[i].pid, 0);
+		lookups += cts[i].lookups;
+	}
+
+	// Every thread has been busy for the whole round
+	return (lookups > 0) ? 1e9 * CAT_SECONDS * count / lookups : 0.0;
+}
+
+int main(int argc, char* argv[])
+{
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (argc > 1)
+		threads = atoi(argv[1]);
+	if (threads < 1)
+		threads = 1;
+
+	printf("SIGMOD Programming Contest 2012 - CatalogBench\n=====================================================\n\n");
+
+	for (int i = 0; i < CAT_INDICES; i++)
+	{
+		snprintf(names[i], sizeof(names[i]), "index%d", i);
+		catalog.Insert(names[i], &values[i]);
+		locked_map[names[i]] = &values[i];
+	}
+
+	CatalogThread* cts = new CatalogThread[threads];
+	int count = 1;
+	while (1)
+	{
+		double lock_free = Round(cts, count, false);
+		double locked = Round(cts, count, true);
+		printf("%3d threads: %8.1f ns/lookup (lock-free) %8.1f ns/lookup (mutex)\n", count, lock_free, locked);
+		fflush(stdout);
+
+		if (count == threads)
+			break;
+		count = (count * 2 > threads) ? threads : count * 2;
+	}
+	delete [] cts;
+	return 0;
+}
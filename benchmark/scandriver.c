@@ -0,0 +1,423 @@
+/**
+* Measures the latency of range scans that compete with inserts and deletes.
+*
+* A single index is populated once. Then every supported isolation level is
+* run for SCN_SECONDS seconds: reader threads scan SCN_SCAN_LENGTH records from
+* random keys inside transactions (like the range queries of basedriver),
+* while writer threads insert and delete random records inside transactions.
+* The average and the maximum latency of a scan and the number of failed
+* operations are printed for every level (and for optimistic transactions
+* the number of commits and of conflicts detected when committing). Berkeley DB
+* only supports snapshots if CONTEST_ISOLATION is set (see IsolationLevel);
+* running with and without it shows what keeping old page versions costs the
+* read committed level.
+*
+* With the argument "boxes", it compares the key layouts instead: the same
+* records are loaded into a lexicographic and a Z-order index of SCN_BOX_DIMENSIONS
+* attributes, and SCN_BOXES box queries that leave the first attribute open are
+* run on both. The steps and seeks of their iterators (see GetIteratorStats())
+* and the time they took are printed for every layout.
+*
+* Usage: scandriver [readers] [writers]
+*        scandriver boxes
+*/
+
+#include <contest_interface.h>
+#include <contest_extensions.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The number of records inside the index
+#define SCN_RECORDS (1 << 18)
+
+// The number of attributes of every key
+#define SCN_DIMENSIONS 2
+
+// The size of a payload in byte
+#define SCN_PAYLOAD 8
+
+// The number of records read by a scan
+#define SCN_SCAN_LENGTH 200
+
+// The number of operations of a writing transaction
+#define SCN_WRITES 4
+
+// The duration of every run in seconds
+#define SCN_SECONDS 10
+
+// The number of records, attributes and queries used to compare the key layouts
+#define SCN_BOX_RECORDS (1 << 16)
+#define SCN_BOX_DIMENSIONS 4
+#define SCN_BOXES 1000
+
+// The values of the attributes are drawn from [0, SCN_BOX_DOMAIN), the restricted
+// attributes of a box cover an eighth of it
+#define SCN_BOX_DOMAIN (1 << 20)
+
+typedef struct ScanThread
+{
+	pthread_t pid;
+	int id;
+	int reader;
+	u_int64_t ops;
+	u_int64_t failures;
+	u_int64_t latency_us;
+	u_int64_t max_latency_us;
+} ScanThread;
+
+static Index* idx;
+static volatile int running;
+
+// Return the current time in microseconds
+static u_int64_t Now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return (u_int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// The key of record i (the first attribute is unique)
+static void SetKey(Record* record, u_int64_t i)
+{
+	record->key.value[0]->int_value = i;
+	record->key.value[1]->int_value = i % 1000;
+}
+
+// Scans SCN_SCAN_LENGTH records from a random key
+static void Scan(ScanThread* st, unsigned int* seed, Record* record, Key* keymax)
+{
+	Transaction* tx;
+	Iterator* it;
+	Record* itrecord;
+	int j;
+	u_int64_t start = Now();
+	if (BeginTransaction(&tx) != kOk)
+	{
+		st->failures++;
+		return;
+	}
+	SetKey(record, rand_r(seed) % SCN_RECORDS);
+	if (GetRecords(tx, idx, record->key, *keymax, &it) == kOk)
+	{
+		for (j = 0; j < SCN_SCAN_LENGTH; j++)
+		{
+			if (GetNext(it, &itrecord) != kOk)
+				break;
+		}
+		CloseIterator(&it);
+	}
+	if (CommitTransaction(&tx) != kOk)
+	{
+		st->failures++;
+		return;
+	}
+	u_int64_t latency = Now() - start;
+	st->ops++;
+	st->latency_us += latency;
+	if (latency > st->max_latency_us)
+		st->max_latency_us = latency;
+}
+
+// Inserts and deletes SCN_WRITES random records
+static void Write(ScanThread* st, unsigned int* seed, Record* record)
+{
+	Transaction* tx;
+	int j;
+	if (BeginTransaction(&tx) != kOk)
+	{
+		st->failures++;
+		return;
+	}
+	for (j = 0; j < SCN_WRITES; j++)
+	{
+		SetKey(record, rand_r(seed) % SCN_RECORDS);
+		ErrorCode res = (j % 2 == 0) ? InsertRecord(tx, idx, record) : DeleteRecord(tx, idx, record, kIgnorePayload);
+		if ((res != kOk) && (res != kErrorNotFound))
+		{
+			AbortTransaction(&tx);
+			st->failures++;
+			return;
+		}
+	}
+	if (CommitTransaction(&tx) != kOk)
+	{
+		st->failures++;
+		return;
+	}
+	st->ops++;
+}
+
+void* ScanTask(void* params)
+{
+	ScanThread* st = (ScanThread*) params;
+	unsigned int seed = st->id + 1;
+	int j;
+
+	Record record;
+	Key keymax;
+	Attribute attrs[SCN_DIMENSIONS], attrsmax[SCN_DIMENSIONS];
+	Attribute* ar[SCN_DIMENSIONS];
+	Attribute* armax[SCN_DIMENSIONS];
+	int64_t payload = 0;
+	record.key.attribute_count = SCN_DIMENSIONS;
+	record.key.value = ar;
+	record.payload.data = &payload;
+	record.payload.size = SCN_PAYLOAD;
+	keymax.attribute_count = SCN_DIMENSIONS;
+	keymax.value = armax;
+	for (j = 0; j < SCN_DIMENSIONS; j++)
+	{
+		record.key.value[j] = &attrs[j];
+		attrs[j].type = kInt;
+		keymax.value[j] = &attrsmax[j];
+		attrsmax[j].type = kInt;
+		attrsmax[j].int_value = INT64_MAX;
+	}
+
+	while (running)
+	{
+		if (st->reader)
+			Scan(st, &seed, &record, &keymax);
+		else
+			Write(st, &seed, &record);
+	}
+	return 0;
+}
+
+// Loads the same records into a lexicographic and a Z-order index and runs the
+// same box queries on both
+static void RunBoxes()
+{
+	KeyLayout layouts[] = {kLayoutLexicographic, kLayoutZOrder};
+	const char* names[] = {"lexicographic", "z-order"};
+	AttributeType atypes[SCN_BOX_DIMENSIONS];
+	Attribute attrs[2][SCN_BOX_DIMENSIONS];
+	Attribute* ar[2][SCN_BOX_DIMENSIONS];
+	Key keys[2];
+	int i, j, l;
+	for (j = 0; j < SCN_BOX_DIMENSIONS; j++)
+	{
+		atypes[j] = kInt;
+	}
+
+	Record* records = malloc(sizeof(Record) * SCN_BOX_RECORDS);
+	Attribute* rattrs = malloc(sizeof(Attribute) * SCN_BOX_DIMENSIONS * SCN_BOX_RECORDS);
+	Attribute** rar = malloc(sizeof(Attribute*) * SCN_BOX_DIMENSIONS * SCN_BOX_RECORDS);
+	int64_t payload = 0;
+	unsigned int seed = 1;
+	for (i = 0; i < SCN_BOX_RECORDS; i++)
+	{
+		records[i].payload.data = &payload;
+		records[i].payload.size = SCN_PAYLOAD;
+		records[i].key.attribute_count = SCN_BOX_DIMENSIONS;
+		records[i].key.value = &rar[i * SCN_BOX_DIMENSIONS];
+		for (j = 0; j < SCN_BOX_DIMENSIONS; j++)
+		{
+			records[i].key.value[j] = &rattrs[i * SCN_BOX_DIMENSIONS + j];
+			rattrs[i * SCN_BOX_DIMENSIONS + j].type = kInt;
+			rattrs[i * SCN_BOX_DIMENSIONS + j].int_value = rand_r(&seed) % SCN_BOX_DOMAIN;
+		}
+	}
+
+	for (l = 0; l < 2; l++)
+	{
+		IndexOptions options;
+		char name[32];
+		memset(&options, 0, sizeof(options));
+		options.layout = layouts[l];
+		sprintf(name, "boxes_%d", l);
+		if (CreateIndexWithOptions(name, SCN_BOX_DIMENSIONS, atypes, &options) != kOk)
+		{
+			printf("%-15s: not supported\n", names[l]);
+			continue;
+		}
+		if ((OpenIndex(name, &idx) != kOk) || (InsertRecords(0, idx, records, SCN_BOX_RECORDS) != kOk))
+		{
+			printf("Populating the %s index failed\n", names[l]);
+			exit(-1);
+		}
+
+		// Every layout runs the same boxes
+		IteratorStats before, after;
+		u_int64_t found = 0, start = Now();
+		seed = 2;
+		GetIteratorStats(&before);
+		for (i = 0; i < SCN_BOXES; i++)
+		{
+			for (j = 0; j < 2; j++)
+			{
+				keys[j].attribute_count = SCN_BOX_DIMENSIONS;
+				keys[j].value = ar[j];
+				ar[j][0] = 0;
+			}
+			for (j = 1; j < SCN_BOX_DIMENSIONS; j++)
+			{
+				int64_t from = rand_r(&seed) % (SCN_BOX_DOMAIN - SCN_BOX_DOMAIN / 8);
+				attrs[0][j].type = attrs[1][j].type = kInt;
+				attrs[0][j].int_value = from;
+				attrs[1][j].int_value = from + SCN_BOX_DOMAIN / 8;
+				ar[0][j] = &attrs[0][j];
+				ar[1][j] = &attrs[1][j];
+			}
+
+			Iterator* it;
+			Record* record;
+			if (GetRecords(0, idx, keys[0], keys[1], &it) != kOk)
+			{
+				printf("GetRecords failed\n");
+				exit(-1);
+			}
+			while (GetNext(it, &record) == kOk)
+				found++;
+			CloseIterator(&it);
+		}
+		GetIteratorStats(&after);
+
+		printf("%-15s: %10.1f us/box, %8.1f seeks/box, %8.1f steps/box (records: %llu)\n", names[l],
+		       (double) (Now() - start) / SCN_BOXES, (double) (after.seeks - before.seeks) / SCN_BOXES,
+		       (double) (after.steps - before.steps) / SCN_BOXES, (unsigned long long) found);
+		fflush(stdout);
+		CloseIndex(&idx);
+	}
+
+	free(records);
+	free(rattrs);
+	free(rar);
+}
+
+int main(int argc, char* argv[])
+{
+	int readers = 4, writers = 4;
+	int i, j, l;
+	if ((argc > 1) && (strcmp(argv[1], "boxes") == 0))
+	{
+		printf("SIGMOD Programming Contest 2012 - ScanDriver\n=====================================================\n\n");
+		RunBoxes();
+		return 0;
+	}
+	if (argc > 1)
+		readers = atoi(argv[1]);
+	if (argc > 2)
+		writers = atoi(argv[2]);
+	if (readers < 1)
+		readers = 1;
+	if (writers < 0)
+		writers = 0;
+
+	printf("SIGMOD Programming Contest 2012 - ScanDriver\n=====================================================\n\n");
+
+	// Populate the index
+	AttributeType atypes[SCN_DIMENSIONS];
+	for (i = 0; i < SCN_DIMENSIONS; i++)
+	{
+		atypes[i] = kInt;
+	}
+	if ((CreateIndex("scans", SCN_DIMENSIONS, atypes) != kOk) || (OpenIndex("scans", &idx) != kOk))
+	{
+		printf("Creating the index failed\n");
+		exit(-1);
+	}
+
+	Record* records = malloc(sizeof(Record) * SCN_RECORDS);
+	Attribute* attrs = malloc(sizeof(Attribute) * SCN_DIMENSIONS * SCN_RECORDS);
+	Attribute** ar = malloc(sizeof(Attribute*) * SCN_DIMENSIONS * SCN_RECORDS);
+	int64_t payload = 0;
+	for (i = 0; i < SCN_RECORDS; i++)
+	{
+		records[i].payload.data = &payload;
+		records[i].payload.size = SCN_PAYLOAD;
+		records[i].key.attribute_count = SCN_DIMENSIONS;
+		records[i].key.value = &ar[i * SCN_DIMENSIONS];
+		for (j = 0; j < SCN_DIMENSIONS; j++)
+		{
+			records[i].key.value[j] = &attrs[i * SCN_DIMENSIONS + j];
+			attrs[i * SCN_DIMENSIONS + j].type = kInt;
+		}
+		SetKey(&records[i], i);
+	}
+	printf("Populating index... ");
+	fflush(stdout);
+	if (InsertRecords(0, idx, records, SCN_RECORDS) != kOk)
+	{
+		printf("InsertRecords failed\n");
+		exit(-1);
+	}
+	free(records);
+	free(attrs);
+	free(ar);
+	printf("done\n\n");
+
+	// Run every isolation level with the same threads
+	IsolationLevel levels[] = {kIsolationReadCommitted, kIsolationSnapshot, kIsolationOptimistic};
+	const char* names[] = {"read committed", "snapshot", "optimistic"};
+	int count = readers + writers;
+	ScanThread* sts = malloc(sizeof(ScanThread) * count);
+	for (l = 0; l < 3; l++)
+	{
+		if (SetIsolationLevel(levels[l]) != kOk)
+		{
+			printf("%-15s: not supported\n", names[l]);
+			continue;
+		}
+
+		running = 1;
+		for (i = 0; i < count; i++)
+		{
+			sts[i].id = i;
+			sts[i].reader = (i < readers);
+			sts[i].ops = 0;
+			sts[i].failures = 0;
+			sts[i].latency_us = 0;
+			sts[i].max_latency_us = 0;
+			if (pthread_create(&sts[i].pid, 0, ScanTask, (void*) &sts[i]) != 0)
+			{
+				printf("pthread_create failed\n");
+				exit(-1);
+			}
+		}
+		sleep(SCN_SECONDS);
+		running = 0;
+
+		u_int64_t scans = 0, scan_failures = 0, latency = 0, max_latency = 0;
+		u_int64_t writes = 0, write_failures = 0;
+		for (i = 0; i < count; i++)
+		{
+			pthread_join(sts[i].pid, 0);
+			if (sts[i].reader)
+			{
+				scans += sts[i].ops;
+				scan_failures += sts[i].failures;
+				latency += sts[i].latency_us;
+				if (sts[i].max_latency_us > max_latency)
+					max_latency = sts[i].max_latency_us;
+			}
+			else
+			{
+				writes += sts[i].ops;
+				write_failures += sts[i].failures;
+			}
+		}
+
+		printf("%-15s: %10.1f us/scan (max: %llu us, scans: %llu, failed: %llu), writes: %llu (failed: %llu)\n",
+		       names[l], (scans > 0) ? (double) latency / scans : 0.0, (unsigned long long) max_latency,
+		       (unsigned long long) scans, (unsigned long long) scan_failures,
+		       (unsigned long long) writes, (unsigned long long) write_failures);
+		if (levels[l] == kIsolationOptimistic)
+		{
+			TransactionStats stats;
+			GetTransactionStats(&stats);
+			printf("%-15s  commits: %llu, conflicts: %llu\n", "", (unsigned long long) stats.optimistic_commits,
+			       (unsigned long long) stats.optimistic_conflicts);
+		}
+		fflush(stdout);
+	}
+	free(sts);
+
+	CloseIndex(&idx);
+	return 0;
+}
@@ -0,0 +1,190 @@
+/**
+* Measures how UpdateRecord() scales with the number of threads.
+*
+* A single index is populated once. Then every round runs an increasing number
+* of threads for UPD_SECONDS seconds each. Every thread updates random records
+* of its own slice of the keys in autocommit mode, so the threads never touch
+* the same record and only contend inside the implementation.
+*
+* Usage: updatedriver [max threads]
+*/
+
+#include <contest_interface.h>
+#include <contest_extensions.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+// The number of records inside the index
+#define UPD_RECORDS (1 << 18)
+
+// The number of attributes of every key
+#define UPD_DIMENSIONS 3
+
+// The size of a payload in byte
+#define UPD_PAYLOAD 8
+
+// The duration of every round in seconds
+#define UPD_SECONDS 5
+
+typedef struct UpdateThread
+{
+	pthread_t pid;
+	int id;
+	int count;
+	u_int64_t ops;
+	u_int64_t failures;
+} UpdateThread;
+
+static Index* idx;
+static volatile int running;
+
+// The key of record i (the first attribute is unique)
+static void SetKey(Record* record, u_int64_t i)
+{
+	int j;
+	record->key.value[0]->int_value = i;
+	for (j = 1; j < UPD_DIMENSIONS; j++)
+	{
+		record->key.value[j]->int_value = i % (1000 * j);
+	}
+}
+
+void* UpdateTask(void* params)
+{
+	UpdateThread* ut = (UpdateThread*) params;
+	unsigned int seed = ut->id + 1;
+	int j;
+
+	Record record;
+	Attribute attrs[UPD_DIMENSIONS];
+	Attribute* ar[UPD_DIMENSIONS];
+	int64_t payload = 0;
+	int64_t new_value;
+	Block new_payload;
+	record.key.attribute_count = UPD_DIMENSIONS;
+	record.key.value = ar;
+	record.payload.data = &payload;
+	record.payload.size = UPD_PAYLOAD;
+	new_payload.data = &new_value;
+	new_payload.size = UPD_PAYLOAD;
+	for (j = 0; j < UPD_DIMENSIONS; j++)
+	{
+		record.key.value[j] = &attrs[j];
+		attrs[j].type = kInt;
+	}
+
+	// Only update the records of the own slice
+	u_int64_t slice = UPD_RECORDS / ut->count;
+	while (running)
+	{
+		SetKey(&record, ut->id * slice + rand_r(&seed) % slice);
+		new_value = rand_r(&seed);
+		if (UpdateRecord(0, idx, &record, &new_payload, kIgnorePayload) == kOk)
+			ut->ops++;
+		else
+			ut->failures++;
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int i, j, count;
+	if (argc > 1)
+		threads = atoi(argv[1]);
+	if (threads < 1)
+		threads = 1;
+
+	printf("SIGMOD Programming Contest 2012 - UpdateDriver\n=====================================================\n\n");
+
+	// Populate the index
+	AttributeType atypes[UPD_DIMENSIONS];
+	for (i = 0; i < UPD_DIMENSIONS; i++)
+	{
+		atypes[i] = kInt;
+	}
+	if ((CreateIndex("updates", UPD_DIMENSIONS, atypes) != kOk) || (OpenIndex("updates", &idx) != kOk))
+	{
+		printf("Creating the index failed\n");
+		exit(-1);
+	}
+
+	Record* records = malloc(sizeof(Record) * UPD_RECORDS);
+	Attribute* attrs = malloc(sizeof(Attribute) * UPD_DIMENSIONS * UPD_RECORDS);
+	Attribute** ar = malloc(sizeof(Attribute*) * UPD_DIMENSIONS * UPD_RECORDS);
+	int64_t payload = 0;
+	for (i = 0; i < UPD_RECORDS; i++)
+	{
+		records[i].payload.data = &payload;
+		records[i].payload.size = UPD_PAYLOAD;
+		records[i].key.attribute_count = UPD_DIMENSIONS;
+		records[i].key.value = &ar[i * UPD_DIMENSIONS];
+		for (j = 0; j < UPD_DIMENSIONS; j++)
+		{
+			records[i].key.value[j] = &attrs[i * UPD_DIMENSIONS + j];
+			attrs[i * UPD_DIMENSIONS + j].type = kInt;
+		}
+		SetKey(&records[i], i);
+	}
+	printf("Populating index... ");
+	fflush(stdout);
+	if (InsertRecords(0, idx, records, UPD_RECORDS) != kOk)
+	{
+		printf("InsertRecords failed\n");
+		exit(-1);
+	}
+	free(records);
+	free(attrs);
+	free(ar);
+	printf("done\n\n");
+
+	// Run rounds with 1, 2, 4, ... threads
+	UpdateThread* uts = malloc(sizeof(UpdateThread) * threads);
+	double base = 0;
+	count = 1;
+	while (1)
+	{
+		running = 1;
+		for (i = 0; i < count; i++)
+		{
+			uts[i].id = i;
+			uts[i].count = count;
+			uts[i].ops = 0;
+			uts[i].failures = 0;
+			if (pthread_create(&uts[i].pid, 0, UpdateTask, (void*) &uts[i]) != 0)
+			{
+				printf("pthread_create failed\n");
+				exit(-1);
+			}
+		}
+		sleep(UPD_SECONDS);
+		running = 0;
+
+		u_int64_t ops = 0, failures = 0;
+		for (i = 0; i < count; i++)
+		{
+			pthread_join(uts[i].pid, 0);
+			ops += uts[i].ops;
+			failures += uts[i].failures;
+		}
+
+		double throughput = (double) ops / UPD_SECONDS;
+		if (count == 1)
+			base = throughput;
+		printf("%3d threads: %12.1f updates/s (speedup %5.2f, failed: %llu)\n", count, throughput,
+		       (base > 0) ? throughput / base : 0.0, (unsigned long long) failures);
+		fflush(stdout);
+
+		if (count == threads)
+			break;
+		count = (count * 2 > threads) ? threads : count * 2;
+	}
+	free(uts);
+
+	CloseIndex(&idx);
+	return 0;
+}
@@ -0,0 +1,63 @@
+#include "Arena.h"
+#include "MemoryBudget.h"
+
+#include <cstdlib>
+
+Arena::Arena(char* buffer, size_t size){
+  blocks_ = NULL;
+  buffer_ = buffer;
+  buffer_size_ = size;
+  next_ = buffer;
+  end_ = buffer + size;
+  block_size_ = ARENA_BLOCK_SIZE;
+  size_ = 0;
+}
+
+Arena::~Arena(){
+  Release();
+}
+
+void* Arena::AllocateBlock(size_t size){
+  // Large allocations get a block of their own, so that the rest of the current
+  // block can still be used (the list of blocks is only needed to free them)
+  size_t header = (sizeof(Block) + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+  bool own = (size > block_size_ / 4);
+  size_t block_size = own ? size : block_size_;
+
+  // Blocks are charged against the memory budget until the arena is released
+  MemoryBudget::getInstance().Charge(header + block_size);
+  Block* block = (Block*) malloc(header + block_size);
+  if(block == NULL){
+    MemoryBudget::getInstance().Release(header + block_size);
+    throw std::bad_alloc();
+  }
+  block->size = header + block_size;
+  size_ += block->size;
+
+  block->next = blocks_;
+  blocks_ = block;
+
+  // Otherwise the allocations continue in the new block
+  char* memory = ((char*) block) + header;
+  if(own)
+    return memory;
+  next_ = memory + size;
+  end_ = memory + block_size;
+  if(block_size_ < ARENA_MAX_BLOCK_SIZE)
+    block_size_ *= 2;
+  return memory;
+}
+
+void Arena::Release(){
+  if(size_ != 0)
+    MemoryBudget::getInstance().Release(size_);
+  while(blocks_ != NULL){
+    Block* next = blocks_->next;
+    free(blocks_);
+    blocks_ = next;
+  }
+  next_ = buffer_;
+  end_ = buffer_ + buffer_size_;
+  block_size_ = ARENA_BLOCK_SIZE;
+  size_ = 0;
+}
@@ -0,0 +1,102 @@
+// A bump allocator for short-lived objects
+//
+// Memory is handed out piece by piece from large blocks and is only given back
+// all at once (by Release() or by the destructor), so allocating is a pointer
+// increment and no allocator lock is taken. Transactions own an arena for the
+// keys, records and iterator state they create, single operations use an
+// InlineArena whose first block is part of the arena itself.
+//
+// Arenas are used by a single thread at a time and only hold objects that do
+// not need their destructor to be called.
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+#include <new>
+
+#include <common/macros.h>
+
+// The size of the first block that an arena allocates in byte (every further
+// block is twice as large as the previous one, up to ARENA_MAX_BLOCK_SIZE)
+#define ARENA_BLOCK_SIZE 4096
+#define ARENA_MAX_BLOCK_SIZE (1 << 20)
+
+// The alignment of every allocation
+#define ARENA_ALIGNMENT 16
+
+class Arena{
+ public:
+  // Constructor (the arena starts with the given buffer, which it does not free)
+  Arena(char* buffer = NULL, size_t size = 0);
+
+  // Destructor
+  ~Arena();
+
+  // Return size bytes of memory (throws std::bad_alloc, also if the memory budget
+  // is exhausted)
+  void* Allocate(size_t size){
+    size = (size + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+    if(size > (size_t) (end_ - next_))
+      return AllocateBlock(size);
+    void* memory = next_;
+    next_ += size;
+    return memory;
+  };
+
+  // Return an array of count objects that need no constructor
+  template <typename T>
+  T* NewArray(size_t count){
+    return static_cast<T*>(Allocate(count * sizeof(T)));
+  };
+
+  // Return a default constructed object
+  template <typename T>
+  T* New(){
+    return new (Allocate(sizeof(T))) T();
+  };
+
+  // Free all memory of the arena (except the buffer passed to the constructor)
+  void Release();
+
+  // Return the number of bytes the arena has taken from the allocator
+  size_t size() const { return size_; };
+
+ private:
+  // The header of a block allocated by the arena
+  struct Block{
+    Block* next;
+    size_t size;
+  };
+
+  // Allocate a new block that holds at least size bytes and return them
+  void* AllocateBlock(size_t size);
+
+  // The blocks of the arena, the latest first
+  Block* blocks_;
+
+  // The free part of the current block
+  char* next_;
+  char* end_;
+
+  // The buffer passed to the constructor
+  char* buffer_;
+  size_t buffer_size_;
+
+  // The size of the next block and the total size of all blocks
+  size_t block_size_;
+  size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(Arena);
+};
+
+// An arena whose first Size bytes are part of the object (e.g. on the stack)
+template <size_t Size>
+class InlineArena : public Arena{
+ public:
+  InlineArena():Arena(buffer_, Size){};
+
+ private:
+  char buffer_[Size] __attribute__ ((aligned (ARENA_ALIGNMENT)));
+};
+
+#endif // _ARENA_H_
@@ -27,16 +27,20 @@ It uses a naive approach to map multidimensional keys to one dimensional keys (i
 #include <pthread.h>
 #include <cstdlib>
 #include <cstring>
+#include <new>
 #include <iostream>
 #include <errno.h>
 #include <sstream>
 
 #include <contest_interface.h>
+#include <contest_extensions.h>
 
 #include "ConnectionManager.h"
-//#include "Mutex.h"
+#include "Mutex.h"
 #include "Index.h"
+#include "IndexOptions.h"
 #include "Iterator.h"
+#include "MemoryBudget.h"
 #include "Util.h"
 
 #define LINE(x) //std::cout<<x<<std::endl<<std::flush
@@ -50,15 +54,26 @@ ErrorCode BeginTransaction(Transaction **tx){
   if(tx == NULL)
     return kErrorGenericFailure;
 
+  DbTxn* txn;
+  IsolationLevel isolation = ConnectionManager::getInstance().isolation();
   try{
-    // Start the new transaction with isolation level read committed
-		ConnectionManager::getInstance().env()->txn_begin(NULL, (DbTxn**) tx, DB_READ_COMMITTED );
+    // Start the new transaction with the current isolation level
+    // (optimistic transactions read a snapshot until their writes are applied)
+		ConnectionManager::getInstance().env()->txn_begin(NULL, &txn,
+        (isolation != kIsolationReadCommitted) ? DB_TXN_SNAPSHOT : DB_READ_COMMITTED);
 	} catch(DbMemoryException &e){
     return kErrorOutOfMemory;
   } catch (DbException &e) {
 			return kErrorGenericFailure;
 	}
 
+  try{
+    *tx = new Transaction(txn, isolation);
+  } catch(std::bad_alloc &e){
+    txn->abort();
+    return kErrorOutOfMemory;
+  }
+
   return kOk;
 };
 
@@ -75,16 +90,17 @@ ErrorCode AbortTransaction(Transaction **tx){
   if((tx == NULL) || (*tx == NULL))
 	  return kErrorTransactionClosed;
   
+  // Abort the transaction and reset the handle (which is closed in any case)
+  ErrorCode res = kOk;
   try{
-    // Abort the transaction and reset the handle
-	  ((DbTxn*) (*tx))->abort();
-    IndexManager::getInstance().CloseTransaction(*tx);
-    (*tx) = NULL;
+	  (*tx)->Abort();
   } catch(DbException &e){
-	  return kErrorGenericFailure;
+	  res = kErrorGenericFailure;
   }
+  delete *tx;
+  (*tx) = NULL;
   
-  return kOk;
+  return res;
 };
 
 /**
@@ -100,21 +116,21 @@ ErrorCode CommitTransaction(Transaction **tx){
   if((tx == NULL) || (*tx == NULL))
 	  return kErrorTransactionClosed;
   
+  // Commit the transaction (Berkeley DB aborts it if the commit fails, an optimistic
+  // transaction is aborted if the validation of its reads fails)
+  ErrorCode res = kOk;
   try{
-    // Commit the transaction
-	  ((DbTxn*) *tx)->commit(0);
-    IndexManager::getInstance().CloseTransaction(*tx);
-    (*tx) = NULL;
-  } catch(DbDeadlockException &e){
-    return kTransactionAborted;
+	  if(!(*tx)->Commit())
+      res = kTransactionAborted;
+  } catch(DbException &e) {
+    res = kTransactionAborted;
+	} catch(std::bad_alloc &e) {
+    res = kTransactionAborted;
   }
-  catch(DbException &e) {
-    if(AbortTransaction(tx) == kOk)
-      return kTransactionAborted;
-        
-		return kErrorGenericFailure;
-	}
-  return kOk;
+  delete *tx;
+  (*tx) = NULL;
+
+  return res;
 };
 
 
@@ -124,27 +140,38 @@ Creates an empty index.
 @see contest_interface.h for details
 */
 ErrorCode CreateIndex(const char* name, uint8_t column_count, KeyType types){
+  return CreateIndexWithOptions(name, column_count, types, NULL);
+}
+
+/*
+Creates an empty index using the given options.
+
+@see contest_extensions.h for details
+*/
+ErrorCode CreateIndexWithOptions(const char* name, uint8_t column_count, KeyType types,
+                                 const IndexOptions *options){
   LINE("CREATE");
 
   // Check that the input values are valid
   if((name == NULL) || (strlen(name) == 0) || (column_count == 0) || (types == NULL))
     return kErrorGenericFailure;
 
+  if(!ValidOptions(column_count, types, options))
+    return kErrorGenericFailure;
+
+  // The structure creates the databases and keeps the handles that are shared by
+  // all index handles (indices using the k-d tree layout are stored lexicographically,
+  // as Berkeley DB only provides b-trees)
+  IndexStructure* structure;
+  try{
+    structure = new IndexStructure(column_count, types, options);
+  } catch (std::bad_alloc &e){
+    return kErrorOutOfMemory;
+  }
   try{
-  	Db db(ConnectionManager::getInstance().env(),0);
-	  
-    // Allow duplicates for this index
-    db.set_flags(DB_DUP);
-
-    // Create the new index
-    db.open(NULL, 		        // Transaction pointer
-				NULL, 					      // File name (NULL, because we want the index to be in-memory)
-				name,					        // Logical db name
-				DB_BTREE,				      // Database type (we use b-tree)
-				DB_CREATE | DB_EXCL,  // Open flags
-				0                     // File mode (defaults)
-				);
+    structure->Create(name);
   } catch (DbException &e){
+    delete structure;
 	  if(e.get_errno() == EEXIST)
 		  return kErrorIndexExists;
     else if(e.get_errno() == ENOMEM)
@@ -154,7 +181,10 @@ ErrorCode CreateIndex(const char* name, uint8_t column_count, KeyType types){
   }
   
   // Insert new Index into the index map
-  IndexManager::getInstance().Insert(name,new IndexStructure(column_count, types));
+  if(!IndexManager::getInstance().Insert(name, structure)){
+    delete structure;
+    return kErrorIndexExists;
+  }
   return kOk;
 }
 
@@ -169,25 +199,12 @@ ErrorCode OpenIndex(const char* name, Index **idx){
   if((name == NULL) || (strlen(name) == 0))
     return kErrorGenericFailure;
   
+  // Open the index (a view of the databases opened by CreateIndex)
 	try{
-    // Open the index
-    if(Index::Open(name,idx) == kErrorUnknownIndex){
-      return kErrorUnknownIndex;
-    };
-  } catch (DbException &e) {
-    // Clean up...
-    delete *idx;
-    *idx = NULL;
-		// And return an appropriate error
-    if(e.get_errno() == ENOENT)
-			return kErrorUnknownIndex;
-    else if(e.get_errno() == ENOMEM)
-      return kErrorOutOfMemory;
-		else
-			return kErrorGenericFailure;
+    return Index::Open(name,idx);
+  } catch (std::bad_alloc &e) {
+    return kErrorOutOfMemory;
   }
-
-  return kOk;
 }
 
 /**
@@ -237,13 +254,20 @@ ErrorCode DeleteIndex(const char* name){
   
   try{
     ErrorCode err;
-    // Try to erase the index structure (closes open db handles)
-    if((err = IndexManager::getInstance().Remove(name)) != kOk)
+    // Try to erase the index structure (closes its handles and the Berkeley DB handles
+    // they share) and remember its secondary indices
+    std::vector<uint8_t> secondary;
+    if((err = IndexManager::getInstance().Remove(name, &secondary)) != kOk)
       return err;
 
-    // And remove the respective Berkeley DB database
+    // And remove the respective Berkeley DB databases
     int res = ConnectionManager::getInstance().env()->dbremove(NULL, NULL,
           name, DB_NOSYNC | DB_AUTO_COMMIT | DB_LOG_NO_DATA);
+    for(size_t i = 0; i < secondary.size(); i++){
+      ConnectionManager::getInstance().env()->dbremove(NULL, NULL,
+          IndexStructure::SecondaryName(name, secondary[i]).c_str(),
+          DB_NOSYNC | DB_AUTO_COMMIT | DB_LOG_NO_DATA);
+    }
   } catch (DbException &e){
 	  if(e.get_errno() == ENOENT)
 		  return kErrorUnknownIndex;
@@ -279,11 +303,45 @@ ErrorCode InsertRecord(Transaction *tx,Index *idx, Record *record){
     if(e.get_errno() == ENOMEM)
       return kErrorOutOfMemory;
 	  return kErrorGenericFailure;
-	}
+	} catch (std::bad_alloc &e){
+    return kErrorOutOfMemory;
+  }
 
   return kOk;
 }
 
+/**
+Inserts a batch of records into the index.
+
+@see contest_extensions.h for details
+*/
+ErrorCode InsertRecords(Transaction *tx, Index *idx, Record *records, uint32_t count){
+  LINE("INSERT RECORDS");
+  // Check that all input values are valid
+  if((idx == NULL) || (idx->closed()))
+    return kErrorUnknownIndex;
+
+  if((records == NULL) && (count > 0))
+    return kErrorGenericFailure;
+
+  for(uint32_t i = 0; i < count; i++){
+    if(!idx->Compatible(&records[i]))
+      return kErrorIncompatibleKey;
+  }
+
+  try {
+    return idx->InsertRecords(tx, records, count);
+  } catch (DbDeadlockException &e){
+    return kErrorDeadlock;
+  } catch (DbException &e){
+    if(e.get_errno() == ENOMEM)
+      return kErrorOutOfMemory;
+    return kErrorGenericFailure;
+  } catch (std::bad_alloc &e){
+    return kErrorOutOfMemory;
+  }
+}
+
 /**
 Searches for a key/value combination given as a record and updates its value.
 
@@ -312,6 +370,8 @@ ErrorCode UpdateRecord(Transaction *tx, Index *idx, Record *record, Block *new_p
     if(e.get_errno() == ENOMEM)
       return kErrorOutOfMemory;
     return kErrorGenericFailure;
+  } catch (std::bad_alloc &e) {
+    return kErrorOutOfMemory;
   }
   LINE("$UPDATE");
   return kOk;
@@ -339,7 +399,11 @@ ErrorCode DeleteRecord(Transaction *tx, Index *idx, Record *record, uint8_t flag
   } catch (DbDeadlockException &de) {
     return kErrorDeadlock;
   } catch (DbException &e) {
+    if(e.get_errno() == ENOMEM)
+      return kErrorOutOfMemory;
     return kErrorGenericFailure;
+  } catch (std::bad_alloc &e) {
+    return kErrorOutOfMemory;
   }
   return kOk;
 
@@ -364,6 +428,10 @@ ErrorCode GetRecords(Transaction *tx,Index *idx, Key min_keys, Key max_keys, Ite
     return kErrorGenericFailure;
 
   try {
+    // An optimistic transaction has to see its own writes
+    if((tx != NULL) && !tx->Prepare(idx))
+      return kErrorDeadlock;
+
     // Create the new Iterator
     *it = new Iterator(tx,idx,min_keys,max_keys);
   } catch (DbDeadlockException &de) {
@@ -374,6 +442,8 @@ ErrorCode GetRecords(Transaction *tx,Index *idx, Key min_keys, Key max_keys, Ite
     if(*it)
       (*it)->Close();
     return kErrorGenericFailure;
+  } catch (std::bad_alloc &e) {
+    return kErrorOutOfMemory;
   }
   
   return kOk;
@@ -413,6 +483,8 @@ ErrorCode GetNext(Iterator *it, Record** record){
     return kErrorDeadlock;
   } catch (DbException &e) {
     return kErrorGenericFailure;
+  } catch (std::bad_alloc &e) {
+    return kErrorOutOfMemory;
   }
   return kOk;
 }
@@ -443,9 +515,105 @@ ErrorCode CloseIterator(Iterator **it){
   return result;
 }
 
+/**
+Returns the movements of all iterators that have been closed so far.
+
+@see contest_extensions.h for details
+*/
+ErrorCode GetIteratorStats(IteratorStats *stats){
+  if(stats == NULL)
+    return kErrorGenericFailure;
+
+  Iterator::stats(&stats->steps, &stats->seeks);
+  return kOk;
+}
+
+/**
+Writes a report on the contention of all locks to a file.
+
+@see contest_extensions.h for details
+*/
+ErrorCode WriteLockReport(const char *path){
+  if(path == NULL)
+    return kErrorGenericFailure;
+
+  return LockProfile::WriteReport(path) ? kOk : kErrorGenericFailure;
+}
+
+/**
+Sets the isolation level of all transactions and iterators started afterwards.
+
+@see contest_extensions.h for details
+*/
+ErrorCode SetIsolationLevel(IsolationLevel level){
+  if((level != kIsolationReadCommitted) && (level != kIsolationSnapshot)
+      && (level != kIsolationOptimistic))
+    return kErrorGenericFailure;
+
+  // Snapshots need the old versions of pages, which are only kept if the environment
+  // has been started with a level reading snapshots
+  ConnectionManager& manager = ConnectionManager::getInstance();
+  if((level != kIsolationReadCommitted) && !manager.multiversion())
+    return kErrorGenericFailure;
+
+  manager.set_isolation(level);
+  return kOk;
+}
+
+/**
+Returns the counters of all optimistic transactions and autocommit retries.
+
+@see contest_extensions.h for details
+*/
+ErrorCode GetTransactionStats(TransactionStats *stats){
+  if(stats == NULL)
+    return kErrorGenericFailure;
+
+  Transaction::stats(stats);
+  return kOk;
+}
+
+/**
+Returns the memory used by the library.
+
+@see contest_extensions.h for details
+*/
+ErrorCode GetMemoryUsage(MemoryUsage *usage){
+  if(usage == NULL)
+    return kErrorGenericFailure;
+
+  MemoryBudget::getInstance().usage(usage);
+  return kOk;
+}
 
+/**
+Sets the memory limit of the library.
 
+@see contest_extensions.h for details
+*/
+ErrorCode SetMemoryLimit(uint64_t bytes){
+  MemoryBudget::getInstance().set_limit(bytes);
+  return kOk;
+}
 
+/**
+Returns the memory footprint of an index.
 
+@see contest_extensions.h for details
+*/
+ErrorCode GetIndexFootprint(const char* name, IndexFootprint *footprint){
+  if((name == NULL) || (footprint == NULL))
+    return kErrorGenericFailure;
 
+  IndexManager::Pin pin;
+  IndexStructure* structure = IndexManager::getInstance().Find(name, &pin);
+  if(structure == NULL)
+    return kErrorUnknownIndex;
 
+  try {
+    structure->footprint(footprint);
+  } catch (DbException &e) {
+    return kErrorGenericFailure;
+  }
+  return kOk;
+}
@@ -0,0 +1,480 @@
+#include "BTree.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <cstdlib>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+
+// The targeted size of a node in byte (nodes hold at least kMinCapacity keys)
+static const size_t kNodeSize = 4096;
+static const int kMinCapacity = 8;
+
+// A node of the tree
+//
+// Inner nodes hold count keys and count+1 children, where child i covers all keys
+// that are less than key i and not less than key i-1. Leaves hold count keys,
+// each of them with its chain of entries.
+struct BTree::Node {
+  // The reader/writer latch protecting this node
+  pthread_rwlock_t latch;
+
+  // Whether this node is a leaf (never changes after creation)
+  bool leaf;
+
+  // The number of keys inside this node
+  int count;
+
+  // The right sibling of a leaf
+  Node* next;
+
+  // The children (inner nodes) or entry chains (leaves)
+  void** ptrs;
+
+  // The keys of this node
+  char* keys;
+};
+
+BTree::BTree(uint8_t attribute_count, KeyType type) : Tree(attribute_count, type){
+  // Fit as many keys as possible into a node
+  capacity_ = (kNodeSize - sizeof(Node)) / (key_size_ + sizeof(void*));
+  if(capacity_ < kMinCapacity)
+    capacity_ = kMinCapacity;
+
+  pthread_rwlock_init(&root_latch_, NULL);
+  root_ = NewNode(true);
+}
+
+BTree::~BTree(){
+  // Close all open Handles of this structure
+  CloseHandles();
+  FreeNode(root_);
+  pthread_rwlock_destroy(&root_latch_);
+}
+
+size_t BTree::node_size() const{
+  return sizeof(Node) + (capacity_ + 1) * sizeof(void*) + capacity_ * key_size_;
+}
+
+BTree::Node* BTree::NewNode(bool leaf){
+  size_t ptrs = (capacity_ + 1) * sizeof(void*);
+  char* memory = (char*) malloc(node_size());
+  if(memory == NULL)
+    throw std::bad_alloc();
+  CountNodeBytes(node_size());
+
+  Node* node = (Node*) memory;
+  pthread_rwlock_init(&node->latch, NULL);
+  node->leaf = leaf;
+  node->count = 0;
+  node->next = NULL;
+  node->ptrs = (void**) (memory + sizeof(Node));
+  node->keys = memory + sizeof(Node) + ptrs;
+  return node;
+}
+
+void BTree::FreeNode(Node* node){
+  if(node->leaf){
+    // Free all entry chains
+    for(int i = 0; i < node->count; i++)
+      FreeChain((Entry*) node->ptrs[i]);
+  } else {
+    for(int i = 0; i <= node->count; i++)
+      FreeNode((Node*) node->ptrs[i]);
+  }
+  pthread_rwlock_destroy(&node->latch);
+  free(node);
+  CountNodeBytes(-(int64_t) node_size());
+}
+
+int BTree::LowerBound(const Node* node, const char* key) const{
+  int low = 0, high = node->count;
+  while(low < high){
+    int mid = (low + high) / 2;
+    if(memcmp(node->keys + mid * key_size_, key, key_size_) < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+int BTree::ChildIndex(const Node* node, const char* key) const{
+  // Find the first key that is greater than the given key
+  int low = 0, high = node->count;
+  while(low < high){
+    int mid = (low + high) / 2;
+    if(memcmp(node->keys + mid * key_size_, key, key_size_) <= 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+// Latch a node in the requested mode
+static inline void Latch(pthread_rwlock_t* latch, bool exclusive){
+  if(exclusive)
+    pthread_rwlock_wrlock(latch);
+  else
+    pthread_rwlock_rdlock(latch);
+}
+
+BTree::Node* BTree::FindLeaf(const char* key, bool exclusive){
+  pthread_rwlock_rdlock(&root_latch_);
+  Node* node = root_;
+  Latch(&node->latch, exclusive && node->leaf);
+  pthread_rwlock_unlock(&root_latch_);
+
+  // Descend using latch coupling (only the leaf is latched exclusively)
+  while(!node->leaf){
+    Node* child = (Node*) node->ptrs[ChildIndex(node, key)];
+    Latch(&child->latch, exclusive && child->leaf);
+    pthread_rwlock_unlock(&node->latch);
+    node = child;
+  }
+  return node;
+}
+
+void BTree::InsertIntoLeaf(Node* leaf, int pos, const char* key, Entry* entry){
+  assert(leaf->count < capacity_);
+  char* slot = leaf->keys + pos * key_size_;
+  memmove(slot + key_size_, slot, (leaf->count - pos) * key_size_);
+  memmove(leaf->ptrs + pos + 1, leaf->ptrs + pos, (leaf->count - pos) * sizeof(void*));
+  memcpy(slot, key, key_size_);
+  leaf->ptrs[pos] = entry;
+  leaf->count++;
+  CountKey(key, 1);
+}
+
+void BTree::Insert(const char* key, Entry* entry){
+  // Optimistic attempt: only the leaf is latched exclusively
+  Node* leaf = FindLeaf(key, true);
+  int pos = LowerBound(leaf, key);
+  if((pos < leaf->count) && (memcmp(leaf->keys + pos * key_size_, key, key_size_) == 0)){
+    AppendEntry((Entry**) &leaf->ptrs[pos], entry);
+    pthread_rwlock_unlock(&leaf->latch);
+    return;
+  }
+  if(leaf->count < capacity_){
+    InsertIntoLeaf(leaf, pos, key, entry);
+    pthread_rwlock_unlock(&leaf->latch);
+    return;
+  }
+  pthread_rwlock_unlock(&leaf->latch);
+
+  // The leaf has to be split
+  InsertPessimistic(key, entry);
+}
+
+void BTree::InsertPessimistic(const char* key, Entry* entry){
+  // The nodes that are latched exclusively (each of them might have to be split)
+  std::vector<Node*> path;
+
+  pthread_rwlock_wrlock(&root_latch_);
+  bool root_latched = true;
+  Node* node = root_;
+  pthread_rwlock_wrlock(&node->latch);
+  if(node->count < capacity_){
+    pthread_rwlock_unlock(&root_latch_);
+    root_latched = false;
+  }
+  path.push_back(node);
+
+  while(!node->leaf){
+    Node* child = (Node*) node->ptrs[ChildIndex(node, key)];
+    pthread_rwlock_wrlock(&child->latch);
+
+    // A node that has room for one more key will not split,
+    // so all latches above it can be released
+    if(child->count < capacity_){
+      for(size_t i = 0; i < path.size(); i++)
+        pthread_rwlock_unlock(&path[i]->latch);
+      path.clear();
+      if(root_latched){
+        pthread_rwlock_unlock(&root_latch_);
+        root_latched = false;
+      }
+    }
+    path.push_back(child);
+    node = child;
+  }
+
+  Node* leaf = node;
+  int pos = LowerBound(leaf, key);
+  if((pos < leaf->count) && (memcmp(leaf->keys + pos * key_size_, key, key_size_) == 0)){
+    AppendEntry((Entry**) &leaf->ptrs[pos], entry);
+  } else if(leaf->count < capacity_){
+    InsertIntoLeaf(leaf, pos, key, entry);
+  } else {
+    // Split the leaf (the left half keeps mid keys)
+    int mid = (capacity_ + 1) / 2;
+    Node* right = NewNode(true);
+    int from = (pos < mid) ? mid - 1 : mid;
+    right->count = capacity_ - from;
+    memcpy(right->keys, leaf->keys + from * key_size_, right->count * key_size_);
+    memcpy(right->ptrs, leaf->ptrs + from, right->count * sizeof(void*));
+    leaf->count = from;
+    if(pos < mid)
+      InsertIntoLeaf(leaf, pos, key, entry);
+    else
+      InsertIntoLeaf(right, pos - mid, key, entry);
+    right->next = leaf->next;
+    leaf->next = right;
+
+    // Propagate the separator to the latched ancestors
+    std::vector<char> separator(right->keys, right->keys + key_size_);
+    std::vector<char> keys((capacity_ + 1) * key_size_);
+    std::vector<void*> children(capacity_ + 2);
+    Node* child = right;
+    int level = (int) path.size() - 2;
+    for(; level >= 0; level--){
+      Node* parent = path[level];
+      int i = ChildIndex(parent, &separator[0]);
+      if(parent->count < capacity_){
+        char* slot = parent->keys + i * key_size_;
+        memmove(slot + key_size_, slot, (parent->count - i) * key_size_);
+        memmove(parent->ptrs + i + 2, parent->ptrs + i + 1, (parent->count - i) * sizeof(void*));
+        memcpy(slot, &separator[0], key_size_);
+        parent->ptrs[i + 1] = child;
+        parent->count++;
+        child = NULL;
+        break;
+      }
+
+      // Split the inner node: build the overfull node in scratch space first
+      memcpy(&keys[0], parent->keys, i * key_size_);
+      memcpy(&keys[(i + 1) * key_size_], parent->keys + i * key_size_, (capacity_ - i) * key_size_);
+      memcpy(&keys[i * key_size_], &separator[0], key_size_);
+      memcpy(&children[0], parent->ptrs, (i + 1) * sizeof(void*));
+      memcpy(&children[i + 2], parent->ptrs + i + 1, (capacity_ - i) * sizeof(void*));
+      children[i + 1] = child;
+
+      int up = (capacity_ + 1) / 2;
+      Node* sibling = NewNode(false);
+      parent->count = up;
+      memcpy(parent->keys, &keys[0], up * key_size_);
+      memcpy(parent->ptrs, &children[0], (up + 1) * sizeof(void*));
+      sibling->count = capacity_ - up;
+      memcpy(sibling->keys, &keys[(up + 1) * key_size_], sibling->count * key_size_);
+      memcpy(sibling->ptrs, &children[up + 1], (sibling->count + 1) * sizeof(void*));
+      memcpy(&separator[0], &keys[up * key_size_], key_size_);
+      child = sibling;
+    }
+
+    // The root itself has been split
+    if(child != NULL){
+      assert(root_latched && (path[0] == root_));
+      Node* root = NewNode(false);
+      root->count = 1;
+      memcpy(root->keys, &separator[0], key_size_);
+      root->ptrs[0] = root_;
+      root->ptrs[1] = child;
+      root_ = root;
+    }
+  }
+
+  for(size_t i = 0; i < path.size(); i++)
+    pthread_rwlock_unlock(&path[i]->latch);
+  if(root_latched)
+    pthread_rwlock_unlock(&root_latch_);
+}
+
+BTree::Node* BTree::BuildTree(const char* const* keys, Entry* const* entries, size_t count){
+  // Nodes are left a quarter empty, so that the following inserts do not split them right away
+  int fill = capacity_ - capacity_ / 4;
+
+  // All nodes that have been allocated (freed again if an allocation fails)
+  std::vector<Node*> nodes;
+
+  // The nodes of the current level and the smallest key below each of them
+  std::vector<Node*> level;
+  std::vector<const char*> lows;
+  try {
+    // Fill the leaves from left to right (equal keys share a chain)
+    Node* leaf = NULL;
+    for(size_t i = 0; i < count; i++){
+      if((leaf != NULL) && (memcmp(leaf->keys + (leaf->count - 1) * key_size_, keys[i], key_size_) == 0)){
+        entries[i-1]->next = entries[i];
+        continue;
+      }
+      if((leaf == NULL) || (leaf->count == fill)){
+        Node* node = NewNode(true);
+        nodes.push_back(node);
+        if(leaf != NULL)
+          leaf->next = node;
+        leaf = node;
+        level.push_back(leaf);
+        lows.push_back(keys[i]);
+      }
+      memcpy(leaf->keys + leaf->count * key_size_, keys[i], key_size_);
+      leaf->ptrs[leaf->count] = entries[i];
+      leaf->count++;
+    }
+
+    // Every inner node separates its children by their smallest keys
+    while(level.size() > 1){
+      std::vector<Node*> parents;
+      std::vector<const char*> parent_lows;
+      for(size_t i = 0; i < level.size(); ){
+        // Do not leave a single child for the last node
+        size_t children = std::min(level.size() - i, (size_t) fill + 1);
+        if(level.size() - i - children == 1)
+          children++;
+
+        Node* parent = NewNode(false);
+        nodes.push_back(parent);
+        parent->ptrs[0] = level[i];
+        for(size_t j = 1; j < children; j++){
+          memcpy(parent->keys + (j - 1) * key_size_, lows[i + j], key_size_);
+          parent->ptrs[j] = level[i + j];
+        }
+        parent->count = children - 1;
+        parents.push_back(parent);
+        parent_lows.push_back(lows[i]);
+        i += children;
+      }
+      level.swap(parents);
+      lows.swap(parent_lows);
+    }
+  } catch(std::bad_alloc &e){
+    for(size_t i = 0; i < nodes.size(); i++){
+      pthread_rwlock_destroy(&nodes[i]->latch);
+      free(nodes[i]);
+      CountNodeBytes(-(int64_t) node_size());
+    }
+    for(size_t i = 0; i < count; i++)
+      entries[i]->next = NULL;
+    throw;
+  }
+
+  // Count the keys once the tree is complete
+  for(size_t i = 0; i < count; i++){
+    if((i == 0) || (memcmp(keys[i-1], keys[i], key_size_) != 0))
+      CountKey(keys[i], 1);
+  }
+  return level[0];
+}
+
+void BTree::InsertBatch(const char* const* keys, Entry* const* entries, size_t count,
+                        size_t* inserted){
+  *inserted = 0;
+  if(count == 0)
+    return;
+
+  // An empty tree is replaced by a tree that is built bottom-up. Holding the root latch
+  // and the latch of the old root makes sure that no reader is left inside of it.
+  pthread_rwlock_wrlock(&root_latch_);
+  Node* old = root_;
+  pthread_rwlock_wrlock(&old->latch);
+  if(old->leaf && (old->count == 0)){
+    try {
+      root_ = BuildTree(keys, entries, count);
+    } catch(std::bad_alloc &e){
+      pthread_rwlock_unlock(&old->latch);
+      pthread_rwlock_unlock(&root_latch_);
+      throw;
+    }
+    pthread_rwlock_unlock(&old->latch);
+    pthread_rwlock_unlock(&root_latch_);
+    FreeNode(old);
+    *inserted = count;
+    return;
+  }
+  pthread_rwlock_unlock(&old->latch);
+  pthread_rwlock_unlock(&root_latch_);
+
+  // Otherwise every descent inserts all following keys that belong to the same leaf
+  while(*inserted < count){
+    size_t first = *inserted;
+    Node* leaf = FindLeaf(keys[first], true);
+
+    // The leaf covers all keys up to its last one (the rightmost leaf all keys behind it)
+    bool rightmost = (leaf->next == NULL);
+    bool split = false;
+    for(size_t i = first; i < count; i++){
+      int pos = LowerBound(leaf, keys[i]);
+      if((pos < leaf->count) && (memcmp(leaf->keys + pos * key_size_, keys[i], key_size_) == 0)){
+        AppendEntry((Entry**) &leaf->ptrs[pos], entries[i]);
+      } else if((pos == leaf->count) && !rightmost && (i > first)){
+        break;
+      } else if(leaf->count < capacity_){
+        InsertIntoLeaf(leaf, pos, keys[i], entries[i]);
+      } else {
+        split = (i == first);
+        break;
+      }
+      (*inserted)++;
+    }
+    pthread_rwlock_unlock(&leaf->latch);
+
+    if(split){
+      InsertPessimistic(keys[first], entries[first]);
+      (*inserted)++;
+    }
+  }
+}
+
+ErrorCode BTree::Modify(const char* key, ChainModifier* modifier){
+  Node* leaf = FindLeaf(key, true);
+  int pos = LowerBound(leaf, key);
+  if((pos >= leaf->count) || (memcmp(leaf->keys + pos * key_size_, key, key_size_) != 0)){
+    pthread_rwlock_unlock(&leaf->latch);
+    return kErrorNotFound;
+  }
+
+  ErrorCode result = ModifyChain((Entry**) &leaf->ptrs[pos], modifier);
+
+  // Drop the key if its last entry has been removed
+  if(leaf->ptrs[pos] == NULL){
+    char* slot = leaf->keys + pos * key_size_;
+    CountKey(slot, -1);
+    memmove(slot, slot + key_size_, (leaf->count - pos - 1) * key_size_);
+    memmove(leaf->ptrs + pos, leaf->ptrs + pos + 1, (leaf->count - pos - 1) * sizeof(void*));
+    leaf->count--;
+  }
+  pthread_rwlock_unlock(&leaf->latch);
+  return result;
+}
+
+bool BTree::Scan(const char* from, bool exclusive, const char* to, ChainVisitor* visitor){
+  Node* leaf = FindLeaf(from, false);
+  int pos = LowerBound(leaf, from);
+  if(exclusive && (pos < leaf->count) && (memcmp(leaf->keys + pos * key_size_, from, key_size_) == 0))
+    pos++;
+
+  while(true){
+    for(; pos < leaf->count; pos++){
+      const char* key = leaf->keys + pos * key_size_;
+      if(memcmp(key, to, key_size_) > 0){
+        pthread_rwlock_unlock(&leaf->latch);
+        return true;
+      }
+      if(!visitor->Visit(key, (const Entry*) leaf->ptrs[pos])){
+        pthread_rwlock_unlock(&leaf->latch);
+        return false;
+      }
+    }
+
+    // Move on to the right sibling (latch coupling from left to right)
+    Node* next = leaf->next;
+    if(next == NULL){
+      pthread_rwlock_unlock(&leaf->latch);
+      return true;
+    }
+    pthread_rwlock_rdlock(&next->latch);
+    pthread_rwlock_unlock(&leaf->latch);
+    leaf = next;
+    pos = 0;
+  }
+}
+
+bool BTree::Search(const char* min, const char* max, const char* after, ChainVisitor* visitor,
+                   SearchState** state){
+  // Keys are sorted by their first attribute, so only the corners limit the scan
+  if(after != NULL)
+    return Scan(after, true, max, visitor);
+  return Scan(min, false, max, visitor);
+}
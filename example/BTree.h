@@ -0,0 +1,87 @@
+#ifndef _BTREE_H_
+#define _BTREE_H_
+
+#include <pthread.h>
+
+#include "Tree.h"
+
+/**
+ * A concurrent in-memory B+-tree over the binary keys of Tree.
+ *
+ * Nodes are protected by reader/writer latches using latch coupling. Inserts first try
+ * an optimistic descent that only latches the leaf exclusively and fall back to a
+ * pessimistic descent if the leaf has to be split. Nodes are never merged, so leaves
+ * that became empty stay in place until the tree is destroyed.
+ */
+class BTree : public Tree {
+ public:
+  // Constructor
+  BTree(uint8_t attribute_count, KeyType type);
+
+  // Destructor
+  ~BTree();
+
+  // Appends an entry to the chain of the given key (creating the key if necessary)
+  void Insert(const char* key, Entry* entry);
+
+  // Appends the entries to the chains of the given (sorted) keys: an empty tree is built
+  // bottom-up, otherwise all keys that fall into the same leaf are inserted at once
+  void InsertBatch(const char* const* keys, Entry* const* entries, size_t count,
+                   size_t* inserted);
+
+  // Runs the modifier on the chain of the given key (returns kErrorNotFound if the key is unknown)
+  ErrorCode Modify(const char* key, ChainModifier* modifier);
+
+  // Visits all keys in [from, to] (or (from, to] if exclusive is set) in ascending order
+  // Returns true if the end of the range has been reached
+  bool Scan(const char* from, bool exclusive, const char* to, ChainVisitor* visitor);
+
+  // Visits the keys between the corners of the box (the box itself is checked by the visitor,
+  // a search is continued behind after, so no state is needed)
+  bool Search(const char* min, const char* max, const char* after, ChainVisitor* visitor,
+              SearchState** state);
+
+ private:
+  struct Node;
+
+  // Allocates a new node
+  Node* NewNode(bool leaf);
+
+  // Return the size of a node in byte (the header, the pointers and the keys)
+  size_t node_size() const;
+
+  // Frees a subtree
+  void FreeNode(Node* node);
+
+  // Return the position of the first key in node that is not less than key
+  int LowerBound(const Node* node, const char* key) const;
+
+  // Return the index of the child of an inner node that covers key
+  int ChildIndex(const Node* node, const char* key) const;
+
+  // Descends to the leaf covering key and returns it latched (exclusive or shared)
+  Node* FindLeaf(const char* key, bool exclusive);
+
+  // Inserts an entry into a latched leaf that is known to have room for the key
+  void InsertIntoLeaf(Node* leaf, int pos, const char* key, Entry* entry);
+
+  // Inserts an entry with latch coupling, splitting nodes on the way up
+  void InsertPessimistic(const char* key, Entry* entry);
+
+  // Builds the levels of a new tree holding the given sorted keys from the leaves up
+  // and returns its root
+  Node* BuildTree(const char* const* keys, Entry* const* entries, size_t count);
+
+  // The maximum number of keys inside a node
+  int capacity_;
+
+  // The root of the tree
+  Node* root_;
+
+  // Protects the root pointer
+  pthread_rwlock_t root_latch_;
+
+  DISALLOW_COPY_AND_ASSIGN(BTree);
+};
+
+#endif // _BTREE_H_
@@ -0,0 +1,460 @@
+/*
+Copyright (c) 2011 TU Dresden - Database Technology Group
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/** @file
+An implementation of the contest interface using native in-memory trees (see example/BTree.h
+and example/KDTree.h).
+
+Like the Berkeley DB implementation it concatenates all key attributes to form a one dimensional
+key, but it stores them in fixed-width, memcmp-comparable slots and does not need an external library.
+Transactions keep their changes in the tree and mark the modified records as owned; other
+transactions do not see these changes before commit. Conflicting writes fail with kErrorDeadlock
+instead of waiting for the owner.
+*/
+#include <stdio.h>
+#include <cstring>
+#include <new>
+
+#include <contest_interface.h>
+#include <contest_extensions.h>
+
+#include "BTree.h"
+#include "KDTree.h"
+#include "BTreeIndex.h"
+#include "BTreeIterator.h"
+#include "IndexOptions.h"
+
+/**
+Starts a new transaction and sets the corresponding handle (tx).
+
+@see contest_interface.h for details
+*/
+ErrorCode BeginTransaction(Transaction **tx){
+  if(tx == NULL)
+    return kErrorGenericFailure;
+
+  try{
+    *tx = new Transaction();
+  } catch(std::bad_alloc &e){
+    return kErrorOutOfMemory;
+  }
+
+  return kOk;
+};
+
+/**
+ Aborts the given transaction and rolls back all changes
+ made during the course of this transaction.
+
+ @see contest_interface.h for details
+ */
+ErrorCode AbortTransaction(Transaction **tx){
+  // Check that the given transaction is valid
+  if((tx == NULL) || (*tx == NULL))
+    return kErrorTransactionClosed;
+
+  (*tx)->Abort();
+  delete *tx;
+  (*tx) = NULL;
+
+  return kOk;
+};
+
+/**
+ Ends the given transaction and persists all changes
+ made during the course of this transaction.
+
+ @see contest_interface.h for details
+ */
+ErrorCode CommitTransaction(Transaction **tx){
+  // Check that the given transaction is valid
+  if((tx == NULL) || (*tx == NULL))
+    return kErrorTransactionClosed;
+
+  (*tx)->Commit();
+  delete *tx;
+  (*tx) = NULL;
+
+  return kOk;
+};
+
+
+/*
+Creates an empty index.
+
+@see contest_interface.h for details
+*/
+ErrorCode CreateIndex(const char* name, uint8_t column_count, KeyType types){
+  return CreateIndexWithOptions(name, column_count, types, NULL);
+}
+
+/*
+Creates an empty index using the given options.
+
+@see contest_extensions.h for details
+*/
+ErrorCode CreateIndexWithOptions(const char* name, uint8_t column_count, KeyType types,
+                                 const IndexOptions *options){
+  // Check that the input values are valid
+  if((name == NULL) || (strlen(name) == 0) || (column_count == 0) || (types == NULL))
+    return kErrorGenericFailure;
+
+  // Only the k-d tree layout has an own structure, all other options are only validated
+  if(!ValidOptions(column_count, types, options))
+    return kErrorGenericFailure;
+
+  // The trees always return their records in ascending order by their key, so they
+  // cannot stand in for the Z-order layout (which returns them in curve order)
+  if((options != NULL) && (options->layout == kLayoutZOrder))
+    return kErrorGenericFailure;
+
+  try{
+    Tree* tree;
+    if((options != NULL) && (options->layout == kLayoutKdTree))
+      tree = new KDTree(column_count, types);
+    else
+      tree = new BTree(column_count, types);
+
+    // Insert the new tree into the tree map
+    if(!BTreeManager::getInstance().Insert(name, tree)){
+      delete tree;
+      return kErrorIndexExists;
+    }
+  } catch(std::bad_alloc &e){
+    return kErrorOutOfMemory;
+  }
+
+  return kOk;
+}
+
+/**
+Opens an index specified by its name to be used by the current thread
+
+@see contest_interface.h for details
+*/
+ErrorCode OpenIndex(const char* name, Index **idx){
+  // Check that the given name is valid
+  if((name == NULL) || (strlen(name) == 0) || (idx == NULL))
+    return kErrorGenericFailure;
+
+  try{
+    // Open the index
+    return Index::Open(name, idx);
+  } catch(std::bad_alloc &e){
+    return kErrorOutOfMemory;
+  }
+}
+
+/**
+Closes an specified index on this thread.
+
+@see contest_interface.h for Details
+*/
+ErrorCode CloseIndex(Index **idx){
+  // Check that the given index handle is valid
+  if((idx == NULL) || (*idx == NULL))
+    return kErrorUnknownIndex;
+
+  ErrorCode result = kOk;
+
+  // If the index handle has been closed already,
+  // but was not deleted, delete it
+  if((*idx)->closed())
+    result = kErrorUnknownIndex;
+
+  // Close the index
+  delete *idx;
+  *idx = NULL;
+
+  return result;
+}
+
+/*
+Deletes an given index and frees all its resources.
+
+@see contest_interface.h for details
+*/
+ErrorCode DeleteIndex(const char* name){
+  // Check that the given name is valid
+  if((name == NULL) || (strlen(name) == 0))
+    return kErrorGenericFailure;
+
+  // Try to erase the tree (closes open handles)
+  return BTreeManager::getInstance().Remove(name);
+}
+
+/**
+Inserts a record (representing a multidimensional key and an associated payload)
+into the index.
+
+@see contest_interface.h for details
+*/
+ErrorCode InsertRecord(Transaction *tx, Index *idx, Record *record){
+  // Check that all input values are valid
+  if((idx == NULL) || (idx->closed()))
+    return kErrorUnknownIndex;
+
+  if(!idx->Compatible(record))
+    return kErrorIncompatibleKey;
+
+  try{
+    return idx->Insert(tx, record);
+  } catch(std::bad_alloc &e){
+    return kErrorOutOfMemory;
+  }
+}
+
+/**
+Inserts a batch of records into the index.
+
+@see contest_extensions.h for details
+*/
+ErrorCode InsertRecords(Transaction *tx, Index *idx, Record *records, uint32_t count){
+  // Check that all input values are valid
+  if((idx == NULL) || (idx->closed()))
+    return kErrorUnknownIndex;
+
+  if((records == NULL) && (count > 0))
+    return kErrorGenericFailure;
+
+  for(uint32_t i = 0; i < count; i++){
+    if(!idx->Compatible(&records[i]))
+      return kErrorIncompatibleKey;
+  }
+
+  try{
+    return idx->InsertRecords(tx, records, count);
+  } catch(std::bad_alloc &e){
+    return kErrorOutOfMemory;
+  }
+}
+
+/**
+Searches for a key/value combination given as a record and updates its value.
+
+@see contest_interface.h for details
+*/
+ErrorCode UpdateRecord(Transaction *tx, Index *idx, Record *record, Block *new_payload, uint8_t flags){
+  // Check that all input values are valid
+  if((idx == NULL) || (idx->closed()))
+    return kErrorUnknownIndex;
+
+  if(!idx->Compatible(record))
+    return kErrorIncompatibleKey;
+
+  if(new_payload == NULL)
+    return kErrorGenericFailure;
+
+  try{
+    return idx->Update(tx, record, new_payload, flags);
+  } catch(std::bad_alloc &e){
+    return kErrorOutOfMemory;
+  }
+}
+
+/**
+Searches for a record and removes it from the index
+
+@see contest_interface.h for details
+*/
+ErrorCode DeleteRecord(Transaction *tx, Index *idx, Record *record, uint8_t flags){
+  // Check that all input values are valid
+  if((idx == NULL) || (idx->closed()))
+    return kErrorUnknownIndex;
+
+  if(!idx->Compatible(record))
+    return kErrorIncompatibleKey;
+
+  try{
+    return idx->Delete(tx, record, flags);
+  } catch(std::bad_alloc &e){
+    return kErrorOutOfMemory;
+  }
+}
+
+/**
+Returns an \ref Iterator that starts at the first value of the given minimum
+multidimensional key.
+
+@see contest_interface.h for details
+*/
+ErrorCode GetRecords(Transaction *tx, Index *idx, Key min_keys, Key max_keys, Iterator **it){
+  // Check that all input values are valid
+  if((idx == NULL) || (idx->closed()))
+    return kErrorUnknownIndex;
+
+  if(!idx->Compatible(min_keys) || !idx->Compatible(max_keys))
+    return kErrorIncompatibleKey;
+
+  if(it == NULL)
+    return kErrorGenericFailure;
+
+  try{
+    // Create the new Iterator
+    *it = new Iterator(tx, idx, min_keys, max_keys);
+  } catch(std::bad_alloc &e){
+    return kErrorOutOfMemory;
+  }
+
+  return kOk;
+}
+
+/**
+Moves the iterator to the next record or reports an end of range (by returning
+an \ref kErrorNotFound status), if the maximum multidimensional key is exceeded.
+
+@see contest_interface.h for details
+*/
+ErrorCode GetNext(Iterator *it, Record** record){
+  // Check that all input values are valid
+  if(record == NULL)
+    return kErrorGenericFailure;
+
+  if((it == NULL) || (it->closed()))
+    return kErrorIteratorClosed;
+
+  try{
+    // Fetch the next record
+    if(!it->Next())
+      return kErrorGenericFailure;
+  } catch(std::bad_alloc &e){
+    return kErrorOutOfMemory;
+  }
+
+  // If the iterator reached it's end, no record was found
+  if(it->end()){
+    *record = NULL;
+    return kErrorNotFound;
+  }
+
+  // Set the record to the retrieved record
+  *record = it->value();
+  return kOk;
+}
+
+/**
+Closes the given iterator and frees all of its resources.
+
+@see contest_interface.h for details
+*/
+ErrorCode CloseIterator(Iterator **it){
+  // Check that all input values are valid
+  if((it == NULL) || (*it == NULL))
+    return kErrorIteratorClosed;
+
+  ErrorCode result = kOk;
+
+  // If the record is already closed we just clean up
+  if((*it)->closed())
+    result = kErrorIteratorClosed;
+  else
+    (*it)->Close();
+
+  delete *it;
+  *it = NULL;
+
+  return result;
+}
+
+/**
+Returns the movements of all iterators that have been closed so far.
+
+@see contest_extensions.h for details
+*/
+ErrorCode GetIteratorStats(IteratorStats *stats){
+  if(stats == NULL)
+    return kErrorGenericFailure;
+
+  Iterator::stats(&stats->steps, &stats->seeks);
+  return kOk;
+}
+
+/**
+Writes a report on the contention of all locks to a file.
+
+@see contest_extensions.h for details
+*/
+ErrorCode WriteLockReport(const char *path){
+  if(path == NULL)
+    return kErrorGenericFailure;
+
+  return LockProfile::WriteReport(path) ? kOk : kErrorGenericFailure;
+}
+
+/**
+Sets the isolation level of all transactions and iterators started afterwards.
+
+Readers of the in-memory trees never wait for writers, but they see changes as soon
+as they are committed, so only read committed is supported.
+
+@see contest_extensions.h for details
+*/
+ErrorCode SetIsolationLevel(IsolationLevel level){
+  return (level == kIsolationReadCommitted) ? kOk : kErrorGenericFailure;
+}
+
+/**
+Returns the counters of all optimistic transactions and autocommit retries (which
+are not supported, so they stay zero: an operation outside of a transaction fails
+right away if it needs a record owned by a transaction).
+
+@see contest_extensions.h for details
+*/
+ErrorCode GetTransactionStats(TransactionStats *stats){
+  if(stats == NULL)
+    return kErrorGenericFailure;
+
+  stats->optimistic_commits = 0;
+  stats->optimistic_conflicts = 0;
+  stats->deadlock_retries = 0;
+  stats->deadlock_failures = 0;
+  return kOk;
+}
+
+/**
+Returns the memory used by the library (which is not accounted for).
+
+@see contest_extensions.h for details
+*/
+ErrorCode GetMemoryUsage(MemoryUsage *usage){
+  if(usage == NULL)
+    return kErrorGenericFailure;
+
+  usage->used = 0;
+  usage->peak = 0;
+  usage->limit = 0;
+  usage->failures = 0;
+  return kOk;
+}
+
+/**
+Sets the memory limit of the library (not supported).
+
+@see contest_extensions.h for details
+*/
+ErrorCode SetMemoryLimit(uint64_t bytes){
+  return kErrorGenericFailure;
+}
+
+/**
+Returns the memory footprint of an index.
+
+@see contest_extensions.h for details
+*/
+ErrorCode GetIndexFootprint(const char* name, IndexFootprint *footprint){
+  if((name == NULL) || (footprint == NULL))
+    return kErrorGenericFailure;
+
+  BTreeManager::Pin pin;
+  Tree* tree = BTreeManager::getInstance().Find(name, &pin);
+  if(tree == NULL)
+    return kErrorUnknownIndex;
+
+  tree->footprint(footprint);
+  return kOk;
+}
@@ -0,0 +1,427 @@
+#include "BTreeIndex.h"
+
+#include <assert.h>
+#include <cstdlib>
+#include <string.h>
+#include <algorithm>
+#include <new>
+
+// Compare two blocks bytewise
+static inline bool BlockEquals(const Block& a, const Block& b){
+  return (a.size == b.size) && ((a.size == 0) || (memcmp(a.data, b.data, a.size) == 0));
+}
+
+// Unlink an entry from its chain and free it
+static void RemoveEntry(Entry** chain, Entry* entry){
+  while(*chain != entry)
+    chain = &((*chain)->next);
+  *chain = entry->next;
+  FreeEntry(entry);
+}
+
+// Finishes a single entry owned by a transaction at commit or abort time
+class FinishModifier : public ChainModifier {
+ public:
+  FinishModifier(Entry* entry, bool commit) : entry_(entry), commit_(commit){};
+
+  ErrorCode Modify(Entry** chain){
+    if(commit_){
+      if(entry_->flags & kEntryDeleted){
+        RemoveEntry(chain, entry_);
+        return kOk;
+      }
+      if(entry_->flags & kEntryUpdated){
+        free(entry_->payload.data);
+        entry_->payload = entry_->pending;
+      }
+    } else {
+      if(entry_->flags & kEntryInserted){
+        RemoveEntry(chain, entry_);
+        return kOk;
+      }
+      if(entry_->flags & kEntryUpdated)
+        free(entry_->pending.data);
+    }
+    entry_->pending.data = NULL;
+    entry_->pending.size = 0;
+    entry_->owner = NULL;
+    entry_->flags = 0;
+    return kOk;
+  }
+
+ private:
+  Entry* entry_;
+  bool commit_;
+};
+
+// Updates or deletes the entries of a chain that match a record
+//
+// Entries that are owned by another transaction cause a kErrorDeadlock (no-wait policy).
+// In autocommit mode (tx == NULL) changes are applied to the committed state directly,
+// which is atomic as the whole chain is modified under the leaf latch.
+class WriteModifier : public ChainModifier {
+ public:
+  WriteModifier(Tree* tree, Transaction* tx, const char* key, Record* record,
+                Block* payload, uint8_t flags)
+    : tree_(tree), tx_(tx), key_(key), record_(record), payload_(payload), flags_(flags){};
+
+  ErrorCode Modify(Entry** chain){
+    bool ignore_payload = (flags_ & kIgnorePayload);
+    bool conflict = false;
+
+    // Collect all matching entries
+    std::vector<Entry*> targets;
+    for(Entry* entry = *chain; entry != NULL; entry = entry->next){
+      if(!Visible(entry, tx_))
+        continue;
+      if(!ignore_payload && !BlockEquals(VisiblePayload(entry, tx_), record_->payload))
+        continue;
+      if((entry->owner != NULL) && (entry->owner != tx_)){
+        conflict = true;
+        continue;
+      }
+      targets.push_back(entry);
+      if(!(flags_ & kMatchDuplicates))
+        break;
+    }
+
+    // Without kMatchDuplicates any matching entry will do, otherwise all of them are needed
+    if(conflict && (targets.empty() || (flags_ & kMatchDuplicates)))
+      return kErrorDeadlock;
+    if(targets.empty())
+      return kErrorNotFound;
+
+    for(size_t i = 0; i < targets.size(); i++){
+      if(payload_ != NULL)
+        Update(targets[i]);
+      else
+        Delete(chain, targets[i]);
+    }
+    return kOk;
+  }
+
+ private:
+  void Update(Entry* entry){
+    if((tx_ == NULL) || ((entry->owner == tx_) && (entry->flags & kEntryInserted))){
+      AssignBlock(entry->payload, *payload_);
+      return;
+    }
+    AssignBlock(entry->pending, *payload_);
+    Acquire(entry, kEntryUpdated);
+  }
+
+  void Delete(Entry** chain, Entry* entry){
+    if(tx_ == NULL){
+      RemoveEntry(chain, entry);
+      return;
+    }
+    Acquire(entry, kEntryDeleted);
+  }
+
+  // Mark the entry as modified by the transaction
+  void Acquire(Entry* entry, uint8_t flag){
+    if(entry->owner == NULL){
+      tx_->Log(tree_, key_, entry);
+      entry->owner = tx_;
+    }
+    entry->flags |= flag;
+  }
+
+  Tree* tree_;
+  Transaction* tx_;
+  const char* key_;
+  Record* record_;
+  Block* payload_;
+  uint8_t flags_;
+};
+
+Transaction::~Transaction(){
+  // Make sure nothing is left behind
+  if(!log_.empty() || !trees_.empty())
+    Abort();
+}
+
+bool Transaction::Register(Tree* tree){
+  for(size_t i = 0; i < trees_.size(); i++){
+    if(trees_[i] == tree)
+      return true;
+  }
+  if(!tree->start_transaction(this))
+    return false;
+  trees_.push_back(tree);
+  return true;
+}
+
+void Transaction::Log(Tree* tree, const char* key, Entry* entry){
+  LogItem item;
+  item.tree = tree;
+  item.key = new char[tree->key_size()];
+  memcpy(item.key, key, tree->key_size());
+  item.entry = entry;
+  log_.push_back(item);
+}
+
+void Transaction::Unlog(size_t count){
+  for(; count > 0; count--){
+    delete[] log_.back().key;
+    log_.pop_back();
+  }
+}
+
+void Transaction::Commit(){
+  Finish(true);
+}
+
+void Transaction::Abort(){
+  Finish(false);
+}
+
+void Transaction::Finish(bool commit){
+  for(size_t i = 0; i < log_.size(); i++){
+    FinishModifier modifier(log_[i].entry, commit);
+    log_[i].tree->Modify(log_[i].key, &modifier);
+    delete[] log_[i].key;
+  }
+  log_.clear();
+
+  // We finished writing on these indices
+  for(size_t i = 0; i < trees_.size(); i++)
+    trees_[i]->end_transaction(this);
+  trees_.clear();
+}
+
+Index::Index(Tree* tree) : mutex_("Index::mutex_"){
+  tree_ = tree;
+  closed_ = false;
+}
+
+ErrorCode Index::Open(const char* name, Index** index){
+  // Try to get the tree of the requested index (it is pinned until the handle
+  // is registered, afterwards deleting the tree closes the handle)
+  BTreeManager::Pin pin;
+  Tree* tree = BTreeManager::getInstance().Find(name, &pin);
+  if(tree == NULL)
+    return kErrorUnknownIndex;
+
+  *index = new Index(tree);
+  tree->register_handle(*index);
+  return kOk;
+}
+
+Index::~Index(){
+  Close();
+}
+
+void Index::Close(){
+  lock(mutex_){
+    if(closed_)
+      return;
+    closed_ = true;
+  }
+  tree_->unregister_handle(this);
+}
+
+ErrorCode Index::Insert(Transaction *tx, Record *record){
+  std::vector<char> key(tree_->key_size());
+  tree_->EncodeKey(record->key, &key[0]);
+  Entry* entry = NewEntry(record->payload);
+
+  // In autocommit mode the entry is committed right away
+  if(tx != NULL){
+    if(!tx->Register(tree_)){
+      FreeEntry(entry);
+      return kErrorUnknownIndex;
+    }
+    entry->owner = tx;
+    entry->flags = kEntryInserted;
+
+    // The entry is logged before other threads can see it, so that an abort always
+    // finds it
+    try {
+      tx->Log(tree_, &key[0], entry);
+    } catch(std::bad_alloc &e){
+      FreeEntry(entry);
+      throw;
+    }
+  }
+
+  // The entry is counted before other threads can see it (it is not part of the
+  // tree if the insert fails)
+  tree_->CountEntry(entry, 1);
+  try {
+    tree_->Insert(&key[0], entry);
+  } catch(std::bad_alloc &e){
+    if(tx != NULL)
+      tx->Unlog(1);
+    tree_->CountEntry(entry, -1);
+    FreeEntry(entry);
+    throw;
+  }
+  return kOk;
+}
+
+// Orders binary keys of the same size
+class KeyOrder {
+ public:
+  KeyOrder(size_t key_size) : key_size_(key_size){};
+
+  bool operator()(const char* a, const char* b) const {
+    return memcmp(a, b, key_size_) < 0;
+  }
+
+ private:
+  size_t key_size_;
+};
+
+ErrorCode Index::InsertRecords(Transaction *tx, Record *records, uint32_t count){
+  if((tx != NULL) && !tx->Register(tree_))
+    return kErrorUnknownIndex;
+  if(count == 0)
+    return kOk;
+
+  // Encode every key once and sort the keys (records with equal keys keep their order)
+  size_t key_size = tree_->key_size();
+  std::vector<char> buffer(count * key_size);
+  std::vector<const char*> keys(count);
+  for(uint32_t i = 0; i < count; i++){
+    tree_->EncodeKey(records[i].key, &buffer[i * key_size]);
+    keys[i] = &buffer[i * key_size];
+  }
+  std::stable_sort(keys.begin(), keys.end(), KeyOrder(key_size));
+
+  // Create the entries in the order of their keys
+  std::vector<Entry*> entries(count);
+  uint32_t created = 0;
+  try {
+    for(; created < count; created++){
+      Record& record = records[(keys[created] - &buffer[0]) / key_size];
+      entries[created] = NewEntry(record.payload);
+      if(tx != NULL){
+        entries[created]->owner = tx;
+        entries[created]->flags = kEntryInserted;
+      }
+    }
+  } catch(std::bad_alloc &e){
+    for(uint32_t i = 0; i < created; i++)
+      FreeEntry(entries[i]);
+    throw;
+  }
+
+  // The entries are logged before other threads can see them, so that an abort
+  // always finds them
+  uint32_t logged = 0;
+  try {
+    for(; (tx != NULL) && (logged < count); logged++)
+      tx->Log(tree_, keys[logged], entries[logged]);
+  } catch(std::bad_alloc &e){
+    tx->Unlog(logged);
+    for(uint32_t i = 0; i < count; i++)
+      FreeEntry(entries[i]);
+    throw;
+  }
+
+  size_t inserted = 0;
+  for(uint32_t i = 0; i < count; i++)
+    tree_->CountEntry(entries[i], 1);
+  try {
+    tree_->InsertBatch(&keys[0], &entries[0], count, &inserted);
+  } catch(std::bad_alloc &e){
+    // The entries that made it into the tree (the first ones) still belong to the
+    // transaction
+    if(tx != NULL)
+      tx->Unlog(count - inserted);
+    for(size_t i = inserted; i < count; i++){
+      tree_->CountEntry(entries[i], -1);
+      FreeEntry(entries[i]);
+    }
+    throw;
+  }
+  return kOk;
+}
+
+ErrorCode Index::Update(Transaction *tx, Record *record, Block *payload, uint8_t flags){
+  if((tx != NULL) && !tx->Register(tree_))
+    return kErrorUnknownIndex;
+
+  std::vector<char> key(tree_->key_size());
+  tree_->EncodeKey(record->key, &key[0]);
+  WriteModifier modifier(tree_, tx, &key[0], record, payload, flags);
+  return tree_->Modify(&key[0], &modifier);
+}
+
+ErrorCode Index::Delete(Transaction *tx, Record *record, uint8_t flags){
+  if((tx != NULL) && !tx->Register(tree_))
+    return kErrorUnknownIndex;
+
+  std::vector<char> key(tree_->key_size());
+  tree_->EncodeKey(record->key, &key[0]);
+  WriteModifier modifier(tree_, tx, &key[0], record, NULL, flags);
+  return tree_->Modify(&key[0], &modifier);
+}
+
+bool Index::Compatible(Record *record){
+  if((record == NULL) || closed_)
+    return false;
+
+  return Compatible(record->key);
+}
+
+bool Index::Compatible(Key key){
+  if(closed_ || (key.attribute_count != tree_->attribute_count()))
+    return false;
+
+  // NULL attributes are wildcards, all others need the type of the index
+  for(int i = 0; i < key.attribute_count; i++){
+    if((key.value[i] != NULL) && (key.value[i]->type != tree_->type(i)))
+      return false;
+  }
+  return true;
+}
+
+
+/**
+Return the singleton instance of BTreeManager;
+
+@return the singleton instance of BTreeManager
+*/
+BTreeManager& BTreeManager::getInstance(){
+  static BTreeManager instance;
+  return instance;
+}
+
+BTreeManager::~BTreeManager(){
+  std::vector<Tree*> trees;
+  trees_.Values(&trees);
+  for(size_t i = 0; i < trees.size(); i++)
+    delete trees[i];
+}
+
+bool BTreeManager::Insert(const char* name, Tree* tree){
+  lock(mutex_){
+    return trees_.Insert(name, tree);
+  }
+  return false;
+}
+
+Tree* BTreeManager::Find(const char* name, Pin* pin){
+  return trees_.Find(name, pin);
+}
+
+ErrorCode BTreeManager::Remove(const char* name){
+  Tree* tree;
+  lock(mutex_){
+    tree = trees_.Get(name);
+    if(tree == NULL)
+      return kErrorUnknownIndex;
+
+    // Try to make the tree read-only
+    if(!tree->MakeReadOnly())
+      return kErrorOpenTransactions;
+
+    trees_.Remove(name);
+  }
+
+  // Nobody can find the tree anymore, and deleting it closes all open handles
+  delete tree;
+  return kOk;
+}
@@ -0,0 +1,156 @@
+#ifndef _BTREE_INDEX_H_
+#define _BTREE_INDEX_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <contest_interface.h>
+#include <common/macros.h>
+
+#include "Catalog.h"
+#include "Tree.h"
+#include "Mutex.h"
+
+// Class representing a transaction
+//
+// Every entry that is modified by a transaction is owned by it and recorded in its
+// undo log, so that commit and abort can finish or roll back exactly those entries.
+class Transaction {
+ public:
+  // Constructor
+  Transaction(){};
+
+  // Destructor
+  ~Transaction();
+
+  // Register this transaction as a writer of the given tree (returns false if the tree is read-only)
+  bool Register(Tree* tree);
+
+  // Record that the given entry (stored under key) is now owned by this transaction
+  void Log(Tree* tree, const char* key, Entry* entry);
+
+  // Forget the given number of most recently logged entries (used if they could not
+  // be stored in the tree after all)
+  void Unlog(size_t count);
+
+  // Persist all changes made by this transaction
+  void Commit();
+
+  // Roll back all changes made by this transaction
+  void Abort();
+
+ private:
+  // An entry owned by this transaction
+  struct LogItem {
+    Tree* tree;
+    char* key;
+    Entry* entry;
+  };
+
+  // Finish all owned entries (commit or abort) and release the trees
+  void Finish(bool commit);
+
+  // The undo log of this transaction
+  std::vector<LogItem> log_;
+
+  // The trees this transaction has written to
+  std::vector<Tree*> trees_;
+
+  DISALLOW_COPY_AND_ASSIGN(Transaction);
+};
+
+// Class representing an index handle
+class Index{
+ public:
+  // Destructor
+  ~Index();
+
+  // Opens an index
+  static ErrorCode Open(const char* name, Index** index);
+
+  // Close this index
+  void Close();
+
+  // Return the tree of this index
+  Tree* tree() const { return tree_; };
+
+  // Insert the given record into the index
+  ErrorCode Insert(Transaction *tx, Record *record);
+
+  // Insert the given records into the index in the order of their keys
+  ErrorCode InsertRecords(Transaction *tx, Record *records, uint32_t count);
+
+  // Update the given record with the given payload
+  ErrorCode Update(Transaction *tx, Record *record, Block *payload, uint8_t flags);
+
+  // Delete the given record
+  ErrorCode Delete(Transaction *tx, Record *record, uint8_t flags);
+
+  // Checks whether the given record is compatible with this index
+  bool Compatible(Record *record);
+
+  // Checks whether the given key is compatible with this index
+  bool Compatible(Key key);
+
+  // Return whether the index has been closed
+  bool closed () const { return closed_; };
+
+ private:
+  // Constructor
+  Index(Tree* tree);
+
+  // The tree of this index
+  Tree* tree_;
+
+  // Whether the index has been closed
+  bool closed_;
+
+  // A mutex for protecting the closed flag
+  Mutex mutex_;
+
+  DISALLOW_COPY_AND_ASSIGN(Index);
+};
+
+/**
+ * Defines a simple tree manager.
+ *
+ * It is used to manage the trees of the created indices.
+ *
+ * BTreeManager implements the Singleton Pattern.
+ */
+class BTreeManager{
+  public:
+    // Return the singleton instance of BTreeManager
+    static BTreeManager& getInstance();
+
+    // Keeps a tree found by Find() from being deleted
+    typedef Catalog<Tree>::Pin Pin;
+
+    // Search for a tree with the given name and pin it (never blocks)
+    Tree *Find(const char* name, Pin* pin);
+
+    // Insert a tree (returns false if the name is already in use)
+    bool Insert(const char* name, Tree* tree);
+
+    // Search and delete the tree with the given name (waits until it is no longer
+    // pinned)
+    ErrorCode Remove(const char* name);
+
+  private:
+    // Private constructor (don't allow instanciation from outside)
+    BTreeManager():mutex_("BTreeManager::mutex_"){};
+
+    // Destructor
+    ~BTreeManager();
+
+    // A catalog holding the trees of all indices
+    Catalog<Tree> trees_;
+
+    // A mutex serializing the modifications of the catalog
+    Mutex mutex_;
+
+    DISALLOW_COPY_AND_ASSIGN(BTreeManager);
+};
+
+#endif // _BTREE_INDEX_H_
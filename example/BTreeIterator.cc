@@ -0,0 +1,178 @@
+#include "BTreeIterator.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// The number of records that are read from the tree at once
+static const size_t kBatchSize = 64;
+
+// The movements of all closed iterators
+static uint64_t total_steps = 0;
+static uint64_t total_seeks = 0;
+
+// Copies the qualifying records of the visited keys into the batch of an iterator
+class BatchVisitor : public ChainVisitor {
+ public:
+  BatchVisitor(Iterator* it) : it_(it){};
+
+  bool Visit(const char* key, const Entry* chain){
+    Tree* tree = it_->tree_;
+    size_t key_size = tree->key_size();
+    memcpy(&it_->last_key_[0], key, key_size);
+    it_->steps_++;
+
+    // Check that every attribute lies inside the range of the iterator
+    for(int i = 0; i < tree->attribute_count(); i++){
+      if((tree->CompareAttribute(key, &it_->min_key_[0], i) < 0) ||
+         (tree->CompareAttribute(key, &it_->max_key_[0], i) > 0))
+        return true;
+    }
+
+    for(const Entry* entry = chain; entry != NULL; entry = entry->next){
+      if(!Visible(entry, it_->tx_))
+        continue;
+      const Block& payload = VisiblePayload(entry, it_->tx_);
+      size_t offset = it_->buffer_.size();
+      it_->records_.push_back(offset);
+      it_->buffer_.resize(offset + key_size + sizeof(uint32_t) + payload.size);
+      char* record = &it_->buffer_[offset];
+      memcpy(record, key, key_size);
+      memcpy(record + key_size, &payload.size, sizeof(uint32_t));
+      if(payload.size > 0)
+        memcpy(record + key_size + sizeof(uint32_t), payload.data, payload.size);
+    }
+
+    // Stop after a whole key, so that the next batch can start behind it
+    return it_->records_.size() < kBatchSize;
+  }
+
+ private:
+  Iterator* it_;
+};
+
+/**
+ * Initialize the iterator to iterate over a given index.
+ */
+Iterator::Iterator(Transaction* tx, Index* idx, Key min_keys, Key max_keys){
+  tree_ = idx->tree();
+  tx_ = tx;
+  closed_ = false;
+  end_ = false;
+  started_ = false;
+  exhausted_ = false;
+  state_ = NULL;
+  position_ = 0;
+  footprint_ = 0;
+  steps_ = 0;
+  seeks_ = 0;
+
+  // Convert the range into binary keys
+  min_key_.resize(tree_->key_size());
+  max_key_.resize(tree_->key_size());
+  last_key_.resize(tree_->key_size());
+  tree_->EncodeKey(min_keys, &min_key_[0]);
+  tree_->EncodeKey(max_keys, &max_key_[0], true);
+
+  // Prepare the record that will be handed out
+  attributes_.resize(tree_->attribute_count());
+  values_.resize(tree_->attribute_count());
+  for(size_t i = 0; i < values_.size(); i++)
+    values_[i] = &attributes_[i];
+  record_.key.value = &values_[0];
+  record_.key.attribute_count = tree_->attribute_count();
+  record_.payload.data = NULL;
+  record_.payload.size = 0;
+  CountFootprint();
+}
+
+// Read the next batch of records from the tree
+void Iterator::Fill(){
+  buffer_.clear();
+  records_.clear();
+  position_ = 0;
+
+  BatchVisitor visitor(this);
+  seeks_++;
+  exhausted_ = tree_->Search(&min_key_[0], &max_key_[0], started_ ? &last_key_[0] : NULL, &visitor,
+                             &state_);
+  started_ = true;
+
+  // The position of the search is no longer needed once the whole range has been read
+  if(exhausted_){
+    delete state_;
+    state_ = NULL;
+  }
+  CountFootprint();
+}
+
+// Report the memory currently held by the iterator to the footprint of the tree
+void Iterator::CountFootprint(){
+  // The attributes of the record reserve MAX_VARCHAR_LENGTH+1 characters each
+  int64_t bytes = sizeof(Iterator)
+                  + min_key_.capacity() + max_key_.capacity() + last_key_.capacity()
+                  + buffer_.capacity() + records_.capacity() * sizeof(size_t)
+                  + attributes_.capacity() * sizeof(Attribute)
+                  + values_.capacity() * sizeof(Attribute*)
+                  + ((state_ != NULL) ? state_->size() : 0);
+  tree_->CountIteratorBytes(bytes - footprint_);
+  footprint_ = bytes;
+}
+
+// Move the iterator to the next record
+bool Iterator::Next(){
+  if(closed_)
+    return false;
+  if(end_)
+    return true;
+
+  if(position_ + 1 < records_.size()){
+    position_++;
+    return true;
+  }
+
+  // The current batch is used up
+  while(!exhausted_){
+    Fill();
+    if(!records_.empty())
+      return true;
+  }
+
+  end_ = true;
+  records_.clear();
+  return true;
+}
+
+// Return the record to which the iterator refers
+Record* Iterator::value(){
+  // If the iterator has already ended, don't return a record
+  if(end_ || closed_ || records_.empty())
+    return NULL;
+
+  const char* record = &buffer_[records_[position_]];
+  size_t key_size = tree_->key_size();
+  tree_->DecodeKey(record, record_.key.value);
+  memcpy(&record_.payload.size, record + key_size, sizeof(uint32_t));
+  record_.payload.data = (void*) (record + key_size + sizeof(uint32_t));
+  return &record_;
+}
+
+// Close the iterator
+void Iterator::Close(){
+  closed_ = true;
+  buffer_.clear();
+  records_.clear();
+  delete state_;
+  state_ = NULL;
+  tree_->CountIteratorBytes(-footprint_);
+  footprint_ = 0;
+
+  // Add the movements of this iterator to the totals
+  __sync_fetch_and_add(&total_steps, steps_);
+  __sync_fetch_and_add(&total_seeks, seeks_);
+}
+
+// Return the counters of all iterators that have been closed so far
+void Iterator::stats(uint64_t *steps, uint64_t *seeks){
+  *steps = __sync_fetch_and_add(&total_steps, 0);
+  *seeks = __sync_fetch_and_add(&total_seeks, 0);
+}
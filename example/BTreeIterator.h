@@ -0,0 +1,98 @@
+#ifndef _BTREE_ITERATOR_H_
+#define _BTREE_ITERATOR_H_
+
+#include <vector>
+
+#include "BTreeIndex.h"
+
+// Represents an iterator
+//
+// The iterator reads the tree in batches: every refill copies the next qualifying
+// records (always including all duplicates of a key) into a local buffer, so no
+// latches are held between two GetNext() calls. The returned record and its payload
+// point into iterator-owned memory that stays valid until the next call.
+class Iterator {
+ public:
+  // Constructor
+  Iterator(Transaction* tx, Index* idx, Key min_keys, Key max_keys);
+
+  // Close the iterator
+  void Close();
+
+  // Move the iterator to the next record
+  bool Next();
+
+  // Return whether the iterator has been closed
+  bool closed() const { return closed_; };
+
+  // Return whether the iterator has exceeded its range
+  bool end() const { return end_; };
+
+  // Return the record to which the iterator refers
+  Record* value();
+
+  // Return the counters of all iterators that have been closed so far
+  static void stats(uint64_t *steps, uint64_t *seeks);
+
+ private:
+  friend class BatchVisitor;
+
+  // Read the next batch of records from the tree
+  void Fill();
+
+  // Report the memory currently held by the iterator to the footprint of the tree
+  void CountFootprint();
+
+  // The tree which is iterated over
+  Tree* tree_;
+
+  // The transaction the iterator belongs to (or NULL)
+  Transaction* tx_;
+
+  // The minimum and maximum key of the range (binary)
+  std::vector<char> min_key_;
+  std::vector<char> max_key_;
+
+  // The last key that has been read from the tree
+  std::vector<char> last_key_;
+
+  // Whether the tree has already been read up to last_key_
+  bool started_;
+
+  // Whether the whole range has been read from the tree
+  bool exhausted_;
+
+  // The position of the search in the tree between two batches (or NULL)
+  SearchState* state_;
+
+  // The current batch (binary key, payload size and payload of each record)
+  std::vector<char> buffer_;
+
+  // The offset of every record of the current batch inside the buffer
+  std::vector<size_t> records_;
+
+  // The position of the current record inside the batch
+  size_t position_;
+
+  // The record handed out by value() and its attributes
+  Record record_;
+  std::vector<Attribute> attributes_;
+  std::vector<Attribute*> values_;
+
+  // Whether the iterator has been closed
+  bool closed_;
+
+  // Whether the iterator has exceeded its range
+  bool end_;
+
+  // The number of bytes that have been added to the footprint of the tree
+  int64_t footprint_;
+
+  // The number of keys read from the tree and the number of descents
+  uint64_t steps_;
+  uint64_t seeks_;
+
+  DISALLOW_COPY_AND_ASSIGN(Iterator);
+};
+
+#endif // _BTREE_ITERATOR_H_
@@ -0,0 +1,288 @@
+// A catalog mapping the names of indices to their structures, which can be
+// searched without taking any lock
+#ifndef _CATALOG_H_
+#define _CATALOG_H_
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+#include <algorithm>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <common/macros.h>
+
+// Class representing a read-mostly catalog
+//
+// The catalog is an immutable, sorted snapshot that is replaced as a whole
+// whenever a name is inserted or removed. Find() only loads the current
+// snapshot and searches it, while a hazard pointer per thread tells writers
+// which old snapshots are still in use. Writers have to be serialized by the
+// caller.
+//
+// Find() pins the value it returns until its Pin is released. Remove() waits
+// until no reader can still find the value in an old snapshot and all its pins
+// are released; only then it returns the value, which the caller may delete.
+template <typename T>
+class Catalog{
+ private:
+  struct Holder;
+
+ public:
+  // Keeps a value returned by Find() from being removed (it is released when the
+  // pin is destroyed or used for the next Find())
+  class Pin{
+   public:
+    Pin() : holder_(NULL){};
+    ~Pin(){ Release(); };
+
+    // Release the pinned value (if any)
+    void Release(){
+      if(holder_ != NULL)
+        __sync_fetch_and_sub(&holder_->pins, 1);
+      holder_ = NULL;
+    };
+
+   private:
+    friend class Catalog;
+
+    // The holder of the pinned value
+    Holder* holder_;
+
+    DISALLOW_COPY_AND_ASSIGN(Pin);
+  };
+
+  // Constructor
+  Catalog() : snapshot_(new Snapshot()), records_(NULL){
+    pthread_key_create(&key_, &ReleaseRecord);
+  };
+
+  // Destructor
+  ~Catalog(){
+    pthread_key_delete(key_);
+    for(size_t i = 0; i < retired_.size(); i++)
+      delete retired_[i];
+    for(size_t i = 0; i < snapshot_->entries.size(); i++)
+      delete snapshot_->entries[i].holder;
+    delete snapshot_;
+    while(records_ != NULL){
+      HazardRecord* next = records_->next;
+      delete records_;
+      records_ = next;
+    }
+  };
+
+  // Search for the value with the given name and pin it (returns NULL if there
+  // is none)
+  T* Find(const char* name, Pin* pin){
+    pin->Release();
+    HazardRecord* record = AcquireRecord();
+
+    // Protect the snapshot before using it, and check that it has not been
+    // replaced (and maybe deleted) in the meantime
+    Snapshot* snapshot;
+    do{
+      snapshot = snapshot_;
+      record->pointer = snapshot;
+      __sync_synchronize();
+    } while(snapshot != snapshot_);
+
+    // The holder is pinned while the snapshot is protected, so Remove() sees
+    // the pin once it has waited for the readers of old snapshots
+    T* value = NULL;
+    size_t i = snapshot->Search(name);
+    if((i < snapshot->entries.size()) &&
+       (strcmp(snapshot->entries[i].name.c_str(), name) == 0)){
+      Holder* holder = snapshot->entries[i].holder;
+      __sync_fetch_and_add(&holder->pins, 1);
+      pin->holder_ = holder;
+      value = holder->value;
+    }
+
+    __sync_lock_release(&record->pointer);
+    return value;
+  };
+
+  // Return the value with the given name without pinning it (returns NULL if
+  // there is none, only for writers)
+  T* Get(const char* name) const{
+    size_t i = snapshot_->Search(name);
+    if((i < snapshot_->entries.size()) &&
+       (strcmp(snapshot_->entries[i].name.c_str(), name) == 0))
+      return snapshot_->entries[i].holder->value;
+    return NULL;
+  };
+
+  // Insert a value (returns false if the name is already in use)
+  bool Insert(const char* name, T* value){
+    size_t i = snapshot_->Search(name);
+    if((i < snapshot_->entries.size()) &&
+       (strcmp(snapshot_->entries[i].name.c_str(), name) == 0))
+      return false;
+
+    Snapshot* snapshot = new Snapshot(*snapshot_);
+    Entry entry;
+    entry.name = name;
+    entry.holder = new Holder();
+    entry.holder->value = value;
+    entry.holder->pins = 0;
+    snapshot->entries.insert(snapshot->entries.begin() + i, entry);
+    Publish(snapshot);
+    return true;
+  };
+
+  // Remove the value with the given name (returns NULL if there is none), and
+  // wait until it is neither pinned nor can be found by a reader anymore
+  T* Remove(const char* name){
+    size_t i = snapshot_->Search(name);
+    if((i == snapshot_->entries.size()) ||
+       (strcmp(snapshot_->entries[i].name.c_str(), name) != 0))
+      return NULL;
+
+    Holder* holder = snapshot_->entries[i].holder;
+    Snapshot* snapshot = new Snapshot(*snapshot_);
+    snapshot->entries.erase(snapshot->entries.begin() + i);
+    Publish(snapshot);
+
+    // Readers only protect a snapshot while they search it, and pins only last
+    // for a single call of the interface, so the waits are short
+    bool old_readers = true;
+    while(old_readers){
+      old_readers = false;
+      for(HazardRecord* record = records_; record != NULL; record = record->next){
+        Snapshot* pointer = record->pointer;
+        if((pointer != NULL) && (pointer != snapshot))
+          old_readers = true;
+      }
+      if(old_readers)
+        sched_yield();
+    }
+    while(__sync_fetch_and_add(&holder->pins, 0) != 0)
+      sched_yield();
+
+    T* value = holder->value;
+    delete holder;
+    return value;
+  };
+
+  // Append all values to the given vector
+  void Values(std::vector<T*>* values) const{
+    for(size_t i = 0; i < snapshot_->entries.size(); i++)
+      values->push_back(snapshot_->entries[i].holder->value);
+  };
+
+ private:
+  // A value together with the number of its pins (shared by all snapshots)
+  struct Holder{
+    T* value;
+    volatile int pins;
+  };
+
+  // An entry of a snapshot
+  struct Entry{
+    std::string name;
+    Holder* holder;
+  };
+
+  // An immutable list of entries, sorted by their names
+  struct Snapshot{
+    std::vector<Entry> entries;
+
+    // Return the position of the first entry not less than the given name
+    size_t Search(const char* name) const{
+      size_t low = 0;
+      size_t high = entries.size();
+      while(low < high){
+        size_t middle = (low + high) / 2;
+        if(strcmp(entries[middle].name.c_str(), name) < 0)
+          low = middle + 1;
+        else
+          high = middle;
+      }
+      return low;
+    };
+  };
+
+  // The hazard pointer of a thread (padded to keep the records of different
+  // threads on different cache lines)
+  struct HazardRecord{
+    Snapshot* volatile pointer;
+    volatile int active;
+    HazardRecord* next;
+    char padding[128 - sizeof(Snapshot*) - sizeof(int) - sizeof(HazardRecord*)];
+  };
+
+  // Return the hazard record of the calling thread
+  HazardRecord* AcquireRecord(){
+    HazardRecord* record = (HazardRecord*) pthread_getspecific(key_);
+    if(record != NULL)
+      return record;
+
+    // Reuse the record of a finished thread or add a new one
+    for(record = records_; record != NULL; record = record->next){
+      if(!record->active && __sync_bool_compare_and_swap(&record->active, 0, 1))
+        break;
+    }
+    if(record == NULL){
+      record = new HazardRecord();
+      record->pointer = NULL;
+      record->active = 1;
+      do{
+        record->next = records_;
+      } while(!__sync_bool_compare_and_swap(&records_, record->next, record));
+    }
+    pthread_setspecific(key_, record);
+    return record;
+  };
+
+  // Give the hazard record of a finished thread back
+  static void ReleaseRecord(void* record){
+    ((HazardRecord*) record)->pointer = NULL;
+    __sync_lock_release(&((HazardRecord*) record)->active);
+  };
+
+  // Replace the current snapshot and delete all old snapshots that are no
+  // longer used by any reader
+  void Publish(Snapshot* snapshot){
+    __sync_synchronize();
+    Snapshot* old = snapshot_;
+    retired_.push_back(old);
+    snapshot_ = snapshot;
+    __sync_synchronize();
+
+    std::vector<Snapshot*> hazards;
+    for(HazardRecord* record = records_; record != NULL; record = record->next){
+      Snapshot* pointer = record->pointer;
+      if(pointer != NULL)
+        hazards.push_back(pointer);
+    }
+    std::sort(hazards.begin(), hazards.end());
+
+    size_t kept = 0;
+    for(size_t i = 0; i < retired_.size(); i++){
+      if(std::binary_search(hazards.begin(), hazards.end(), retired_[i]))
+        retired_[kept++] = retired_[i];
+      else
+        delete retired_[i];
+    }
+    retired_.resize(kept);
+  };
+
+  // The current snapshot
+  Snapshot* volatile snapshot_;
+
+  // The hazard records of all threads that have searched this catalog
+  HazardRecord* volatile records_;
+
+  // A key for the hazard record of the calling thread
+  pthread_key_t key_;
+
+  // The old snapshots that may still be used by readers
+  std::vector<Snapshot*> retired_;
+
+  DISALLOW_COPY_AND_ASSIGN(Catalog);
+};
+
+#endif // _CATALOG_H_
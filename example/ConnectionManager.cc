@@ -1,6 +1,15 @@
 #include <db_cxx.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "ConnectionManager.h"
+#include "MemoryBudget.h"
+
+// The size of the in-memory cache without a memory limit
+static const uint64_t kCacheSize = (uint64_t) 4 << 30;
+
+// The size of the in-memory log buffer
+static const uint32_t kLogBufferSize = ((uint32_t) 1 << 20) * 25;
 
 // Constructur for Connectionmanager
 ConnectionManager::ConnectionManager(){
@@ -25,16 +34,38 @@ ConnectionManager::ConnectionManager(){
 	env_->log_set_config(DB_LOG_IN_MEMORY, 1);
   
   // Specify the size of the in-memory log buffer.
-  env_->set_lg_bsize(((size_t) 1 << 20) * 25 );
+  env_->set_lg_bsize(kLogBufferSize);
   
-  // Specify the size of the in-memory cache
-  env_->set_cachesize(4, 0, 1);
+  // Specify the size of the in-memory cache (with a memory limit it takes half of
+  // it, both buffers are charged against the limit right away)
+  uint64_t cache = kCacheSize;
+  uint64_t limit = MemoryBudget::getInstance().limit();
+  if((limit != 0) && (limit / 2 < cache))
+    cache = limit / 2;
+  env_->set_cachesize((u_int32_t) (cache >> 30), (u_int32_t) (cache & ((1 << 30) - 1)), 1);
+  MemoryBudget::getInstance().Force(cache + kLogBufferSize);
 
   // Indicate that we want the db to internally perform deadlock
   // detection. Also indicate that the transaction with
   // the fewest number of write locks will receive the
   // deadlock notification in the event of a deadlock.
   env_->set_lk_detect(DB_LOCK_MINWRITE);
+
+  // Read the isolation level of the first transactions. Only if it reads snapshots,
+  // old versions of modified pages are kept, so that snapshot reads do not need locks
+  // (all databases of the environment are opened with DB_MULTIVERSION). Otherwise
+  // writers do not copy pages that a snapshot might still read.
+  isolation_ = kIsolationReadCommitted;
+  const char* value = getenv(ISOLATION_VARIABLE);
+  if(value != NULL){
+    if(strcmp(value, "snapshot") == 0)
+      isolation_ = kIsolationSnapshot;
+    else if(strcmp(value, "optimistic") == 0)
+      isolation_ = kIsolationOptimistic;
+  }
+  multiversion_ = (isolation_ != kIsolationReadCommitted);
+  if(multiversion_)
+    env_->set_flags(DB_MULTIVERSION, 1);
   
   // Specify a log file to output error messages
   env_->set_errfile(fopen ("bdb.log" , "w"));
@@ -1,10 +1,15 @@
 #ifndef _CONNECTION_MANAGER_H_
 #define _CONNECTION_MANAGER_H_
 
+#include <contest_extensions.h>
 #include <common/macros.h>
 
 class DbEnv;
 
+// The environment variable that sets the isolation level of the first transactions
+// ("read_committed", "snapshot" or "optimistic"; unset means read committed)
+#define ISOLATION_VARIABLE "CONTEST_ISOLATION"
+
 /**
  * Defines a simple connection manager for Berkeley DB.
  * 
@@ -19,9 +24,18 @@ class ConnectionManager{
 		
     // Return the Berkeley DB environment that will be used
 		DbEnv *env(){ return env_; }
+
+    // Return or set the isolation level of new transactions and iterators
+    IsolationLevel isolation() const { return isolation_; }
+    void set_isolation(IsolationLevel isolation){ isolation_ = isolation; }
+
+    // Return whether the environment keeps old versions of modified pages (only then
+    // transactions and iterators can read snapshots)
+    bool multiversion() const { return multiversion_; }
     
 	private:
-		// Private constructor (don't allow instanciation from outside)
+		// Private constructor (don't allow instanciation from outside, reads the
+		// isolation level from ISOLATION_VARIABLE)
 		ConnectionManager();
 
 		// Destructor
@@ -30,6 +44,12 @@ class ConnectionManager{
 		// The Berkeley DB environment that will be used
 		DbEnv *env_;
 
+    // The isolation level of new transactions and iterators
+    volatile IsolationLevel isolation_;
+
+    // Whether the environment has been opened with DB_MULTIVERSION
+    bool multiversion_;
+
     DISALLOW_COPY_AND_ASSIGN(ConnectionManager);
 };
 
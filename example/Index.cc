@@ -1,141 +1,340 @@
 #define __STDC_LIMIT_MACROS
 #include "Index.h"
 #include "Iterator.h"
+#include "MemoryBudget.h"
 #include "Util.h"
 #include <db_cxx.h>
 #include <assert.h>
 
 #include <stdint.h>
+#include <stdio.h>
 #include <cstdlib>
 #include <string.h>
+#include <unistd.h>
+#include <algorithm>
 
-//TODO: Optimize GetBDBKey
+// The size of the buffer that holds the records of a bulk put
+static const size_t kBulkSize = 1 << 20;
 
-Dbt* Index::GetBDBKey(Key key, bool max){
-  return structure_->GetBDBKey(key);
+// The size of the arena on the stack of a single insert, update or delete (it
+// holds the compact and the binary key unless the key has long varchars)
+static const size_t kOperationArenaSize = 1024;
+
+Dbt* Index::GetBDBKey(const CompactAttribute* key, Arena* arena, bool max){
+  return structure_->GetBDBKey(key, arena, max);
 };
 
-Key Index::GetKey(const Dbt *bdb_key){
-  return structure_->GetKey(bdb_key);
+Key Index::GetKey(const Dbt *bdb_key, Arena* arena){
+  return structure_->GetKey(bdb_key, arena);
+}
+
+// Binary keys are built in a way that memcmp() orders them attribute by attribute
+// (integers by value, strings like strcmp()):
+//  - kShort/kInt are stored big-endian with a flipped sign bit
+//  - kVarchar is stored without padding, '\0' bytes are escaped as 0x00 0xFF
+//    and the string is terminated by 0x00 0x01
+// A NULL attribute of a minimum key is stored as the smallest value of its type, a NULL
+// attribute of a maximum key as a byte string that is greater than any value of its type.
+static const unsigned char kEscape = 0x00;
+static const unsigned char kEscapedNull = 0xFF;
+static const unsigned char kTerminator = 0x01;
+
+// Write an unsigned integer of the given width in big-endian byte order
+static inline void EncodeUnsigned(unsigned char* buf, uint64_t value, int width){
+  for(int i = width - 1; i >= 0; i--){
+    buf[i] = (unsigned char) (value & 0xFF);
+    value >>= 8;
+  }
 }
 
-void Index::FreeKey(Key key)
-{
-	int i;
-	for (i = 0; i < key.attribute_count; i++)
-	{
-		delete key.value[i];
-	}
-	delete[] key.value;
+// Read an unsigned integer of the given width in big-endian byte order
+static inline uint64_t DecodeUnsigned(const unsigned char* buf, int width){
+  uint64_t value = 0;
+  for(int i = 0; i < width; i++)
+    value = (value << 8) | buf[i];
+  return value;
 }
 
+// Return the order-preserving unsigned value of a kShort or kInt attribute
+// (a wildcard stands for the minimum or maximum value of the type)
+static inline uint64_t UnsignedValue(const CompactAttribute& attribute, AttributeType type, bool max){
+  if(type == kShort){
+    if(attribute.null)
+      return max ? 0xFFFFFFFFULL : 0;
+    return (uint32_t) attribute.short_value ^ 0x80000000U;
+  }
+  if(attribute.null)
+    return max ? ~0ULL : 0;
+  return (uint64_t) attribute.int_value ^ 0x8000000000000000ULL;
+}
 
-Dbt* IndexStructure::GetBDBKey(Key key, bool max){
+Dbt* IndexStructure::GetBDBKey(const CompactAttribute* key, Arena* arena, bool max){
 
-  // Allocate the necessary memory
-  char* data = new char[size_];
+  // Allocate the necessary memory (enough for the largest possible key)
+  char* buffer = arena->NewArray<char>(size_);
+  uint32_t size = EncodeKey(key, buffer, max);
 
-  int offset = 0, size = 0;
-  
-  // If the key value is NULL we have to set a wildcard
-  // depending on if it is a maximum or minimum key
-  int32_t short_wildcard = (max?INT32_MAX:INT32_MIN);
-  int64_t int_wildcard = (max?INT64_MAX:INT64_MIN);
+  // Return the newly created Dbt object
+  Dbt* dbt = arena->New<Dbt>();
+  dbt->set_data(buffer);
+  dbt->set_size(size);
+  return dbt;
+}
+
+uint32_t IndexStructure::EncodeKey(Key key, char* buffer, bool max){
+  // The attributes only refer to the strings of the key (on the stack, as bulk
+  // inserts encode every key they write)
+  CompactAttribute attributes[UINT8_MAX];
+  for(int i = 0; i < attribute_count_; i++)
+    Compact(&attributes[i], key.value[i], type_[i], NULL);
+  return EncodeKey(attributes, buffer, max);
+}
+
+uint32_t IndexStructure::EncodeKey(const CompactAttribute* key, char* buffer, bool max){
+  unsigned char* data = (unsigned char*) buffer;
 
+  // The Z-order layout interleaves the bits of all attributes
+  if(layout_ == kLayoutZOrder){
+    uint64_t values[UINT8_MAX];
+    for(int i = 0; i < attribute_count_; i++)
+      values[i] = UnsignedValue(key[i], type_[i], max);
+    Interleave(values, buffer);
+    return size_;
+  }
+
+  int offset = 0;
   for(int i = 0; i < attribute_count_; i++){
-    // Determine the attribute size
+    unsigned char* slot = data + offset;
     if(type_[i] == kShort){
-      size = 4;
-      if(key.value[i] == NULL)
-        memcpy(data+offset,&short_wildcard,size);
+      EncodeUnsigned(slot, UnsignedValue(key[i], kShort, max), 4);
+      offset += 4;
     }else if(type_[i] == kInt){
-      size = 8;
-      if(key.value[i] == NULL)
-        memcpy(data+offset,&int_wildcard,size);
-
+      EncodeUnsigned(slot, UnsignedValue(key[i], kInt, max), 8);
+      offset += 8;
     }else{
-      size = MAX_VARCHAR_LENGTH+1;
-      if(key.value[i] == NULL){
-         memset(data+offset,127,MAX_VARCHAR_LENGTH);
-         memset(data+offset+MAX_VARCHAR_LENGTH,'\0',1);
+      if(key[i].null){
+        if(max){
+          // Longer than any string, so it exceeds every encoded value
+          memset(slot, 0xFF, MAX_VARCHAR_LENGTH+1);
+          offset += MAX_VARCHAR_LENGTH+1;
+          continue;
+        }
+      } else {
+        const char* value = key[i].chars();
+        for(int j = 0; j < key[i].length; j++){
+          data[offset++] = (unsigned char) value[j];
+          if(value[j] == kEscape)
+            data[offset++] = kEscapedNull;
+        }
       }
+      // The empty string is the smallest value
+      data[offset++] = kEscape;
+      data[offset++] = kTerminator;
     }
-    if(key.value[i] != NULL){
-      // Copy the data into the buffer
-      memcpy(data+offset,&(key.value[i]->char_value),size);
-    }
-    // Set the offset to the first byte after the attribute
-    offset += size;
   }
 
-  // Return the newly created Dbt object
-  Dbt* rt = new Dbt(data,size_);
-  return rt;
-};
+  return offset;
+}
 
-Key IndexStructure::GetKey(const Dbt *bdb_key){
-  // Create the new key object
-  Key key;
-  key.value = new Attribute*[attribute_count_];
-  key.attribute_count = attribute_count_;
-  
-  int offset = 0, size = 0;
+uint32_t IndexStructure::DataSize(Key key) const{
+  uint32_t size = 0;
   for(int i = 0; i < attribute_count_; i++){
-    // Determine the attribute size
     if(type_[i] == kShort)
-      size = 4;
+      size += 4;
     else if(type_[i] == kInt)
-      size = 8;
+      size += 8;
     else
-      size = MAX_VARCHAR_LENGTH+1;
-    
-    // Create the attribute
-    key.value[i] = new Attribute;
-    key.value[i]->type = type_[i];
-    memcpy(&(key.value[i]->char_value),((char*)bdb_key->get_data())+offset,size);
+      size += strnlen(key.value[i]->char_value, MAX_VARCHAR_LENGTH);
+  }
+  return size;
+}
+
+uint32_t IndexStructure::DataSize(const CompactAttribute* key) const{
+  uint32_t size = 0;
+  for(int i = 0; i < attribute_count_; i++){
+    if(type_[i] == kShort)
+      size += 4;
+    else if(type_[i] == kInt)
+      size += 8;
+    else
+      size += key[i].length;
+  }
+  return size;
+}
+
+int IndexStructure::Compare(const Dbt *a, const Dbt *b) const{
+  // Integer-only keys all have the same size (only the keys used by iterators to
+  // skip behind a prefix are longer)
+  u_int32_t a_size = a->get_size(), b_size = b->get_size();
+  if((fixed_size_ != 0) && (a_size == b_size))
+    return memcmp(a->get_data(), b->get_data(), fixed_size_);
+
+  int res = memcmp(a->get_data(), b->get_data(), (a_size < b_size) ? a_size : b_size);
+  if(res != 0)
+    return res;
+  return (a_size < b_size) ? -1 : ((a_size > b_size) ? 1 : 0);
+}
+
+void IndexStructure::Offsets(const Dbt *bdb_key, uint32_t *offsets) const{
+  const unsigned char* data = (const unsigned char*) bdb_key->get_data();
+  uint32_t size = bdb_key->get_size();
+  uint32_t offset = 0;
+  for(int i = 0; i < attribute_count_; i++){
+    offsets[i] = offset;
+    if(type_[i] == kShort){
+      offset += 4;
+    }else if(type_[i] == kInt){
+      offset += 8;
+    }else{
+      // Search the terminator (the wildcard of a maximum key has
+      // MAX_VARCHAR_LENGTH+1 characters and no terminator)
+      int length = 0;
+      while((offset < size) && (length <= MAX_VARCHAR_LENGTH)){
+        if(data[offset] == kEscape){
+          if(data[offset+1] == kTerminator)
+            break;
+          offset += 2;
+        } else {
+          offset++;
+        }
+        length++;
+      }
+      if(length <= MAX_VARCHAR_LENGTH)
+        offset += 2;
+    }
+  }
+  offsets[attribute_count_] = offset;
+}
 
-    // Set the offset to the first byte after the attribute
-    offset+=size;
+void IndexStructure::Interleave(const uint64_t *values, char *buffer) const{
+  unsigned char* data = (unsigned char*) buffer;
+  memset(data, 0, size_);
+  for(size_t i = 0; i < curve_.size(); i++){
+    if((values[curve_[i].attribute] >> curve_[i].bit) & 1)
+      data[i >> 3] |= (0x80 >> (i & 7));
   }
+}
+
+void IndexStructure::Deinterleave(const Dbt *bdb_key, uint64_t *values) const{
+  const unsigned char* data = (const unsigned char*) bdb_key->get_data();
+  memset(values, 0, attribute_count_ * sizeof(uint64_t));
+  for(size_t i = 0; i < curve_.size(); i++){
+    if(data[i >> 3] & (0x80 >> (i & 7)))
+      values[curve_[i].attribute] |= (1ULL << curve_[i].bit);
+  }
+}
+
+// Walks down the bits of the curve like a search in a binary tree whose nodes are halves
+// of the box (Tropf and Herzog, "Multidimensional Range Search in Dynamically Balanced
+// Trees"). Whenever the box is split by a bit, the lower half is followed if the key lies
+// in it, and the start of the upper half is remembered as the result so far.
+bool IndexStructure::BigMin(const uint64_t *key, const uint64_t *min, const uint64_t *max,
+                            uint64_t *next) const{
+  std::vector<uint64_t> low(min, min + attribute_count_);
+  std::vector<uint64_t> high(max, max + attribute_count_);
+  bool found = false;
+
+  for(size_t i = 0; i < curve_.size(); i++){
+    int attribute = curve_[i].attribute;
+    uint64_t bit = 1ULL << curve_[i].bit;
+    uint64_t rest = bit | (bit - 1);
+    bool k = key[attribute] & bit, l = low[attribute] & bit, h = high[attribute] & bit;
+
+    if(!k && !l && h){
+      // The upper half starts behind the key, continue in the lower half
+      memcpy(next, &low[0], attribute_count_ * sizeof(uint64_t));
+      next[attribute] = (low[attribute] & ~rest) | bit;
+      high[attribute] = (high[attribute] & ~rest) | (bit - 1);
+      found = true;
+    } else if(!k && l){
+      // The whole box lies behind the key
+      memcpy(next, &low[0], attribute_count_ * sizeof(uint64_t));
+      return true;
+    } else if(k && !h){
+      // The whole box lies in front of the key
+      return found;
+    } else if(k && !l && h){
+      // Continue in the upper half
+      low[attribute] = (low[attribute] & ~rest) | bit;
+    }
+  }
+  return found;
+}
 
+Key IndexStructure::GetKey(const Dbt *bdb_key, Arena* arena){
+  // Create the new key object
+  Key key;
+  key.value = arena->NewArray<Attribute*>(attribute_count_);
+  key.attribute_count = attribute_count_;
+  Attribute* attributes = arena->NewArray<Attribute>(attribute_count_);
+  for(int i = 0; i < attribute_count_; i++)
+    key.value[i] = &attributes[i];
+
+  DecodeKey(bdb_key, key.value);
   return key;
 }
 
-Index::Index(const char* name){
+void IndexStructure::DecodeKey(const Dbt *bdb_key, Attribute **attributes){
+  // Keys of the Z-order layout are deinterleaved first (on the stack, as iterators
+  // decode every key they return)
+  uint64_t values[UINT8_MAX];
+  bool interleaved = (layout_ == kLayoutZOrder);
+  if(interleaved)
+    Deinterleave(bdb_key, values);
+
+  const unsigned char* data = (const unsigned char*) bdb_key->get_data();
+  int offset = 0;
+  for(int i = 0; i < attribute_count_; i++){
+    attributes[i]->type = type_[i];
+
+    if(type_[i] == kShort){
+      uint64_t value = interleaved ? values[i] : DecodeUnsigned(data+offset, 4);
+      attributes[i]->short_value = (int32_t) ((uint32_t) value ^ 0x80000000U);
+      offset += 4;
+    }else if(type_[i] == kInt){
+      uint64_t value = interleaved ? values[i] : DecodeUnsigned(data+offset, 8);
+      attributes[i]->int_value = (int64_t) (value ^ 0x8000000000000000ULL);
+      offset += 8;
+    }else{
+      // Unescape the string up to its terminator
+      int length = 0;
+      while(!((data[offset] == kEscape) && (data[offset+1] == kTerminator))){
+        if(length < MAX_VARCHAR_LENGTH)
+          attributes[i]->char_value[length++] = (char) data[offset];
+        offset += (data[offset] == kEscape) ? 2 : 1;
+      }
+      attributes[i]->char_value[length] = '\0';
+      offset += 2;
+    }
+  }
+}
+
+// Return the memory charged for an index structure with the given number of attributes
+static inline size_t StructureCharge(uint8_t attribute_count){
+  return sizeof(IndexStructure) + attribute_count * sizeof(AttributeType);
+}
+
+Index::Index(const char* name) : mutex_("Index::mutex_"){
+  MemoryBudget::getInstance().Charge(sizeof(Index));
   name_ = name;
   closed_ = true;
   op_count_ = 0;
 };
 
 ErrorCode Index::Open(const char* name, Index** index){
-  
-  *index = new Index(name);
-
-  // Creat a new db handle
-  (*index)->db_ = new Db(ConnectionManager::getInstance().env(), 0);
-  
-  // Try to get the structure of the requested index
-  (*index)->structure_ = IndexManager::getInstance().Find(name);
-  if(!(*index)->structure_)
+  // Try to get the structure of the requested index (it is pinned until the handle
+  // is registered, afterwards deleting the structure closes the handle)
+  IndexManager::Pin pin;
+  IndexStructure* structure = IndexManager::getInstance().Find(name, &pin);
+  if(structure == NULL)
     return kErrorUnknownIndex;
-  
-  (*index)->structure_->register_handle(*index);
 
-
-  // Allow duplicates for this db instance
-	(*index)->db_->set_flags(DB_DUP);
-	  
-  // Set the compare function for the b-tree
-  (*index)->db_->set_bt_compare(&keycmp);
-
-  // And finally open the index
-  (*index)->db_->open(NULL, 	    // Transaction pointer
-    NULL, 					              // File name (NULL, because we want to load from main memory)
-    (*index)->name_,				 	    // Logical db name (i.e. the index name)
-    DB_BTREE,				              // Database type (we use b-tree)
-    DB_THREAD | DB_AUTO_COMMIT,   // Open flags
-    0                             // File mode (defaults)
-    );
+  // The handle only refers to the Berkeley DB handles of the structure, so
+  // opening it does not touch Berkeley DB at all
+  *index = new Index(name);
+  (*index)->structure_ = structure;
+  (*index)->db_ = structure->db();
+  structure->register_handle(*index);
 
   // The index was successfully opened
   (*index)->closed_ = false;
@@ -146,14 +345,31 @@ ErrorCode Index::Open(const char* name, Index** index){
 Dbc* Index::Cursor(Transaction* tx){
   Dbc* cursor;
 
-  // Create a new cursor with isolation level read committed
-  db_->cursor((DbTxn*) tx, &cursor, DB_READ_COMMITTED);
+  // Reuse a cursor of a closed iterator of the transaction
+  if((tx != NULL) && ((cursor = tx->TakeCursor(db_)) != NULL))
+    return cursor;
+
+  // Or create a new cursor with the isolation level of the transaction
+  db_->cursor(Transaction::txn(tx), &cursor, Transaction::cursor_flags(tx));
+
+  return cursor;
+};
+
+Dbc* Index::SecondaryCursor(Transaction* tx, int i){
+  Dbc* cursor;
+  Db* db = structure_->secondary_db()[i];
+  if((tx != NULL) && ((cursor = tx->TakeCursor(db)) != NULL))
+    return cursor;
+
+  // Use the same isolation level as the cursors of the index itself
+  db->cursor(Transaction::txn(tx), &cursor, Transaction::cursor_flags(tx));
 
   return cursor;
 };
 
 Index::~Index(){
   Close();
+  MemoryBudget::getInstance().Release(sizeof(Index));
 };
 
 void Index::Close(){
@@ -167,17 +383,8 @@ void Index::Close(){
   while(op_count_ > 0){
     sleep(1);
   };
-      //std::cerr<<__LINE__<<"\n";
-
-      if(db_ != NULL){
-               // std::cerr<<__LINE__<<"\n";
-
-        db_->close(0);
-        //std::cerr<<__LINE__<<"\n";
-
-        db_ = NULL;
-      }
-          //std::cerr<<__LINE__<<"\n";
+      // The Berkeley DB handles belong to the structure and stay open
+      db_ = NULL;
 
       if(structure_ != NULL){
         structure_->unregister_handle(this);
@@ -200,254 +407,389 @@ void Index::Close(){
 }
 
 ErrorCode Index::Insert(Transaction *tx, Record *record){
-  // Convert the payload
-  Dbt value;
-  value.set_data(record->payload.data);
-  value.set_size(record->payload.size);
-  value.set_flags(0);
-	
-  
-  // If the insert occured inside a larger transaction, then add
-  // the parent transaction to the set of open transactions
+  // The key is only converted, its strings are copied if the insert is buffered
+  InlineArena<kOperationArenaSize> arena;
+  CompactAttribute* key = CompactKey(record->key, structure_->type(), &arena, false);
+  return Insert(tx, key, record->payload);
+}
+
+ErrorCode Index::Insert(Transaction *tx, const CompactAttribute* key, const Block& payload){
+  // If the insert occured inside a larger transaction, then register
+  // this index with the parent transaction (an optimistic one only buffers it)
   if(tx != NULL){
-    if(!structure_->start_transaction((DbTxn*) tx))
+    if(tx->buffering())
+      return tx->BufferInsert(this, key, payload);
+    if(!tx->Register(structure_))
       return kErrorUnknownIndex;
+    return InsertOnce(tx, key, payload);
   }
 
-  // Perform the database put
-  Dbt bdbkey = *GetBDBKey(record->key);
-  bdbkey.set_flags(0);//TODO: Check if needed
-  ErrorCode res = kOk;
-  if (db_->put((DbTxn*) tx, &bdbkey, &value, 0) != 0){
-	  res = kErrorGenericFailure;
-  }else{
-    release(&bdbkey);
-    release(&value);
+  // An autocommit insert that has been chosen as a deadlock victim has not
+  // changed anything, so it is simply tried again
+  for(int attempt = 0; ; attempt++){
+    try {
+      return InsertOnce(NULL, key, payload);
+    } catch (DbDeadlockException &e) {
+      if(!Transaction::Backoff(attempt))
+        throw;
+    }
   }
-  return res;
-  
 }
 
-ErrorCode Index::Update(Transaction *tx, Record *record, Block *payload, uint8_t flags){
-  ErrorCode result = kOk;
-  DbTxn* tid;
-  Dbc* cursor;
-  
-  bool ignore_payload = (flags & kIgnorePayload);
-  lock(mutex_){
-  // Convert the record 
-  Dbt key = *GetBDBKey(record->key);
-  void* pkey = key.get_data();
-  
+void Index::Account(Transaction *tx, const FootprintDelta& delta){
+  if(tx != NULL)
+    tx->Account(structure_, delta);
+  else
+    structure_->Account(delta);
+}
+
+ErrorCode Index::InsertOnce(Transaction *tx, const CompactAttribute* key, const Block& payload){
+  // Convert the payload
   Dbt value;
-  // If necessary set the value to match
-  if(!ignore_payload){
-    value.set_data(record->payload.data);
-    value.set_size(record->payload.size);
-  }
+  value.set_data(payload.data);
+  value.set_size(payload.size);
+  value.set_flags(0);
 
-  Dbt original_value = value;
+  // Without a transaction the record and its secondary entries
+  // have to be written by a transaction of their own
+  DbTxn* tid = Transaction::txn(tx);
+  if((tx == NULL) && !structure_->secondary_db().empty())
+    ConnectionManager::getInstance().env()->txn_begin(NULL, &tid, 0);
 
-  // Convert the new payload
-  Dbt new_value;
-  new_value.set_data(payload->data);
-  new_value.set_size(payload->size);
-  
-  // Create a serializable nested transaction (to prevent the transaction
-  // from seeing data that has been inserted after the transaction begun)
-  ConnectionManager::getInstance().env()->txn_begin((DbTxn*) tx, &tid,  0 );
+  // Perform the database put (the key is only needed during the call)
+  InlineArena<kOperationArenaSize> arena;
+  Dbt* bdbkey = GetBDBKey(key, &arena);
+  ErrorCode res = kOk;
+  try {
+    if (db_->put(tid, bdbkey, &value, 0) != 0)
+      res = kErrorGenericFailure;
+    else
+      InsertSecondary(tid, bdbkey);
+  } catch (DbException &e) {
+    if(tid != Transaction::txn(tx))
+      tid->abort();
+    throw;
+  }
+
+  if(tid != Transaction::txn(tx)){
+    if(res == kOk)
+      tid->commit(0);
+    else
+      tid->abort();
+  }
+  if(res == kOk){
+    uint32_t data = structure_->DataSize(key);
+    FootprintDelta delta = {1, bdbkey->get_size(), bdbkey->get_size() - data, payload.size};
+    Account(tx, delta);
+  }
+  return res;
   
-  // Start writing on the index
-  if(structure_->start_transaction(tid)){
+}
 
-    // Create a cursor for this index
-    db_->cursor(tid, &cursor, 0);
+// Orders the positions of encoded keys by these keys (used by InsertRecords)
+class KeyOrder {
+ public:
+  KeyOrder(const IndexStructure* structure, const std::vector<Dbt>& keys)
+    : structure_(structure), keys_(keys){};
 
-    // Retrieve the first record
-    int err = 0, i;
-    if(ignore_payload){
-      err = cursor->get(&key, &value, DB_SET_RANGE);
-
-      // Check that the found record has a valid key
-      Key otkey = GetKey(&key);
-      if(keycmp(otkey,record->key))
-        err = DB_NOTFOUND;
-      FreeKey(otkey);
-    } else {
-      // Try an exact match
-      err = cursor->get(&key, &value, DB_GET_BOTH);
-    }
-    if(err == 0){
-      // Update the record using the new payload
-      if((err = cursor->put(&key, &new_value, DB_CURRENT)) == 0){
-        // If the update occured inside a larger transaction, then add
-        // the parent transaction to the set of open transactions
-        if(tx != NULL){
-          structure_->start_transaction((DbTxn*) tx);
-        }
-        
-        // If necessary update duplicates
-        if(flags & kMatchDuplicates){
-          if(!ignore_payload){
-            // Find next exact duplicate
-            while((err = cursor->get(&key, &value, DB_NEXT_DUP)) == 0){
-              // And update it
-              if ((err = cursor->put(&key, &new_value, DB_CURRENT)) != 0)
-                break;
-            }
-          } else {
-            // Find next record with the same key
-        	Key cmpkey = GetKey(&key);
-            while(((err = cursor->get(&key, &value, DB_NEXT)) == 0)
-                    && (keycmp(cmpkey,record->key) == 0)){
-              // And update it
-              if ((err = cursor->put(&key, &new_value, DB_CURRENT)) != 0)
-                break;
-            }
-            FreeKey(cmpkey);
-
-          }
-          
-          if(err != DB_NOTFOUND)
-            result = kErrorNotFound;
-        }
+  bool operator()(uint32_t a, uint32_t b) const {
+    return structure_->Compare(&keys_[a], &keys_[b]) < 0;
+  }
+
+ private:
+  const IndexStructure* structure_;
+  const std::vector<Dbt>& keys_;
+};
+
+ErrorCode Index::InsertRecords(Transaction *tx, Record *records, uint32_t count){
+  // An optimistic transaction writes bulk inserts right away (after its buffered writes)
+  if(tx != NULL){
+    if(tx->buffering() && !tx->Flush())
+      return kErrorDeadlock;
+    if(!tx->Register(structure_))
+      return kErrorUnknownIndex;
+  }
+  if(count == 0)
+    return kOk;
+
+  // The buffers below are charged against the memory budget while they exist
+  MemoryReservation reservation((size_t) count * (structure_->size() + sizeof(Dbt) + sizeof(uint32_t))
+                                + kBulkSize);
+
+  // Encode every key once and sort the records by their keys (records
+  // with equal keys keep their order)
+  std::vector<char> buffer((size_t) count * structure_->size());
+  std::vector<Dbt> keys(count);
+  std::vector<uint32_t> order(count);
+  for(uint32_t i = 0; i < count; i++){
+    char* data = &buffer[(size_t) i * structure_->size()];
+    keys[i].set_data(data);
+    keys[i].set_size(structure_->EncodeKey(records[i].key, data));
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), KeyOrder(structure_, keys));
+
+  // The sorted records are written with bulk puts, each of them filling a buffer of
+  // kBulkSize bytes. Berkeley DB inserts the pairs of a buffer one after the other
+  // with a single cursor, so they mostly land on pages that have just been visited,
+  // and ascending inserts into an empty index fill its pages completely.
+  std::vector<char> bulk(kBulkSize);
+  Dbt pairs(&bulk[0], kBulkSize);
+  pairs.set_ulen(kBulkSize);
+  pairs.set_flags(DB_DBT_USERMEM);
+  Dbt unused;
+
+  // Without a transaction every bulk put commits on its own
+  DbTxn* tid = Transaction::txn(tx);
+  uint32_t next = 0;
+  while(next < count){
+    if(tx == NULL)
+      ConnectionManager::getInstance().env()->txn_begin(NULL, &tid, 0);
+
+    ErrorCode res = kOk;
+    FootprintDelta delta = {0, 0, 0, 0};
+    try {
+      uint32_t first = next;
+      DbMultipleKeyDataBuilder builder(pairs);
+      for(; next < count; next++){
+        Record& record = records[order[next]];
+        if(!builder.append(keys[order[next]].get_data(), keys[order[next]].get_size(),
+                           record.payload.data, record.payload.size))
+          break;
+      }
+      if(db_->put(tid, &pairs, &unused, DB_MULTIPLE_KEY) != 0){
+        res = kErrorGenericFailure;
       } else {
-        if(err == DB_NOTFOUND)
-          result = kErrorNotFound;
-        else
-          result = kErrorGenericFailure;
+        for(uint32_t i = first; i < next; i++){
+          InsertSecondary(tid, &keys[order[i]]);
+          Record& record = records[order[i]];
+          uint32_t size = keys[order[i]].get_size();
+          delta.records++;
+          delta.key_bytes += size;
+          delta.key_padding += size - structure_->DataSize(record.key);
+          delta.payload_bytes += record.payload.size;
+        }
       }
-    } else {
-      if(err == DB_NOTFOUND)
-        result = kErrorNotFound;
+    } catch (DbException &e) {
+      if(tid != Transaction::txn(tx))
+        tid->abort();
+      throw;
+    }
+
+    if(tid != Transaction::txn(tx)){
+      if(res == kOk)
+        tid->commit(0);
       else
-        result = kErrorGenericFailure;
+        tid->abort();
     }
-  } else {
-    // Abort the new transaction
-	delete [] (char*) pkey;
-    tid->abort();
-    return kErrorUnknownIndex;
+    if(res != kOk)
+      return res;
+    Account(tx, delta);
   }
+  return kOk;
+}
 
-  // Commit the nested transaction
-  tid->commit(0);
-  delete [] (char*) pkey;
-  // We finished writing on the index
-  structure_->end_transaction(tid);
+void Index::InsertSecondary(DbTxn* tx, Dbt* bdb_key){
+  const std::vector<Db*>& secondary_db = structure_->secondary_db();
+  if(secondary_db.empty())
+    return;
+
+  uint32_t offsets[UINT8_MAX + 1];
+  structure_->Offsets(bdb_key, offsets);
+
+  const std::vector<uint8_t>& secondary = structure_->secondary();
+  for(size_t i = 0; i < secondary.size(); i++){
+    // The secondary key is the binary attribute itself, which keeps it order-preserving
+    Dbt key(((char*) bdb_key->get_data()) + offsets[secondary[i]],
+            offsets[secondary[i]+1] - offsets[secondary[i]]);
+    Dbt data(bdb_key->get_data(), bdb_key->get_size());
+
+    // Duplicates of an existing key (DB_KEYEXIST) already have their entry
+    secondary_db[i]->put(tx, &key, &data, DB_NODUPDATA);
   }
-  return result;
+}
+
+void Index::DeleteSecondary(DbTxn* tx, Dbt* bdb_key){
+  const std::vector<Db*>& secondary_db = structure_->secondary_db();
+  if(secondary_db.empty())
+    return;
+
+  // The entries are still needed as long as a record with this key exists (no data is
+  // read, but the handle is free-threaded, so the Dbt has to name a buffer)
+  Dbt value;
+  value.set_flags(DB_DBT_USERMEM | DB_DBT_PARTIAL);
+  value.set_ulen(0);
+  value.set_doff(0);
+  value.set_dlen(0);
+  if(db_->get(tx, bdb_key, &value, 0) == 0)
+    return;
+
+  uint32_t offsets[UINT8_MAX + 1];
+  structure_->Offsets(bdb_key, offsets);
+
+  const std::vector<uint8_t>& secondary = structure_->secondary();
+  for(size_t i = 0; i < secondary.size(); i++){
+    Dbt key(((char*) bdb_key->get_data()) + offsets[secondary[i]],
+            offsets[secondary[i]+1] - offsets[secondary[i]]);
+    Dbt data(bdb_key->get_data(), bdb_key->get_size());
+
+    Dbc* cursor;
+    secondary_db[i]->cursor(tx, &cursor, 0);
+    if(cursor->get(&key, &data, DB_GET_BOTH) == 0)
+      cursor->del(0);
+    cursor->close();
+  }
+}
+
+ErrorCode Index::Update(Transaction *tx, Record *record, Block *payload, uint8_t flags){
+  // Concurrent updates are isolated by the locks of Berkeley DB
+  InlineArena<kOperationArenaSize> arena;
+  CompactAttribute* key = CompactKey(record->key, structure_->type(), &arena, false);
+  return Modify(tx, key, record->payload, payload, flags);
 }
 
 ErrorCode Index::Delete(Transaction *tx, Record *record, uint8_t flags){
-  ErrorCode result = kOk;
-  DbTxn* tid;
-  Dbc* cursor;
-  
+  InlineArena<kOperationArenaSize> arena;
+  CompactAttribute* key = CompactKey(record->key, structure_->type(), &arena, false);
+  return Modify(tx, key, record->payload, NULL, flags);
+}
+
+// Return whether a payload returned by Berkeley DB equals the given block
+static inline bool SamePayload(const Dbt& value, const Block& payload){
+  return (value.get_size() == payload.size)
+      && ((payload.size == 0) || (memcmp(value.get_data(), payload.data, payload.size) == 0));
+}
+
+//
+// Updates (payload != NULL) or deletes the records matching the given one
+//
+// All records with the key of the given record (and its payload unless kIgnorePayload
+// is set) are duplicates of each other, so a single cursor visits them with DB_NEXT_DUP.
+// Inside a transaction the cursor works in that transaction directly, in autocommit
+// mode a single transaction covers the records and their secondary entries.
+//
+ErrorCode Index::Modify(Transaction *tx, const CompactAttribute* key, const Block& current,
+                        Block *payload, uint8_t flags){
+  // If the operation occurs inside a larger transaction, then register
+  // this index with it (an optimistic one only buffers the operation)
+  if(tx != NULL){
+    if(!tx->Prepare(this))
+      return kErrorDeadlock;
+    if(tx->buffering())
+      return tx->BufferModify(this, key, current, payload, flags);
+    if(!tx->Register(structure_))
+      return kErrorUnknownIndex;
+    return ModifyOnce(tx, key, current, payload, flags);
+  }
+
+  // The transaction of an autocommit operation that has been chosen as a deadlock
+  // victim has been aborted, so the operation is simply tried again
+  for(int attempt = 0; ; attempt++){
+    try {
+      return ModifyOnce(NULL, key, current, payload, flags);
+    } catch (DbDeadlockException &e) {
+      if(!Transaction::Backoff(attempt))
+        throw;
+    }
+  }
+}
+
+ErrorCode Index::ModifyOnce(Transaction *tx, const CompactAttribute* record_key,
+                            const Block& current, Block *payload, uint8_t flags){
   bool ignore_payload = (flags & kIgnorePayload);
 
-  // Convert the record 
-  Dbt key = *GetBDBKey(record->key);
-  void* pkey = key.get_data();
-  
-  Dbt value;
+  // Convert the record
+  InlineArena<kOperationArenaSize> arena;
+  char* buffer = arena.NewArray<char>(structure_->size());
+  Dbt search(buffer, structure_->EncodeKey(record_key, buffer));
+  Dbt key(search.get_data(), search.get_size());
+
   // If necessary set the value to match
+  Dbt value;
   if(!ignore_payload){
-    value.set_data(record->payload.data);
-    value.set_size(record->payload.size);
+    value.set_data(current.data);
+    value.set_size(current.size);
   }
-    
-  // Create a serializable nested transaction (to prevent the transaction
-  // from seeing data that has been inserted after the transaction begun)
-  ConnectionManager::getInstance().env()->txn_begin((DbTxn*) tx, &tid,  0 );
-  
-  // Start writing on the index
-  if(structure_->start_transaction(tid)){
-  
-    // Create a cursor for this index
-    db_->cursor(tid, &cursor, DB_READ_COMMITTED);
 
-    // Retrieve the first record
-    int err = 0, i;
-    if(ignore_payload){
-      err = cursor->get(&key, &value, DB_SET_RANGE);
-    
-      // Check that the found record has a valid key
-      Key cmpkey = GetKey(&key);
-      if(keycmp( cmpkey,record->key))
-        err = DB_NOTFOUND;
-      FreeKey(cmpkey);
-
-    } else {
-      // Try an exact match
-      err = cursor->get(&key, &value, DB_GET_BOTH);
-    }
+  // Convert the new payload
+  Dbt new_value;
+  if(payload != NULL){
+    new_value.set_data(payload->data);
+    new_value.set_size(payload->size);
+  }
 
-    if(err == 0){
-      // Delete the record
-      if((err = cursor->del(0)) == 0){
-        // If the deletion occured inside a larger transaction, then add
-        // the parent transaction to the set of open transactions
-        if(tx != NULL){
-          structure_->start_transaction((DbTxn*) tx);
-        }
+  DbTxn* tid = Transaction::txn(tx);
+  if(tx == NULL)
+    ConnectionManager::getInstance().env()->txn_begin(NULL, &tid, 0);
 
-        // If necessary delete duplicates
-        if(flags & kMatchDuplicates){
-          if(!ignore_payload){
-            // Find next exact duplicate
-            while((err = cursor->get(&key, &value, DB_NEXT_DUP)) == 0){
-              // And delete it
-              if ((err = cursor->del(0)) != 0)
-                break;
-            }
-          } else {
-            // Find next record with the same key
-        	 Key cmpkey = GetKey(&key);
-            while(((err = cursor->get(&key, &value, DB_NEXT)) == 0)
-                    && (keycmp(cmpkey,record->key) == 0)){
-              // And delete it
-              if ((err = cursor->del(0)) != 0)
-                break;
-            }
-            FreeKey(cmpkey);
-
-          }
-          
-          if(err != DB_NOTFOUND)
-            result = kErrorGenericFailure;
-        }
-      } else {
-      if(err == DB_NOTFOUND)
-        result = kErrorNotFound;
-      else
-        result = kErrorGenericFailure;
-    }
+  ErrorCode result = kOk;
+  FootprintDelta delta = {0, 0, 0, 0};
+  uint32_t padding = search.get_size() - structure_->DataSize(record_key);
+  Dbc* cursor = NULL;
+  try {
+    db_->cursor(tid, &cursor, 0);
 
+    // Visit the duplicates of the key starting with the first matching one
+    // (DB_RMW takes the write locks right away instead of upgrading read locks)
+    int modified = 0;
+    int err = cursor->get(&key, &value, (ignore_payload ? DB_SET : DB_GET_BOTH) | DB_RMW);
+    while(err == 0){
+      if(ignore_payload || SamePayload(value, current)){
+        uint32_t size = value.get_size();
+        if(payload != NULL)
+          err = cursor->put(&key, &new_value, DB_CURRENT);
+        else
+          err = cursor->del(0);
+        if(err != 0)
+          break;
+        modified++;
+
+        if(payload != NULL){
+          delta.payload_bytes += (int64_t) new_value.get_size() - size;
+        } else {
+          delta.records--;
+          delta.key_bytes -= search.get_size();
+          delta.key_padding -= padding;
+          delta.payload_bytes -= size;
+        }
 
-    } else {
-      if(err == DB_NOTFOUND)
-        result = kErrorNotFound;
-      else
-        result = kErrorGenericFailure;
+        // Without kMatchDuplicates a single record is modified
+        if(!(flags & kMatchDuplicates))
+          break;
+      }
+      err = cursor->get(&key, &value, DB_NEXT_DUP | DB_RMW);
     }
-  } else {
-    // Abort the new transaction
-	delete [] (char*) pkey;
-    tid->abort();
 
-    return kErrorUnknownIndex;
+    if((err != 0) && (err != DB_NOTFOUND))
+      result = kErrorGenericFailure;
+    else if(modified == 0)
+      result = kErrorNotFound;
+
+    cursor->close();
+    cursor = NULL;
+
+    // Remove the secondary entries of the key if it has no records left
+    if((result == kOk) && (payload == NULL))
+      DeleteSecondary(tid, &search);
+  } catch (DbException &e) {
+    if(cursor != NULL)
+      cursor->close();
+    if(tid != Transaction::txn(tx))
+      tid->abort();
+    throw;
   }
 
-  // Commit the nested transaction //TODO: Errorhandling
-  delete [] (char*) pkey;
-  tid->commit(0);
-
-  // We finished writing on the index
-  structure_->end_transaction(tid);
-  
+  if(tid != Transaction::txn(tx)){
+    if(result == kOk)
+      tid->commit(0);
+    else
+      tid->abort();
+  }
+  if(result == kOk)
+    Account(tx, delta);
   return result;
 }
+
 bool Index::Compatible(Record *record){
   if((record == NULL) || closed_)
     return false;
@@ -493,51 +835,52 @@ IndexManager& IndexManager::getInstance(){
   return instance;
 };
 
-void IndexManager::Insert(std::string name, IndexStructure* structure){
+bool IndexManager::Insert(const char* name, IndexStructure* structure){
   lock(mutex_){
-    indices_[name] = structure;
+    return indices_.Insert(name, structure);
   }
+  return false;
 };
 
-IndexStructure* IndexManager::Find(std::string name){
-  lock(mutex_){
-    std::map<std::string,IndexStructure*>::iterator it = indices_.find(name);
-
-    if( it != indices_.end())
-    {
-      return it->second;
-    }
-    
-    return NULL;
-  }
+IndexStructure* IndexManager::Find(const char* name, Pin* pin){
+  return indices_.Find(name, pin);
 };
 
-ErrorCode IndexManager::Remove(std::string name){
+ErrorCode IndexManager::Remove(const char* name, std::vector<uint8_t>* secondary){
+  IndexStructure* structure;
   lock(mutex_){
-    std::map<std::string,IndexStructure*>::iterator it = indices_.find(name);
-
-    if( it != indices_.end()){
-      // Try to delete the index structure
-      if(it->second->MakeReadOnly()){
-        delete it->second;
-        indices_.erase(it);
-      } else {
-        //std::cout<<"kErrorOpenTransaction"<<std::flush;
-        return kErrorOpenTransactions;
-      }
-    } else {
-      //std::cout<<"kErrorUnknownIndex"<<std::flush;
+    structure = indices_.Get(name);
+    if(structure == NULL)
       return kErrorUnknownIndex;
-    }
+
+    // Try to make the index structure read-only
+    if(!structure->MakeReadOnly())
+      return kErrorOpenTransactions;
+
+    *secondary = structure->secondary();
+    indices_.Remove(name);
   }
+
+  // Nobody can find the structure anymore
+  delete structure;
   return kOk;
 }
 
-IndexStructure::IndexStructure(uint8_t attribute_count, KeyType type){
+IndexStructure::IndexStructure(uint8_t attribute_count, KeyType type, const IndexOptions* options)
+    : mutex_("IndexStructure::mutex_"), transaction_mutex_("IndexStructure::transaction_mutex_"){
+    MemoryBudget::getInstance().Charge(StructureCharge(attribute_count));
     attribute_count_ = attribute_count;
     type_ = new AttributeType[attribute_count];
     size_ = 0;
+    fixed_size_ = 0;
     read_only_=false;
+    transaction_count_ = 0;
+    records_ = 0;
+    key_bytes_ = 0;
+    key_padding_ = 0;
+    payload_bytes_ = 0;
+    iterator_bytes_ = 0;
+    db_ = NULL;
 
     // Build the size and copy the type array
     for(int i = 0; i < attribute_count; i++){
@@ -546,18 +889,98 @@ IndexStructure::IndexStructure(uint8_t attribute_count, KeyType type){
       else if(type[i] == kInt)
         size_ += 8;
       else
-        size_ += MAX_VARCHAR_LENGTH+1;
+        size_ += 2*MAX_VARCHAR_LENGTH+2;
       
       type_[i] = type[i];
     }
+
+    // Without varchars every key has the same size
+    bool fixed = true;
+    for(int i = 0; i < attribute_count; i++)
+      fixed = fixed && (type[i] != kVarchar);
+    if(fixed)
+      fixed_size_ = size_;
+
+    layout_ = kLayoutLexicographic;
+    if(options != NULL){
+      secondary_.assign(options->secondary, options->secondary + options->secondary_count);
+      layout_ = options->layout;
+    }
+
+    // The Z-order curve takes one bit of every attribute at a time, kShort
+    // attributes are aligned with the most significant bits of kInt attributes
+    if(layout_ == kLayoutZOrder){
+      for(int level = 63; level >= 0; level--){
+        for(int i = 0; i < attribute_count; i++){
+          if((type_[i] == kShort) && (level < 32))
+            continue;
+          CurveBit bit;
+          bit.attribute = i;
+          bit.bit = (type_[i] == kShort) ? level - 32 : level;
+          curve_.push_back(bit);
+        }
+      }
+    }
   };
 
+std::string IndexStructure::SecondaryName(const std::string& name, uint8_t attribute){
+  // A control character separates the suffix, as names chosen by users do not contain one
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), "\x1fsecondary%u", (unsigned) attribute);
+  return name + suffix;
+}
+
 IndexStructure::~IndexStructure(){
     // Close all open Handles of this structure
     CloseHandles();
+
+    // And the Berkeley DB handles they have shared
+    for(size_t i = 0; i < secondary_db_.size(); i++){
+      secondary_db_[i]->close(0);
+      delete secondary_db_[i];
+    }
+    if(db_ != NULL){
+      db_->close(0);
+      delete db_;
+    }
     delete[] type_;
+    MemoryBudget::getInstance().Release(StructureCharge(attribute_count_));
   };
 
+// Create the Berkeley DB databases of the index with the given name
+void IndexStructure::Create(const char* name){
+  // A single free-threaded handle of every database is shared by all index handles
+  db_ = new Db(ConnectionManager::getInstance().env(), 0);
+
+  // Allow duplicates for this index
+  db_->set_flags(DB_DUP);
+
+  // Attach the structure to the db handle (used by the compare function)
+  db_->set_app_private(this);
+
+  // Set the compare function for the b-tree
+  db_->set_bt_compare(&keycmp);
+
+  // Create the new index
+  db_->open(NULL,                                     // Transaction pointer
+    NULL,                                             // File name (NULL, because we want the index to be in-memory)
+    name,                                             // Logical db name (i.e. the index name)
+    DB_BTREE,                                         // Database type (we use b-tree)
+    DB_CREATE | DB_EXCL | DB_THREAD | DB_AUTO_COMMIT, // Open flags
+    0                                                 // File mode (defaults)
+    );
+
+  // Create the secondary indices (they map an attribute to the binary keys having it,
+  // which are kept sorted so that the records of a value can be returned in order)
+  for(size_t i = 0; i < secondary_.size(); i++){
+    Db* db = new Db(ConnectionManager::getInstance().env(), 0);
+    secondary_db_.push_back(db);
+    db->set_flags(DB_DUP | DB_DUPSORT);
+    db->open(NULL, NULL, SecondaryName(name, secondary_[i]).c_str(), DB_BTREE,
+             DB_CREATE | DB_EXCL | DB_THREAD | DB_AUTO_COMMIT, 0);
+  }
+}
+
 void IndexStructure::register_handle(Index* handle){
     lock(mutex_){
       handles_.insert(handle);
@@ -571,40 +994,40 @@ void IndexStructure::unregister_handle(Index* handle){
   };
 
 void IndexStructure::CloseHandles(){
+      // Closing a handle unregisters it, so the set is copied first
+      std::set<Index*> handles;
+      lock(mutex_){
+        handles = handles_;
+      }
       std::set<Index*>::iterator it;
-      it=handles_.begin();
-      while(it != handles_.end()){
+      for(it = handles.begin(); it != handles.end(); it++){
         // Closs Index handle
         if(*it != NULL)
           (*it)->Close();
-        it++;
-
       }
   };
 
   
 // Start a new modifying transaction on this index (returns false if index is read-only)
-bool IndexStructure::start_transaction(DbTxn *tx){
-  lock(transaction_mutex_){
+bool IndexStructure::start_transaction(){
+  lock(shared(transaction_mutex_)){
     if(read_only_)
       return false;
     
-    transactions_.insert(tx);
+    __sync_fetch_and_add(&transaction_count_, 1);
   }
   return true;
 }
 
 // End a modifying transaction on this index
-void IndexStructure::end_transaction(DbTxn *tx){
-  lock(transaction_mutex_){
-    transactions_.erase(tx);
-  }
+void IndexStructure::end_transaction(){
+  __sync_fetch_and_sub(&transaction_count_, 1);
 }
 
 // Try to make this index read-only (will return false if open transactions have written to this index)
 bool IndexStructure::MakeReadOnly(){
   lock(transaction_mutex_){
-    if(transactions_.size() > 0){
+    if(transaction_count_ > 0){
       return false;
     }
     read_only_ = true;
@@ -612,12 +1035,49 @@ bool IndexStructure::MakeReadOnly(){
   return true;
 }
 
-void IndexManager::CloseTransaction(Transaction* tx){
-  lock(mutex_){
-    std::map<std::string,IndexStructure*>::iterator it;
-    for(it=indices_.begin();it!=indices_.end();it++){
-      it->second->end_transaction((DbTxn*) tx);
-    }
-  }
+void IndexStructure::Account(const FootprintDelta& delta){
+  __sync_fetch_and_add(&records_, delta.records);
+  __sync_fetch_and_add(&key_bytes_, delta.key_bytes);
+  __sync_fetch_and_add(&key_padding_, delta.key_padding);
+  __sync_fetch_and_add(&payload_bytes_, delta.payload_bytes);
 }
 
+void IndexStructure::CountIteratorBytes(int64_t bytes){
+  __sync_fetch_and_add(&iterator_bytes_, bytes);
+}
+
+// Read a counter that is changed atomically (transactions add their changes when
+// they commit, so a delete may be added before the insert of its record)
+static inline uint64_t ReadCounter(int64_t* counter){
+  int64_t value = __sync_fetch_and_add(counter, 0);
+  return (value > 0) ? (uint64_t) value : 0;
+}
+
+// Return the number of bytes of the pages of a database (DB_FAST_STAT only reads
+// its metadata instead of traversing the tree)
+static uint64_t PageBytes(Db* db){
+  DB_BTREE_STAT* stat = NULL;
+  if(db->stat(NULL, &stat, DB_FAST_STAT) != 0)
+    return 0;
+  uint64_t bytes = (uint64_t) stat->bt_pagecnt * stat->bt_pagesize;
+  free(stat);
+  return bytes;
+}
+
+void IndexStructure::footprint(IndexFootprint* footprint){
+  footprint->records = ReadCounter(&records_);
+  footprint->keys = 0;
+  footprint->key_bytes = ReadCounter(&key_bytes_);
+  footprint->key_padding = ReadCounter(&key_padding_);
+  footprint->payload_bytes = ReadCounter(&payload_bytes_);
+  footprint->duplicates = 0;
+  footprint->chain_bytes = 0;
+
+  // The secondary indices only hold copies of the keys, so they count as overhead
+  footprint->tree_bytes = PageBytes(db_);
+  for(size_t i = 0; i < secondary_db_.size(); i++)
+    footprint->tree_bytes += PageBytes(secondary_db_[i]);
+  uint64_t data = footprint->key_bytes + footprint->payload_bytes;
+  footprint->tree_overhead = (footprint->tree_bytes > data) ? footprint->tree_bytes - data : 0;
+  footprint->iterator_bytes = ReadCounter(&iterator_bytes_);
+}
@@ -4,18 +4,24 @@
 #include <map>
 #include <set>
 #include <string>
+#include <vector>
 
 #include <contest_interface.h>
+#include <contest_extensions.h>
 #include <common/macros.h>
 
+#include "Arena.h"
+#include "Catalog.h"
 #include "ConnectionManager.h"
 #include "Mutex.h"
+#include "Transaction.h"
 
 class Db;
 class Dbt;
 class Dbc;
 class IndexStructure;
-class DbTxn; // TODO: Replace with Transaction
+class DbTxn;
+struct CompactAttribute;
 
 // Class representing an index handle
 class Index{
@@ -29,27 +35,44 @@ class Index{
   // Close this index
   void Close();
   
-  // Create a cursor to access the data inside this index
+  // Create a cursor to access the data inside this index (inside a transaction a
+  // cursor left behind by a closed iterator is reused)
   Dbc* Cursor(Transaction* tx);
+
+  // Create a cursor to access the secondary index with the given number
+  Dbc* SecondaryCursor(Transaction* tx, int i);
   
   // Return the name of this index
   const char* name() const { return name_; };
+
+  // Return the structure of this index
+  IndexStructure* structure() const { return structure_; };
   
-  // Converts the given Dbt to a key of this index
-  Key GetKey(const Dbt *bdb_key);
-  void FreeKey(Key key);
+  // Converts the given Dbt to a key of this index (allocated from the arena)
+  Key GetKey(const Dbt *bdb_key, Arena* arena);
   
-  // Converts the given Key of this index into a Dbt object
-  Dbt *GetBDBKey(Key key, bool max = false);
+  // Converts the given key of this index into a Dbt object (allocated from the arena)
+  Dbt *GetBDBKey(const CompactAttribute* key, Arena* arena, bool max = false);
   
   // Insert the given record into the index
   ErrorCode Insert(Transaction *tx, Record *record);
+
+  // Insert the record with the given key and payload into the index
+  ErrorCode Insert(Transaction *tx, const CompactAttribute* key, const Block& payload);
+
+  // Insert the given records into the index in the order of their keys
+  ErrorCode InsertRecords(Transaction *tx, Record *records, uint32_t count);
   
   // Update the given record with the given payload
   ErrorCode Update(Transaction *tx, Record *record, Block *payload, uint8_t flags);
   
   // Delete the given record
   ErrorCode Delete(Transaction *tx, Record *record, uint8_t flags);
+
+  // Updates the records with the given key and payload (any payload with
+  // kIgnorePayload) with the new payload (or deletes them if it is NULL)
+  ErrorCode Modify(Transaction *tx, const CompactAttribute* key, const Block& current,
+                   Block *payload, uint8_t flags);
   
   // Checks whether the given record is compatible with this index
   bool Compatible(Record *record);
@@ -70,7 +93,22 @@ class Index{
   // Constructor
   Index(const char* name);
   
-  // The Berkeley DB database handle
+  // Add a change of the footprint to the transaction (or to the structure right
+  // away for autocommit operations that have been committed)
+  void Account(Transaction *tx, const FootprintDelta& delta);
+
+  // Perform a single attempt of an insert or a modification (autocommit operations
+  // are retried by Insert() and Modify() if they are chosen as deadlock victims)
+  ErrorCode InsertOnce(Transaction *tx, const CompactAttribute* key, const Block& payload);
+  ErrorCode ModifyOnce(Transaction *tx, const CompactAttribute* key, const Block& current,
+                       Block *payload, uint8_t flags);
+
+  // Adds or removes the entries of the secondary indices for a record with the given
+  // binary key (entries are only removed if no record with that key is left)
+  void InsertSecondary(DbTxn* tx, Dbt* bdb_key);
+  void DeleteSecondary(DbTxn* tx, Dbt* bdb_key);
+
+  // The Berkeley DB database handle (it belongs to the structure)
   Db	*db_;
 
   // The name of this index
@@ -89,7 +127,8 @@ class Index{
   std::set<Iterator*> iterators_;
   
   // A mutex for protecting the insert and read operations on the iterator set
-  Mutex mutex_;
+  // (held only briefly, so waiting threads spin before they block)
+  SpinMutex mutex_;
   
   DISALLOW_COPY_AND_ASSIGN(Index);
 };
@@ -97,17 +136,54 @@ class Index{
 // Class representing the structure of an index
 class IndexStructure{
   public:
-  // Constructor
-  IndexStructure(uint8_t attribute_count, KeyType type);
+  // Constructor (options may be NULL)
+  IndexStructure(uint8_t attribute_count, KeyType type, const IndexOptions* options = NULL);
   
   // Destructor
   ~IndexStructure();
   
-  // Converts the given Dbt to a key of this index
-  Key GetKey(const Dbt *bdb_key);
+  // Converts the given Dbt to a key of this index (allocated from the arena)
+  Key GetKey(const Dbt *bdb_key, Arena* arena);
+
+  // Decodes the given Dbt into the attribute_count() preallocated attributes
+  void DecodeKey(const Dbt *bdb_key, Attribute **attributes);
   
-  // Converts the given Key of this index into a Dbt object
-  Dbt *GetBDBKey(Key key, bool max = false);
+  // Converts the given key of this index into a Dbt object (allocated from the arena)
+  Dbt *GetBDBKey(const CompactAttribute* key, Arena* arena, bool max = false);
+
+  // Writes the binary representation of the given key into buffer (which has to hold
+  // size() bytes) and returns its length
+  uint32_t EncodeKey(Key key, char* buffer, bool max = false);
+  uint32_t EncodeKey(const CompactAttribute* key, char* buffer, bool max = false);
+
+  // Return the number of bytes of the given key that hold data (the encoding adds
+  // a terminator to every varchar and escapes some of its characters)
+  uint32_t DataSize(Key key) const;
+  uint32_t DataSize(const CompactAttribute* key) const;
+
+  // Compares two binary keys of this index (without allocating memory or taking locks)
+  int Compare(const Dbt *a, const Dbt *b) const;
+
+  // Determines the offset of every attribute inside the given binary key
+  // (offsets needs room for attribute_count()+1 values, the last one is the end of the key)
+  void Offsets(const Dbt *bdb_key, uint32_t *offsets) const;
+
+  // Converts between a binary key of the Z-order layout and the order-preserving unsigned
+  // values of its attributes (kShort uses the lower 32 bits of its value)
+  void Interleave(const uint64_t *values, char *buffer) const;
+  void Deinterleave(const Dbt *bdb_key, uint64_t *values) const;
+
+  // Computes the smallest point of the box [min, max] that follows the point key on the
+  // Z-order curve (returns false if there is none)
+  bool BigMin(const uint64_t *key, const uint64_t *min, const uint64_t *max, uint64_t *next) const;
+
+  // Create the Berkeley DB databases of the index with the given name and open the
+  // free-threaded handles that are shared by all index handles
+  void Create(const char* name);
+
+  // Return the Berkeley DB handles of the index and of its secondary indices
+  Db* db() const { return db_; };
+  const std::vector<Db*>& secondary_db() const { return secondary_db_; };
 
   // Register a new index handle
   void register_handle(Index* handle);
@@ -119,17 +195,32 @@ class IndexStructure{
   void CloseHandles();
   
   // Start a new modifying transaction on this index (returns false if index is readonly)
-  bool start_transaction(DbTxn *tx);
+  bool start_transaction();
 
   // End a modifying transaction on this index
-  void end_transaction(DbTxn *tx);
+  void end_transaction();
 
   // Try to make this index read-only (will return false if open transactions have written to this index)
   bool MakeReadOnly();
 
+  // Add the change of the footprint caused by committed writes
+  void Account(const FootprintDelta& delta);
+
+  // Account for memory held by an iterator over the index
+  void CountIteratorBytes(int64_t bytes);
+
+  // Return the footprint of the index (reads the page counts of its databases)
+  void footprint(IndexFootprint* footprint);
+
+  // Return the name of the Berkeley DB database holding the secondary index on the
+  // given attribute of the index with the given name
+  static std::string SecondaryName(const std::string& name, uint8_t attribute);
+
   uint8_t attribute_count() const { return attribute_count_; };
   AttributeType* type(){ return type_; };
   size_t size(){return size_;};
+  const std::vector<uint8_t>& secondary() const { return secondary_; };
+  KeyLayout layout() const { return layout_; };
  
  private:
   // The number of attributes that form a key of this index
@@ -138,23 +229,54 @@ class IndexStructure{
   // An array of attribute types
    AttributeType* type_;
   
-  // The size of a key of this index in byte
+  // The maximum size of a binary key of this index in byte
   size_t size_;
 
+  // The size of every binary key of this index if it only has integer attributes (or 0)
+  size_t fixed_size_;
+
+  // The attributes that have a secondary index
+  std::vector<uint8_t> secondary_;
+
+  // The order of the keys
+  KeyLayout layout_;
+
+  // A bit of a key in the Z-order layout
+  struct CurveBit {
+    uint8_t attribute;
+    uint8_t bit;
+  };
+
+  // The bits of the Z-order layout, starting with the most significant one
+  std::vector<CurveBit> curve_;
+
   // Whether the index is readonly
   bool read_only_;
 
+  // The Berkeley DB database handles of the index and of its secondary indices
+  Db* db_;
+  std::vector<Db*> secondary_db_;
+
   // A set of all open handles of this index structure
   std::set<Index*> handles_;
 
-  // A set of open transactions that have modified this index
-  std::set<DbTxn*> transactions_;
+  // The number of open transactions that have modified this index
+  volatile uint32_t transaction_count_;
+
+  // The counters of the footprint (changed atomically)
+  int64_t records_;
+  int64_t key_bytes_;
+  int64_t key_padding_;
+  int64_t payload_bytes_;
+  int64_t iterator_bytes_;
   
   // A mutex for protecting the insert and read operations on the handle set
   Mutex mutex_;
 
-  // A mutex for protecting the insert and read operations on the transaction set
-  Mutex transaction_mutex_;
+  // A lock for making the index read-only: transactions starting to modify the
+  // index hold it shared, MakeReadOnly() holds it exclusively (it has a cache line
+  // of its own, as the attributes above are read by every operation)
+  Padded<SharedMutex> transaction_mutex_;
 
   DISALLOW_COPY_AND_ASSIGN(IndexStructure);
 };
@@ -173,40 +295,32 @@ class IndexManager{
     // Return the singleton instance of IndexManager
 		static IndexManager& getInstance();
 		
-    // Search for a index with the given name
-    IndexStructure *Find(std::string name);    
+    // Keeps an index structure found by Find() from being deleted
+    typedef Catalog<IndexStructure>::Pin Pin;
+
+    // Search for a index with the given name and pin it (never blocks)
+    IndexStructure *Find(const char* name, Pin* pin);
     
-    // Insert a index structure (may overwrite existing entrie)
-    void Insert(std::string name, IndexStructure* structure);
+    // Insert a index structure (returns false if the name is already in use)
+    bool Insert(const char* name, IndexStructure* structure);
     
-    // Search and delete the index structure with the given name
-    ErrorCode Remove(std::string name);
-
-    // Removes the given transaction from all indices
-    void CloseTransaction(Transaction* tx);
-
-    //IndexStructure* structure("");
+    // Search and delete the index structure with the given name (waits until it
+    // is no longer pinned) and return the attributes of its secondary indices
+    ErrorCode Remove(const char* name, std::vector<uint8_t>* secondary);
 
 	private:
 		// Private constructor (don't allow instanciation from outside)
-		IndexManager(){};
+		IndexManager():mutex_("IndexManager::mutex_"){};
 
 		// Destructor
 		~IndexManager(){};
 		
-		// A map holding the structures of all indices
-		std::map<std::string,IndexStructure*> indices_;
-    
+		// A catalog holding the structures of all indices
+		Catalog<IndexStructure> indices_;
 
-    //std::map<Db*, IndexStructure*> structure_;
-    // A mutex for protecting the insert and read operations
-    // Note: It would be better to use some type of S/X locks
-    // as multiple threads may read the map concurrently without
-    // affecting each other (this map however is not performance-critical)
+    // A mutex serializing the modifications of the catalog
     Mutex mutex_;
     
-    Mutex db_mutex_;
-
     DISALLOW_COPY_AND_ASSIGN(IndexManager);
 };
 
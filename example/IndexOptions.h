@@ -0,0 +1,38 @@
+#ifndef _INDEX_OPTIONS_H_
+#define _INDEX_OPTIONS_H_
+
+#include <contest_interface.h>
+#include <contest_extensions.h>
+
+// Checks the options passed to CreateIndexWithOptions() (NULL selects the defaults)
+inline bool ValidOptions(uint8_t column_count, KeyType types, const IndexOptions* options){
+  if(options == NULL)
+    return true;
+
+  // Secondary indices are only useful for attributes behind the first one
+  for(int i = 0; i < options->secondary_count; i++){
+    uint8_t attribute = options->secondary[i];
+    if((attribute == 0) || (attribute >= column_count))
+      return false;
+    for(int j = 0; j < i; j++){
+      if(options->secondary[j] == attribute)
+        return false;
+    }
+  }
+
+  // The other layouts partition the space of integer attributes,
+  // which makes secondary indices unnecessary
+  if((options->layout == kLayoutZOrder) || (options->layout == kLayoutKdTree)){
+    if(options->secondary_count > 0)
+      return false;
+    for(int i = 0; i < column_count; i++){
+      if(types[i] == kVarchar)
+        return false;
+    }
+  } else if(options->layout != kLayoutLexicographic){
+    return false;
+  }
+  return true;
+}
+
+#endif // _INDEX_OPTIONS_H_
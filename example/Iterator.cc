@@ -10,99 +10,418 @@
 #include <string.h>
 #include <assert.h>
 
+// The size of the buffer that receives a batch of records from the cursor
+static const size_t kBatchSize = 64 * 1024;
+
+// The movements of all closed iterators
+static uint64_t total_steps = 0;
+static uint64_t total_seeks = 0;
+
 /**
  * Initialize the iterator to iterate over a given index.
  */
-Iterator::Iterator(Transaction* tx, Index* idx, Key min_keys, Key max_keys){
-  
+Iterator::Iterator(Transaction* tx, Index* idx, Key min_keys, Key max_keys)
+    : reservation_(sizeof(Iterator)){
+  // The keys are only needed while the iterator is initialized, so their strings
+  // are not copied
+  Arena* arena = (tx != NULL) ? tx->arena() : &arena_;
+  AttributeType* types = idx->structure()->type();
+  Init(tx, idx, CompactKey(min_keys, types, arena, false), CompactKey(max_keys, types, arena, false));
+}
+
+Iterator::Iterator(Transaction* tx, Index* idx, const CompactAttribute* min_keys,
+                   const CompactAttribute* max_keys)
+    : reservation_(sizeof(Iterator)){
+  Init(tx, idx, min_keys, max_keys);
+}
+
+void Iterator::Init(Transaction* tx, Index* idx, const CompactAttribute* min_keys,
+                    const CompactAttribute* max_keys){
   index_ = idx;
+  tx_ = tx;
+  structure_ = idx->structure();
   closed_ = false;
   end_ = false;
   initialized_ = false;
-  cvalue = NULL;
+  steps_ = 0;
+  seeks_ = 0;
 
-    
-  // Initialize the min_key_ (copy the whole key)
-  CopyKey(min_key_, min_keys);
-  
-  // Initialize the max_key_ (copy the whole key)
-  CopyKey(max_key_, max_keys);
+  // All memory of the iterator comes from the arena of its transaction (or from its
+  // own arena), so it is freed at once
+  Arena* arena = (tx != NULL) ? tx->arena() : &arena_;
+
+  // Prepare the record returned by value(), so that no record needs to be allocated
+  int attribute_count = structure_->attribute_count();
+  Attribute* attributes = arena->NewArray<Attribute>(attribute_count);
+  Attribute** attribute_pointers = arena->NewArray<Attribute*>(attribute_count);
+  for(int i = 0; i < attribute_count; i++)
+    attribute_pointers[i] = &attributes[i];
+  record_.key.attribute_count = attribute_count;
+  record_.key.value = attribute_pointers;
+  record_.payload.data = NULL;
+  record_.payload.size = 0;
+
+  // Convert the range into binary keys
+  min_key_ = index_->GetBDBKey(min_keys, arena);
+  max_key_ = index_->GetBDBKey(max_keys, arena, true);
+
+  // Determine where the attributes of the range are located
+  int count = structure_->attribute_count() + 1;
+  key_offsets_ = arena->NewArray<uint32_t>(count);
+  min_offsets_ = arena->NewArray<uint32_t>(count);
+  max_offsets_ = arena->NewArray<uint32_t>(count);
+  structure_->Offsets(min_key_, min_offsets_);
+  structure_->Offsets(max_key_, max_offsets_);
+  seek_key_ = arena->NewArray<char>(2 * structure_->size() + 1);
+
+  // The corners of the range on the Z-order curve
+  key_values_ = min_values_ = max_values_ = seek_values_ = NULL;
+  if(structure_->layout() == kLayoutZOrder){
+    key_values_ = arena->NewArray<uint64_t>(count);
+    min_values_ = arena->NewArray<uint64_t>(count);
+    max_values_ = arena->NewArray<uint64_t>(count);
+    seek_values_ = arena->NewArray<uint64_t>(count);
+    structure_->Deinterleave(min_key_, min_values_);
+    structure_->Deinterleave(max_key_, max_values_);
+  }
 
   // Initialize the cursor
   cursor_ = index_->Cursor(tx);
+  cursor_db_ = structure_->db();
+  range_ = (tx != NULL) ? tx->AddRange(idx, min_keys, max_keys) : NULL;
   
   // Start with the min_key and an empty value
-  key_ = index_->GetBDBKey(min_keys);
-  value_ = new Dbt();
+  key_ = arena->New<Dbt>();
+  value_ = arena->New<Dbt>();
   value_->set_size(0);
 
+  // Check whether a secondary index is more selective than the index itself
+  secondary_cursor_ = NULL;
+  secondary_db_ = NULL;
+  secondary_key_ = arena->New<Dbt>();
+  secondary_value_ = arena->New<Dbt>();
+  secondary_ = ChooseSecondary();
+  if(secondary_ >= 0){
+    secondary_cursor_ = index_->SecondaryCursor(tx, secondary_);
+    secondary_db_ = structure_->secondary_db()[secondary_];
+  }
+
+  // Otherwise the records are read in batches (a batch fits at least a few of the
+  // largest records, Berkeley DB wants its size to be a multiple of 1024). A read
+  // committed cursor only holds the lock of the record it is positioned on, so it
+  // reads one record at a time to keep the returned record locked until the iterator
+  // moves on; the other cursors read a snapshot or keep their read locks.
+  batch_ = NULL;
+  batch_iterator_ = NULL;
+  batch_size_ = 0;
+  if((secondary_ < 0) && (Transaction::cursor_flags(tx) != DB_READ_COMMITTED)){
+    size_t size = 4 * (structure_->size() + MAX_PAYLOAD_LENGTH + 16);
+    size = (size < kBatchSize) ? kBatchSize : ((size + 1023) & ~((size_t) 1023));
+    char* buffer = (tx != NULL) ? tx->TakeBuffer(size) : NULL;
+    if(buffer == NULL){
+      // The buffer stays charged while it is kept by the transaction
+      MemoryBudget::getInstance().Charge(size);
+      try{
+        buffer = new char[size];
+      } catch(std::bad_alloc &e){
+        MemoryBudget::getInstance().Release(size);
+        throw;
+      }
+    }
+    batch_ = arena->New<Dbt>();
+    batch_->set_data(buffer);
+    batch_->set_size(size);
+    batch_->set_ulen(size);
+    batch_->set_flags(DB_DBT_USERMEM);
+    batch_size_ = size;
+  }
+
+  // The attributes of the record reserve MAX_VARCHAR_LENGTH+1 characters each
+  footprint_ = sizeof(Iterator) + attribute_count * (sizeof(Attribute) + sizeof(Attribute*))
+               + min_key_->get_size() + max_key_->get_size() + batch_size_;
+  structure_->CountIteratorBytes(footprint_);
+
 
   // Register the new iterator
   //index_->register_iterator(this);
 }
 
+// Compares two attributes of binary keys (the encoding is order-preserving)
+static inline int AttributeCompare(const char* a, uint32_t a_size, const char* b, uint32_t b_size){
+  int res = memcmp(a, b, (a_size < b_size) ? a_size : b_size);
+  if(res != 0)
+    return res;
+  return (a_size < b_size) ? -1 : ((a_size > b_size) ? 1 : 0);
+}
+
+int Iterator::Violation(bool *above){
+  const char* key = (const char*) key_->get_data();
+  const char* min = (const char*) min_key_->get_data();
+  const char* max = (const char*) max_key_->get_data();
+  structure_->Offsets(key_, key_offsets_);
+
+  for(int i = 0; i < structure_->attribute_count(); i++){
+    const char* attribute = key + key_offsets_[i];
+    uint32_t size = key_offsets_[i+1] - key_offsets_[i];
+    if(AttributeCompare(attribute, size, min + min_offsets_[i], min_offsets_[i+1] - min_offsets_[i]) < 0){
+      *above = false;
+      return i;
+    }
+    if(AttributeCompare(attribute, size, max + max_offsets_[i], max_offsets_[i+1] - max_offsets_[i]) > 0){
+      *above = true;
+      return i;
+    }
+  }
+  return -1;
+}
+
+void Iterator::SetSeekKey(int index, bool above){
+  // Keep the attributes in front of the violating one
+  uint32_t prefix = key_offsets_[index];
+  memcpy(seek_key_, key_->get_data(), prefix);
+
+  uint32_t size;
+  if(above){
+    // Every key with this prefix is smaller than the prefix followed by
+    // more 0xFF bytes than any key can have behind it
+    size = structure_->size() + 1;
+    memset(seek_key_ + prefix, 0xFF, size - prefix);
+  } else {
+    // Continue with the minimum key from the violating attribute on
+    uint32_t rest = min_offsets_[structure_->attribute_count()] - min_offsets_[index];
+    memcpy(seek_key_ + prefix, ((char*) min_key_->get_data()) + min_offsets_[index], rest);
+    size = prefix + rest;
+  }
+  key_->set_data(seek_key_);
+  key_->set_size(size);
+}
+
+int Iterator::ChooseSecondary(){
+  const char* min = (const char*) min_key_->get_data();
+  const char* max = (const char*) max_key_->get_data();
+
+  // The range of an attribute holds a single value if its bounds are equal. If that is
+  // the case for the first attribute, the index itself only reads the range (i == -1).
+  const std::vector<uint8_t>& secondary = structure_->secondary();
+  for(int i = -1; i < (int) secondary.size(); i++){
+    int attribute = (i < 0) ? 0 : secondary[i];
+    uint32_t min_size = min_offsets_[attribute+1] - min_offsets_[attribute];
+    uint32_t max_size = max_offsets_[attribute+1] - max_offsets_[attribute];
+    if((min_size == max_size)
+        && (memcmp(min + min_offsets_[attribute], max + max_offsets_[attribute], min_size) == 0))
+      return i;
+  }
+  return -1;
+}
+
 //
-// Retrieves the next value from the iterator
+// Retrieves the next value from the iterator using the secondary index
 //
-// It essentially applies post-filtering to the result set, in order to find 
-// the next valid key/value pair
-// (i.e., it reads the next key/value pairs until a valid one has been found 
-//  or the given range is exceeded).
+// All keys having the value of the secondary attribute are stored as sorted duplicates
+// in the secondary index. Every key that also lies inside the range of the other
+// attributes is looked up in the index to return its records.
 //
-// This approach can be very inefficient (especially for partial match queries
-// that do not restrict the dimension of the first key)
+bool Iterator::NextSecondary(){
+  int err;
+
+  if(!initialized_){
+    // Position the secondary cursor at the value of the range
+    uint8_t attribute = structure_->secondary()[secondary_];
+    secondary_key_->set_data(((char*) min_key_->get_data()) + min_offsets_[attribute]);
+    secondary_key_->set_size(min_offsets_[attribute+1] - min_offsets_[attribute]);
+    err = secondary_cursor_->get(secondary_key_, secondary_value_, DB_SET);
+    seeks_++;
+    initialized_ = true;
+  } else {
+    // Continue with the next record of the current key
+    err = cursor_->get(key_, value_, DB_NEXT_DUP);
+    steps_++;
+    if(err == 0)
+      return true;
+
+    // Or with the next key
+    if(err == DB_NOTFOUND){
+      err = secondary_cursor_->get(secondary_key_, secondary_value_, DB_NEXT_DUP);
+      steps_++;
+    }
+  }
+
+  bool above;
+  while(err == 0){
+    // Look up the records of keys inside the range
+    key_->set_data(secondary_value_->get_data());
+    key_->set_size(secondary_value_->get_size());
+    if(Violation(&above) < 0){
+      err = cursor_->get(key_, value_, DB_SET);
+      seeks_++;
+      if(err == 0)
+        return true;
+      if(err != DB_NOTFOUND)
+        break;
+    }
+    err = secondary_cursor_->get(secondary_key_, secondary_value_, DB_NEXT_DUP);
+    steps_++;
+  }
+
+  // Mark the iterator as ended because no new record could be fetched
+  SetEnded();
+  if(err != DB_NOTFOUND){
+    Close();
+    return false;
+  }
+  return true;
+}
+
 //
-bool Iterator::Next(){
+// Moves the cursor to the next key (DB_NEXT) or to the first key that is not smaller
+// than key_ (DB_SET_RANGE)
+//
+// The cursor reads as many records as fit into batch_ at once (DB_MULTIPLE_KEY) and is
+// left at the last of them. Until the batch is exhausted, the records are taken from
+// it without calling into Berkeley DB, which also includes seeks whose key is found
+// further inside the batch. key_ and value_ point into the batch, so the returned
+// record stays valid until the next batch is fetched. Without a batch buffer the
+// cursor reads a single record.
+//
+int Iterator::Fetch(uint32_t flags){
+  if(batch_ == NULL)
+    return cursor_->get(key_, value_, flags);
+
+  if(batch_iterator_ != NULL){
+    if(flags == DB_NEXT){
+      if(batch_iterator_->next(*key_, *value_))
+        return 0;
+    } else {
+      Dbt target(key_->get_data(), key_->get_size());
+      while(batch_iterator_->next(*key_, *value_)){
+        if(structure_->Compare(key_, &target) >= 0)
+          return 0;
+      }
+      key_->set_data(target.get_data());
+      key_->set_size(target.get_size());
+    }
+    delete batch_iterator_;
+    batch_iterator_ = NULL;
+  }
+
+  int err = cursor_->get(key_, batch_, flags | DB_MULTIPLE_KEY);
+  if(err != 0)
+    return err;
+  batch_iterator_ = new DbMultipleKeyDataIterator(*batch_);
+  if(!batch_iterator_->next(*key_, *value_))
+    return DB_NOTFOUND;
+  return 0;
+}
+
+//
+// Retrieves the next value from an index using the Z-order layout
+//
+// The range of the iterator is a box whose keys lie between the keys of its minimum
+// and its maximum corner on the curve. Whenever the cursor reaches a key outside of
+// the box, it is repositioned at the next point of the curve that lies inside (BIGMIN),
+// so it only reads the intervals of the curve that run through the box.
+//
+bool Iterator::NextZOrder(){
+  int err;
+
+  if(!initialized_){
+    // The minimum corner is the first point of the box on the curve
+    key_->set_data(min_key_->get_data());
+    key_->set_size(min_key_->get_size());
+    err = Fetch(DB_SET_RANGE);
+    seeks_++;
+    initialized_ = true;
+  } else {
+    err = Fetch(DB_NEXT);
+    steps_++;
+  }
+
+  int count = structure_->attribute_count();
+  while(err == 0){
+    // The maximum corner is the last point of the box on the curve
+    if(structure_->Compare(key_, max_key_) > 0)
+      break;
+
+    structure_->Deinterleave(key_, key_values_);
+    bool inside = true;
+    for(int i = 0; (i < count) && inside; i++)
+      inside = (key_values_[i] >= min_values_[i]) && (key_values_[i] <= max_values_[i]);
+    if(inside)
+      return true;
+
+    // Skip to the next point of the curve inside the box
+    if(!structure_->BigMin(key_values_, min_values_, max_values_, seek_values_))
+      break;
+    structure_->Interleave(seek_values_, seek_key_);
+    key_->set_data(seek_key_);
+    key_->set_size(structure_->size());
+    err = Fetch(DB_SET_RANGE);
+    seeks_++;
+  }
+
+  // Mark the iterator as ended because no new record could be fetched
+  SetEnded();
+  if((err != 0) && (err != DB_NOTFOUND)){
+    Close();
+    return false;
+  }
+  return true;
+}
+
+//
+// Retrieves the next value from the iterator
+//
+// It reads the next key/value pair and checks it against the range of the iterator.
+// If an attribute lies outside of the range, all following keys that share the
+// attributes in front of it lie outside as well (or are smaller than the minimum),
+// so the cursor is repositioned behind them (skip-scan) instead of stepping through them.
+// This makes partial match queries that do not restrict the first attribute skip
+// whole groups of keys at a time.
+//
+bool Iterator::Advance(){
   int err, index;
-  bool found = false;
+  bool above;
 
+  if(secondary_ >= 0)
+    return NextSecondary();
+  if(structure_->layout() == kLayoutZOrder)
+    return NextZOrder();
 
   if(!initialized_){
     // Get the first key/value pair in the range of this iterator
-	char* pkey = (char*) key_->get_data();
-    err = cursor_->get(key_, value_, DB_SET_RANGE);
-    if (pkey != key_->get_data())
-    {
-    	delete [] pkey;
-    }
+    key_->set_data(min_key_->get_data());
+    key_->set_size(min_key_->get_size());
+    err = Fetch(DB_SET_RANGE);
+    seeks_++;
     initialized_ = true;
   } else {
     // Move the cursor to the next key
-    err = cursor_->get(key_, value_, DB_NEXT);
+    err = Fetch(DB_NEXT);
+    steps_++;
   }
   
   while(true){
     
     if( err == 0){
-    	Key key = index_->GetKey(key_);
-      
       // Check if the key is inside the range of this iterator
-      if(!CheckBounds(key,max_key_,&index)){
-    	  index_->FreeKey(key);
-
-        // As the records are ordered starting with the first key attribute
-        // we have exceeded our key range when the first key attribute of the retrieved
-        // key is greater than the first attribute of the maximum key
-        if(index == 0){
-
-          // Mark the iterator as ended
-          SetEnded();
-          
-          // And clean up
-          //delete [] (char*)key_->get_data();
-	        //delete key_;
-          //delete [] (char*)value_->get_data();
-          //delete value_;
-
-          return true;
-        }
-        // Move the cursor to the next key
-        err = cursor_->get(key_, value_, DB_NEXT);
-      } else {
+      if((index = Violation(&above)) < 0){
         // We've found a record
-    	  index_->FreeKey(key);
         return true;
       }
+
+      // As the records are ordered starting with the first key attribute
+      // we have exceeded our key range when the first key attribute of the retrieved
+      // key is greater than the first attribute of the maximum key
+      if(above && (index == 0)){
+        // Mark the iterator as ended
+        SetEnded();
+        return true;
+      }
+
+      // Skip to the next key that might be inside the range
+      SetSeekKey(index, above);
+      err = Fetch(DB_SET_RANGE);
+      seeks_++;
     } else {
       // Mark the iterator as ended because no new record could be fetched
       SetEnded();
@@ -122,51 +441,110 @@ bool Iterator::Next(){
   return true;
 }
 
+// Move the iterator to the next record and record it for the validation of an
+// optimistic transaction
+bool Iterator::Next(){
+  if(!Advance())
+    return false;
+  if(range_ != NULL){
+    if(end_){
+      range_->ended = true;
+    } else {
+      range_->count++;
+      range_->fingerprint = Fingerprint(range_->fingerprint);
+    }
+  }
+  return true;
+}
+
+// Add the bytes of the given block to an FNV-1a hash
+static inline uint64_t Hash(uint64_t hash, const void* data, uint32_t size){
+  const unsigned char* bytes = (const unsigned char*) data;
+  for(uint32_t i = 0; i < size; i++)
+    hash = (hash ^ bytes[i]) * 1099511628211ULL;
+  return hash;
+}
+
+// Add the key and the payload of the current record to the given hash
+uint64_t Iterator::Fingerprint(uint64_t hash) const{
+  uint32_t size = value_->get_size();
+  hash = Hash(hash, key_->get_data(), key_->get_size());
+  hash = Hash(hash, &size, sizeof(size));
+  return Hash(hash, value_->get_data(), value_->get_size());
+}
+
 // Return the record to which the iterator refers
 Record* Iterator::value(){
-  
-  if (cvalue != NULL)
-	  DeleteRecord(&cvalue);
-  cvalue = 0;
-  
-  
   // If the iterator has already ended, don't return a record
-  if(!end_){
-    cvalue = new Record;
-    // Set the key
-    cvalue->key = index_->GetKey(key_);
-  
-    // Set the payload
-    cvalue->payload.data = malloc(value_->get_size());
-    memcpy(cvalue->payload.data,value_->get_data(),value_->get_size());
-    cvalue->payload.size = value_->get_size();
-  }
-  return cvalue;
-};
+  if(end_)
+    return NULL;
+
+  // Decode the key into the attributes of the record and let the payload refer to the
+  // data returned by the cursor (or the batch), which stays untouched until the
+  // iterator moves on
+  structure_->DecodeKey(key_, record_.key.value);
+  record_.payload.data = value_->get_data();
+  record_.payload.size = value_->get_size();
+  return &record_;
+}
+
+// Return the payload of the record to which the iterator refers
+Block Iterator::payload() const{
+  Block payload;
+  payload.data = value_->get_data();
+  payload.size = value_->get_size();
+  return payload;
+}
 
 // Close the iterator
 void Iterator::Close(){
+    closed_ = true;
+    CloseCursor();
 
-	if (cvalue != NULL)
-		 DeleteRecord(&cvalue);
+    // The batch buffer is kept for the next iterator of the transaction
+    if(batch_ != NULL){
+      if(tx_ != NULL){
+        tx_->ReturnBuffer((char*) batch_->get_data(), batch_size_);
+      } else {
+        delete [] (char*) batch_->get_data();
+        MemoryBudget::getInstance().Release(batch_size_);
+      }
+    }
+    delete batch_iterator_;
+    structure_->CountIteratorBytes(-footprint_);
 
-	closed_ = true;
-    CloseCursor();
-    DeleteKey(&min_key_);
-    DeleteKey(&max_key_);
+    // The rest of the memory belongs to the arena
+    arena_.Release();
 
-    delete key_;
-    delete value_;
+    // Add the movements of this iterator to the totals
+    __sync_fetch_and_add(&total_steps, steps_);
+    __sync_fetch_and_add(&total_seeks, seeks_);
+}
 
+// Return the counters of all iterators that have been closed so far
+void Iterator::stats(uint64_t *steps, uint64_t *seeks){
+  *steps = __sync_fetch_and_add(&total_steps, 0);
+  *seeks = __sync_fetch_and_add(&total_seeks, 0);
 }
 
 // Closes the Berkeley DB Cursor
 void Iterator::CloseCursor(){
   // Needed to prevent closing of cursor that are already closed
+  // (inside a transaction they are kept for its next iterator)
   if(cursor_!=NULL){
-    cursor_->close();
+    if(tx_ != NULL)
+      tx_->ReturnCursor(cursor_db_, cursor_);
+    else
+      cursor_->close();
     cursor_ = NULL;
   }
+  if(secondary_cursor_!=NULL){
+    if(tx_ != NULL)
+      tx_->ReturnCursor(secondary_db_, secondary_cursor_);
+    else
+      secondary_cursor_->close();
+    secondary_cursor_ = NULL;
+  }
 }
 
 // Mark the iterator as ended
@@ -2,9 +2,16 @@
 #define _ITERATOR_H_
 
 #include "Index.h"
+#include "MemoryBudget.h"
 
+class Db;
 class Dbc;
 class Dbt;
+class DbMultipleKeyDataIterator;
+
+// The size of the arena that is part of every iterator in byte (enough for
+// the state of iterators over keys with a few integer attributes)
+#define ITERATOR_ARENA_SIZE 4096
 
 // Represents an iterator
 class Iterator {
@@ -12,6 +19,10 @@ class Iterator {
   // Constructor
   Iterator(Transaction* tx, Index* idx, Key min_keys, Key max_keys);
 
+  // Constructor for a range given by compact keys of the index
+  Iterator(Transaction* tx, Index* idx, const CompactAttribute* min_keys,
+           const CompactAttribute* max_keys);
+
   // Close the iterator
   void Close();
 
@@ -24,14 +35,62 @@ class Iterator {
   // Return whether the iterator has exceeded its range
   bool end() const { return end_; };
 
-  // Return the record to which the iterator refers
+  // Return the record to which the iterator refers (it stays valid until the iterator
+  // moves on or is closed)
   Record* value();
+
+  // Return the payload of the record to which the iterator refers (without decoding
+  // its key)
+  Block payload() const;
+
+  // Add the key and the payload of the current record to the given FNV-1a hash
+  uint64_t Fingerprint(uint64_t hash) const;
+
+  // Return the counters of all iterators that have been closed so far
+  static void stats(uint64_t *steps, uint64_t *seeks);
     
  private:
+  // Initialize the iterator (used by the constructors)
+  void Init(Transaction* tx, Index* idx, const CompactAttribute* min_keys,
+            const CompactAttribute* max_keys);
+
+  // Move the iterator to the next record (without recording it in range_)
+  bool Advance();
+
   // Mark the iterator as ended
   void SetEnded();
-  
-  Record* cvalue;
+
+  // Return the index of the first attribute of the current key that lies outside the
+  // range of this iterator (or -1) and whether it is above the maximum key
+  int Violation(bool *above);
+
+  // Build the key that skips all keys sharing the attributes before index with the current
+  // key (above) or that jumps to the minimum value of the attribute index (!above)
+  void SetSeekKey(int index, bool above);
+
+  // Return the secondary index that should answer the range of this iterator (or -1)
+  int ChooseSecondary();
+
+  // Move the iterator to the next record using the secondary index
+  bool NextSecondary();
+
+  // Move the iterator to the next record of an index using the Z-order layout
+  bool NextZOrder();
+
+  // Move the cursor like Dbc::get(key_, value_, flags) with DB_NEXT or DB_SET_RANGE,
+  // but take the records from the current batch as long as it holds them
+  int Fetch(uint32_t flags);
+
+  // Charges the iterator itself against the memory budget
+  MemoryReservation reservation_;
+
+  // The arena holding the memory of an iterator used outside of a transaction (one
+  // inside a transaction uses the arena of the transaction)
+  InlineArena<ITERATOR_ARENA_SIZE> arena_;
+
+  // The record returned by value() (it is reused for every record, its payload
+  // refers to the data of value_)
+  Record record_;
 
   // The current key to which the iterator refers
   Dbt *key_;
@@ -39,17 +98,64 @@ class Iterator {
   // The current value to which the iterator refers
   Dbt *value_;
 
-  // The maximum key that limits the range of this iterator
-  Key max_key_;
+  // The maximum key that limits the range of this iterator (binary)
+  Dbt *max_key_;
+
+  // The minimum key for this iterator (binary)
+  Dbt *min_key_;
 
-  // The minimum key for this iterator
-  Key min_key_;
+  // The attribute offsets of the current, the minimum and the maximum key
+  uint32_t *key_offsets_;
+  uint32_t *min_offsets_;
+  uint32_t *max_offsets_;
+
+  // The buffer holding the key used to reposition the cursor
+  char *seek_key_;
+
+  // The attribute values of the current key, the corners of the range and the key
+  // used to reposition the cursor (only used by indices with the Z-order layout)
+  uint64_t *key_values_;
+  uint64_t *min_values_;
+  uint64_t *max_values_;
+  uint64_t *seek_values_;
   
   // The index which is iterated over
   Index *index_;
 
-  // The used Berkeley DB cursor
+  // The transaction of the iterator (or NULL), which keeps its cursors and its batch
+  // buffer when it is closed
+  Transaction *tx_;
+
+  // The structure of the index
+  IndexStructure *structure_;
+
+  // The number of cursor steps and repositionings of this iterator
+  uint64_t steps_;
+  uint64_t seeks_;
+
+  // The used Berkeley DB cursor and the database it belongs to
   Dbc *cursor_;
+  Db *cursor_db_;
+
+  // The buffer receiving a batch of key/value pairs from the cursor (NULL if the
+  // secondary index is used or the cursor reads at read committed) and the position
+  // inside it (NULL if the batch is exhausted)
+  Dbt *batch_;
+  size_t batch_size_;
+  DbMultipleKeyDataIterator *batch_iterator_;
+
+  // The number of bytes the iterator has added to the footprint of the index (the
+  // iterator, its record, its range and its batch buffer)
+  int64_t footprint_;
+
+  // The secondary index used to find the keys of the range (or -1)
+  int secondary_;
+
+  // The cursor of the secondary index (and its database) and the entry it refers to
+  Dbc *secondary_cursor_;
+  Db *secondary_db_;
+  Dbt *secondary_key_;
+  Dbt *secondary_value_;
 
   // Whether the iterator has been closed
   bool closed_;
@@ -59,8 +165,12 @@ class Iterator {
 
   // Whether the iterator is initialized
   bool initialized_;
+
+  // The range in which the records read by an optimistic transaction are recorded
+  // (or NULL)
+  ReadRange *range_;
   
-  // Closes the Berkeley DB Cursor
+  // Closes the Berkeley DB Cursors
   void CloseCursor();
 
   DISALLOW_COPY_AND_ASSIGN(Iterator);
@@ -0,0 +1,476 @@
+#include "KDTree.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <cstdlib>
+#include <string.h>
+#include <new>
+
+// The targeted size of a leaf in byte (leaves hold at least kMinCapacity keys)
+static const size_t kLeafSize = 4096;
+static const int kMinCapacity = 8;
+
+// A node of the tree
+//
+// An inner node splits its region by the value of one attribute: keys whose attribute
+// is less than the one of split belong to low, all others to high. A leaf holds count
+// keys, each of them with its chain.
+struct KDTree::Node {
+  // The reader/writer latch protecting this node
+  pthread_rwlock_t latch;
+
+  // The attribute that splits the region of an inner node (-1 for leaves)
+  int attribute;
+
+  // A key holding the split value (inner nodes)
+  char* split;
+
+  // The children of an inner node
+  Node* low;
+  Node* high;
+
+  // The number of keys inside a leaf
+  int count;
+
+  // The keys and entry chains of a leaf
+  char* keys;
+  Entry** chains;
+};
+
+// The state of a search
+//
+// The queue holds the nodes whose regions intersect the box but have not been expanded
+// yet and the keys that have been found but not visited yet. A node is ordered by the
+// lower corner of its region inside the box, which no key of the node is less than, so
+// the smallest item is always the next key to visit or a node that has to be expanded
+// first. Each item refers to a slot in the pool that holds the corners of a node (lower
+// and upper) or the key.
+struct KDTree::Cursor : public SearchState {
+  struct Item {
+    // The node to expand, or the leaf that held the key when it was found
+    Node* node;
+
+    // The position of the key inside the leaf (-1 for nodes)
+    int position;
+
+    // The offset of the slot inside the pool
+    size_t slot;
+  };
+
+  Cursor(size_t key_size) : key_size(key_size), version(0), started(false){};
+
+  size_t size() const {
+    return sizeof(Cursor) + queue.capacity() * sizeof(Item) + pool.capacity()
+           + free_slots.capacity() * sizeof(size_t);
+  }
+
+  // Return a free slot (which may move the pool)
+  size_t Allocate(){
+    if(!free_slots.empty()){
+      size_t slot = free_slots.back();
+      free_slots.pop_back();
+      return slot;
+    }
+    size_t slot = pool.size();
+    pool.resize(slot + 2 * key_size);
+    return slot;
+  }
+
+  // The size of a key
+  size_t key_size;
+
+  // The version of the tree when the queue has been built
+  uint64_t version;
+
+  // Whether the queue belongs to a search that has been started
+  bool started;
+
+  // A heap holding the items that are left
+  std::vector<Item> queue;
+
+  // The slots of the items and the slots that are free
+  std::vector<char> pool;
+  std::vector<size_t> free_slots;
+};
+
+// Orders the items of a cursor by their keys (the smallest one first)
+class KDTree::ItemOrder {
+ public:
+  ItemOrder(const Cursor* cursor) : cursor_(cursor){};
+
+  bool operator()(const Cursor::Item& a, const Cursor::Item& b) const {
+    const char* pool = &cursor_->pool[0];
+    return memcmp(pool + a.slot, pool + b.slot, cursor_->key_size) > 0;
+  }
+
+ private:
+  const Cursor* cursor_;
+};
+
+// Orders the keys of a leaf by one attribute
+class AttributeOrder {
+ public:
+  AttributeOrder(const Tree* tree, const char* keys, int attribute)
+    : tree_(tree), keys_(keys), attribute_(attribute){};
+
+  bool operator()(int a, int b) const {
+    size_t key_size = tree_->key_size();
+    return tree_->CompareAttribute(keys_ + a * key_size, keys_ + b * key_size, attribute_) < 0;
+  }
+
+ private:
+  const Tree* tree_;
+  const char* keys_;
+  int attribute_;
+};
+
+KDTree::KDTree(uint8_t attribute_count, KeyType type) : Tree(attribute_count, type){
+  // Fit as many keys as possible into a leaf
+  capacity_ = kLeafSize / (key_size_ + sizeof(Entry*));
+  if(capacity_ < kMinCapacity)
+    capacity_ = kMinCapacity;
+
+  version_ = 0;
+  root_ = NewLeaf();
+}
+
+KDTree::~KDTree(){
+  // Close all open Handles of this structure
+  CloseHandles();
+  FreeNode(root_);
+}
+
+size_t KDTree::leaf_size() const{
+  return capacity_ * (key_size_ + sizeof(Entry*));
+}
+
+KDTree::Node* KDTree::NewLeaf(){
+  Node* node = new Node;
+  pthread_rwlock_init(&node->latch, NULL);
+  node->attribute = -1;
+  node->split = NULL;
+  node->low = NULL;
+  node->high = NULL;
+  node->count = 0;
+  node->keys = (char*) malloc(capacity_ * key_size_);
+  node->chains = (Entry**) malloc(capacity_ * sizeof(Entry*));
+  if((node->keys == NULL) || (node->chains == NULL)){
+    free(node->keys);
+    free(node->chains);
+    pthread_rwlock_destroy(&node->latch);
+    delete node;
+    throw std::bad_alloc();
+  }
+  CountNodeBytes(sizeof(Node) + leaf_size());
+  return node;
+}
+
+void KDTree::FreeNode(Node* node){
+  if(node->attribute < 0){
+    for(int i = 0; i < node->count; i++)
+      FreeChain(node->chains[i]);
+  } else {
+    FreeNode(node->low);
+    FreeNode(node->high);
+  }
+  CountNodeBytes(-(int64_t) (sizeof(Node) + ((node->attribute < 0) ? leaf_size() : key_size_)));
+  free(node->split);
+  free(node->keys);
+  free(node->chains);
+  pthread_rwlock_destroy(&node->latch);
+  delete node;
+}
+
+KDTree::Node* KDTree::FindLeaf(Node* node, const char* key, bool exclusive, int* depth) const{
+  while(true){
+    pthread_rwlock_rdlock(&node->latch);
+    if(node->attribute < 0){
+      if(!exclusive)
+        return node;
+
+      // The leaf may have been split while waiting for the exclusive latch
+      pthread_rwlock_unlock(&node->latch);
+      pthread_rwlock_wrlock(&node->latch);
+      if(node->attribute < 0)
+        return node;
+    }
+
+    // Inner nodes never change, so the child can be latched after the node is released
+    Node* child = (CompareAttribute(key, node->split, node->attribute) < 0) ? node->low : node->high;
+    pthread_rwlock_unlock(&node->latch);
+    node = child;
+    (*depth)++;
+  }
+}
+
+const Entry* KDTree::FindChain(Node* leaf, int position, const char* key, Node** latched) const{
+  // Usually the key is still where it has been found
+  int depth = 0;
+  leaf = FindLeaf(leaf, key, false, &depth);
+  *latched = leaf;
+  if((position >= leaf->count) || (memcmp(leaf->keys + position * key_size_, key, key_size_) != 0))
+    position = Find(leaf, key);
+  return (position >= 0) ? leaf->chains[position] : NULL;
+}
+
+int KDTree::Find(const Node* leaf, const char* key) const{
+  for(int i = 0; i < leaf->count; i++){
+    if(memcmp(leaf->keys + i * key_size_, key, key_size_) == 0)
+      return i;
+  }
+  return -1;
+}
+
+void KDTree::Split(Node* leaf, int depth){
+  // Use the attribute of this level, or the next one in which the keys differ
+  // (there is one, as all keys of a leaf are distinct)
+  int attribute = -1;
+  for(int j = 0; (j < attribute_count_) && (attribute < 0); j++){
+    int candidate = (depth + j) % attribute_count_;
+    for(int i = 1; i < leaf->count; i++){
+      if(CompareAttribute(leaf->keys + i * key_size_, leaf->keys, candidate) != 0){
+        attribute = candidate;
+        break;
+      }
+    }
+  }
+  assert(attribute >= 0);
+
+  // Split at the median, but make sure that the lower half is not empty
+  std::vector<int> order(leaf->count);
+  for(int i = 0; i < leaf->count; i++)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), AttributeOrder(this, leaf->keys, attribute));
+  const char* smallest = leaf->keys + order[0] * key_size_;
+  int median = leaf->count / 2;
+  while(CompareAttribute(leaf->keys + order[median] * key_size_, smallest, attribute) == 0)
+    median++;
+
+  char* split = (char*) malloc(key_size_);
+  if(split == NULL)
+    throw std::bad_alloc();
+  memcpy(split, leaf->keys + order[median] * key_size_, key_size_);
+
+  Node* low = NULL;
+  Node* high = NULL;
+  try {
+    low = NewLeaf();
+    high = NewLeaf();
+  } catch(std::bad_alloc &e){
+    free(split);
+    if(low != NULL)
+      FreeNode(low);
+    throw;
+  }
+
+  for(int i = 0; i < leaf->count; i++){
+    const char* key = leaf->keys + i * key_size_;
+    Node* child = (CompareAttribute(key, split, attribute) < 0) ? low : high;
+    memcpy(child->keys + child->count * key_size_, key, key_size_);
+    child->chains[child->count] = leaf->chains[i];
+    child->count++;
+  }
+
+  // Turn the leaf into an inner node in place (its parent keeps pointing to it)
+  free(leaf->keys);
+  free(leaf->chains);
+  CountNodeBytes((int64_t) key_size_ - (int64_t) leaf_size());
+  leaf->keys = NULL;
+  leaf->chains = NULL;
+  leaf->count = 0;
+  leaf->split = split;
+  leaf->low = low;
+  leaf->high = high;
+  leaf->attribute = attribute;
+}
+
+void KDTree::Insert(const char* key, Entry* entry){
+  int depth = 0;
+  Node* leaf = FindLeaf(root_, key, true, &depth);
+  try {
+    int pos = Find(leaf, key);
+    if(pos >= 0){
+      AppendEntry(&leaf->chains[pos], entry);
+    } else {
+      // A full leaf is split first (the tree stays unchanged if that fails), its new
+      // children cannot be reached by others before the split leaf is released
+      if(leaf->count == capacity_){
+        Split(leaf, depth);
+        Node* child = (CompareAttribute(key, leaf->split, leaf->attribute) < 0) ? leaf->low : leaf->high;
+        pthread_rwlock_wrlock(&child->latch);
+        pthread_rwlock_unlock(&leaf->latch);
+        leaf = child;
+      }
+      memcpy(leaf->keys + leaf->count * key_size_, key, key_size_);
+      leaf->chains[leaf->count] = entry;
+      leaf->count++;
+      __sync_fetch_and_add(&version_, 1);
+      CountKey(key, 1);
+    }
+  } catch(std::bad_alloc &e){
+    pthread_rwlock_unlock(&leaf->latch);
+    throw;
+  }
+  pthread_rwlock_unlock(&leaf->latch);
+}
+
+ErrorCode KDTree::Modify(const char* key, ChainModifier* modifier){
+  int depth = 0;
+  Node* leaf = FindLeaf(root_, key, true, &depth);
+  int pos = Find(leaf, key);
+  if(pos < 0){
+    pthread_rwlock_unlock(&leaf->latch);
+    return kErrorNotFound;
+  }
+
+  ErrorCode result;
+  try {
+    result = ModifyChain(&leaf->chains[pos], modifier);
+  } catch(std::bad_alloc &e){
+    pthread_rwlock_unlock(&leaf->latch);
+    throw;
+  }
+
+  // Drop the key if its last entry has been removed (the order inside a leaf does not matter)
+  if(leaf->chains[pos] == NULL){
+    CountKey(leaf->keys + pos * key_size_, -1);
+    leaf->count--;
+    memmove(leaf->keys + pos * key_size_, leaf->keys + leaf->count * key_size_, key_size_);
+    leaf->chains[pos] = leaf->chains[leaf->count];
+    __sync_fetch_and_add(&version_, 1);
+  }
+  pthread_rwlock_unlock(&leaf->latch);
+  return result;
+}
+
+void KDTree::PushChildren(Cursor* cursor, Node* node, size_t slot, const char* after) const{
+  int attribute = node->attribute;
+  size_t offset = offset_[attribute];
+  size_t width = offset_[attribute + 1] - offset_[attribute];
+  Node* children[2] = {node->low, node->high};
+
+  for(int i = 0; i < 2; i++){
+    // The region of the low child ends at the split, the one of the high child starts there
+    const char* lower = &cursor->pool[slot];
+    const char* upper = lower + key_size_;
+    if((i == 0) ? (CompareAttribute(lower, node->split, attribute) >= 0)
+                : (CompareAttribute(upper, node->split, attribute) < 0))
+      continue;
+
+    size_t child = cursor->Allocate();
+    char* child_lower = &cursor->pool[child];
+    char* child_upper = child_lower + key_size_;
+    lower = &cursor->pool[slot];
+    upper = lower + key_size_;
+    memcpy(child_lower, lower, 2 * key_size_);
+    if((i == 0) && (CompareAttribute(upper, node->split, attribute) > 0))
+      memcpy(child_upper + offset, node->split + offset, width);
+    if((i == 1) && (CompareAttribute(lower, node->split, attribute) < 0))
+      memcpy(child_lower + offset, node->split + offset, width);
+
+    // No key of the child is greater than its upper corner
+    if((after != NULL) && (memcmp(child_upper, after, key_size_) <= 0)){
+      cursor->free_slots.push_back(child);
+      continue;
+    }
+
+    Cursor::Item item;
+    item.node = children[i];
+    item.position = -1;
+    item.slot = child;
+    cursor->queue.push_back(item);
+    std::push_heap(cursor->queue.begin(), cursor->queue.end(), ItemOrder(cursor));
+  }
+}
+
+void KDTree::PushKeys(Cursor* cursor, Node* leaf, const char* min, const char* max,
+                      const char* after) const{
+  for(int i = 0; i < leaf->count; i++){
+    const char* key = leaf->keys + i * key_size_;
+    if((after != NULL) && (memcmp(key, after, key_size_) <= 0))
+      continue;
+    bool inside = true;
+    for(int j = 0; (j < attribute_count_) && inside; j++)
+      inside = (CompareAttribute(key, min, j) >= 0) && (CompareAttribute(key, max, j) <= 0);
+    if(!inside)
+      continue;
+
+    Cursor::Item item;
+    item.node = leaf;
+    item.position = i;
+    item.slot = cursor->Allocate();
+    memcpy(&cursor->pool[item.slot], key, key_size_);
+    cursor->queue.push_back(item);
+    std::push_heap(cursor->queue.begin(), cursor->queue.end(), ItemOrder(cursor));
+  }
+}
+
+bool KDTree::Search(const char* min, const char* max, const char* after, ChainVisitor* visitor,
+                    SearchState** state){
+  if(*state == NULL)
+    *state = new Cursor(key_size_);
+  Cursor* cursor = static_cast<Cursor*>(*state);
+  std::vector<Cursor::Item>& queue = cursor->queue;
+
+  // The positions inside the queue are only valid as long as no keys have been added or
+  // removed, otherwise the search starts over at the root (skipping the regions that
+  // end before after). Changes made while a call runs are noticed by the next one.
+  uint64_t version = __sync_fetch_and_add(&version_, 0);
+  if(!cursor->started || (after == NULL) || (cursor->version != version)){
+    queue.clear();
+    cursor->pool.clear();
+    cursor->free_slots.clear();
+    cursor->version = version;
+    cursor->started = true;
+
+    Cursor::Item root;
+    root.node = root_;
+    root.position = -1;
+    root.slot = cursor->Allocate();
+    memcpy(&cursor->pool[root.slot], min, key_size_);
+    memcpy(&cursor->pool[root.slot + key_size_], max, key_size_);
+    queue.push_back(root);
+  }
+
+  ItemOrder order(cursor);
+  while(!queue.empty()){
+    std::pop_heap(queue.begin(), queue.end(), order);
+    Cursor::Item item = queue.back();
+    queue.pop_back();
+
+    Node* latched;
+    if(item.position >= 0){
+      const char* key = &cursor->pool[item.slot];
+      const Entry* chain = FindChain(item.node, item.position, key, &latched);
+      bool more = true;
+      try {
+        // The slot is only reused by the next push, and a key that has been removed in
+        // the meantime is skipped
+        cursor->free_slots.push_back(item.slot);
+        if(chain != NULL)
+          more = visitor->Visit(key, chain);
+      } catch(std::bad_alloc &e){
+        pthread_rwlock_unlock(&latched->latch);
+        throw;
+      }
+      pthread_rwlock_unlock(&latched->latch);
+      if(!more)
+        return false;
+    } else {
+      latched = item.node;
+      pthread_rwlock_rdlock(&latched->latch);
+      try {
+        if(latched->attribute >= 0)
+          PushChildren(cursor, latched, item.slot, after);
+        else
+          PushKeys(cursor, latched, min, max, after);
+        cursor->free_slots.push_back(item.slot);
+      } catch(std::bad_alloc &e){
+        pthread_rwlock_unlock(&latched->latch);
+        throw;
+      }
+      pthread_rwlock_unlock(&latched->latch);
+    }
+  }
+  return true;
+}
@@ -0,0 +1,102 @@
+#ifndef _KDTREE_H_
+#define _KDTREE_H_
+
+#include <pthread.h>
+#include <vector>
+
+#include "Tree.h"
+
+/**
+ * An in-memory k-d tree over the binary keys of Tree.
+ *
+ * Instead of sorting the keys by their first attribute, the tree partitions the space of
+ * all attributes: every inner node splits its region at the median of one attribute
+ * (cycling through the attributes from level to level) and every leaf holds a bucket of
+ * up to capacity_ keys. A search for a box only descends into the regions that intersect
+ * it, so ranges that leave the first attributes open skip whole subtrees. To return the
+ * keys in ascending order, a search expands the regions in the order of the smallest key
+ * they may hold inside the box (see Cursor) and keeps its queue between two calls.
+ *
+ * The tree is meant for indices that only consist of kShort and kInt attributes. Every
+ * node has its own reader/writer latch. A leaf is split by turning it into an inner node
+ * in place, and inner nodes never change afterwards, so an operation only latches the
+ * node it currently looks at: modifications latch their leaf exclusively, searches latch
+ * the nodes they expand and the leaves of the keys they visit in shared mode. Leaves are
+ * never merged.
+ */
+class KDTree : public Tree {
+ public:
+  // Constructor
+  KDTree(uint8_t attribute_count, KeyType type);
+
+  // Destructor
+  ~KDTree();
+
+  // Appends an entry to the chain of the given key (creating the key if necessary)
+  void Insert(const char* key, Entry* entry);
+
+  // Runs the modifier on the chain of the given key (returns kErrorNotFound if the key is unknown)
+  ErrorCode Modify(const char* key, ChainModifier* modifier);
+
+  // Visits the keys inside the box [min, max] behind after in ascending order (a search
+  // is continued from its state unless keys have been added or removed in the meantime)
+  bool Search(const char* min, const char* max, const char* after, ChainVisitor* visitor,
+              SearchState** state);
+
+ private:
+  struct Node;
+
+  // The state of a search
+  struct Cursor;
+
+  // Orders the items of a cursor by their keys (the smallest one first)
+  class ItemOrder;
+
+  // Allocates a new leaf
+  Node* NewLeaf();
+
+  // Return the size of the keys and chains of a leaf in byte
+  size_t leaf_size() const;
+
+  // Frees a subtree
+  void FreeNode(Node* node);
+
+  // Descends from node to the leaf whose region contains key and returns it latched
+  // (exclusive or shared), depth is increased by the number of levels descended
+  Node* FindLeaf(Node* node, const char* key, bool exclusive, int* depth) const;
+
+  // Return the chain of the key an item of a cursor refers to (or NULL if the key has been
+  // removed) along with its leaf, which is latched in shared mode
+  const Entry* FindChain(Node* leaf, int position, const char* key, Node** latched) const;
+
+  // Return the position of key inside a leaf (or -1)
+  int Find(const Node* leaf, const char* key) const;
+
+  // Turns an overfull leaf into an inner node with two leaves
+  void Split(Node* leaf, int depth);
+
+  // Adds the children of an inner node that intersect the box (and may hold keys behind
+  // after) to the queue of a cursor, the region of the node inside the box is given by
+  // its corners in the slot
+  void PushChildren(Cursor* cursor, Node* node, size_t slot, const char* after) const;
+
+  // Adds the keys of a leaf that lie inside the box [min, max] and behind after to the
+  // queue of a cursor
+  void PushKeys(Cursor* cursor, Node* leaf, const char* min, const char* max,
+                const char* after) const;
+
+  // The maximum number of keys inside a leaf
+  int capacity_;
+
+  // The root of the tree
+  Node* root_;
+
+  // Counts the keys that have been added to or removed from the tree (which moves keys
+  // inside their leaves), so that searches notice that their queue is out of date
+  // (changed atomically)
+  uint64_t version_;
+
+  DISALLOW_COPY_AND_ASSIGN(KDTree);
+};
+
+#endif // _KDTREE_H_
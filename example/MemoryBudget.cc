@@ -0,0 +1,65 @@
+#include "MemoryBudget.h"
+
+#include <cstdlib>
+#include <new>
+
+MemoryBudget::MemoryBudget(){
+  limit_ = 0;
+  used_ = 0;
+  peak_ = 0;
+  failures_ = 0;
+
+  // Read the limit (e.g. "512M")
+  const char* value = getenv(MEMORY_LIMIT_VARIABLE);
+  if(value != NULL){
+    char* suffix;
+    uint64_t limit = strtoull(value, &suffix, 10);
+    if((*suffix == 'K') || (*suffix == 'k'))
+      limit <<= 10;
+    else if((*suffix == 'M') || (*suffix == 'm'))
+      limit <<= 20;
+    else if((*suffix == 'G') || (*suffix == 'g'))
+      limit <<= 30;
+    limit_ = limit;
+  }
+}
+
+MemoryBudget& MemoryBudget::getInstance(){
+  static MemoryBudget instance;
+  return instance;
+}
+
+void MemoryBudget::Charge(size_t bytes){
+  // The bytes are charged first and given back if they exceed the limit, so that no
+  // lock is needed (concurrent allocations close to the limit may fail together)
+  uint64_t limit = limit_;
+  uint64_t used = __sync_add_and_fetch(&used_, bytes);
+  if((limit != 0) && (used > limit)){
+    __sync_fetch_and_sub(&used_, bytes);
+    __sync_fetch_and_add(&failures_, 1);
+    throw std::bad_alloc();
+  }
+
+  // Raise the peak if this is the highest usage so far
+  uint64_t peak = peak_;
+  while((used > peak) && !__sync_bool_compare_and_swap(&peak_, peak, used))
+    peak = peak_;
+}
+
+void MemoryBudget::Force(size_t bytes){
+  uint64_t used = __sync_add_and_fetch(&used_, bytes);
+  uint64_t peak = peak_;
+  while((used > peak) && !__sync_bool_compare_and_swap(&peak_, peak, used))
+    peak = peak_;
+}
+
+void MemoryBudget::Release(size_t bytes){
+  __sync_fetch_and_sub(&used_, bytes);
+}
+
+void MemoryBudget::usage(MemoryUsage* usage){
+  usage->used = __sync_fetch_and_add(&used_, 0);
+  usage->peak = __sync_fetch_and_add(&peak_, 0);
+  usage->limit = limit_;
+  usage->failures = __sync_fetch_and_add(&failures_, 0);
+}
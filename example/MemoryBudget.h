@@ -0,0 +1,84 @@
+#ifndef _MEMORY_BUDGET_H_
+#define _MEMORY_BUDGET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <contest_extensions.h>
+#include <common/macros.h>
+
+// The environment variable that sets the memory limit of the library in byte (a
+// suffix K, M or G multiplies it by 2^10, 2^20 or 2^30; unset or 0 means no limit)
+#define MEMORY_LIMIT_VARIABLE "CONTEST_MEMORY_LIMIT"
+
+/**
+ * Accounts for the memory used by the library.
+ *
+ * Every allocation whose size depends on the data (the blocks of arenas, the
+ * batch buffers of iterators, the buffers of bulk inserts, index handles and
+ * structures) is charged against a global budget before it is made and given back
+ * when it is freed. If the budget would be exceeded, the allocation fails with
+ * std::bad_alloc, which the API functions report as kErrorOutOfMemory. The cache
+ * and the log buffer of Berkeley DB are charged once when the environment is opened.
+ *
+ * MemoryBudget implements the Singleton Pattern.
+ */
+class MemoryBudget{
+ public:
+  // Return the singleton instance of MemoryBudget
+  static MemoryBudget& getInstance();
+
+  // Charge the given number of bytes (throws std::bad_alloc if the budget would be
+  // exceeded)
+  void Charge(size_t bytes);
+
+  // Charge the given number of bytes even if the budget is exceeded by them
+  void Force(size_t bytes);
+
+  // Give back the given number of charged bytes
+  void Release(size_t bytes);
+
+  // Return or set the limit in byte (0 if there is none)
+  uint64_t limit() const { return limit_; };
+  void set_limit(uint64_t limit){ limit_ = limit; };
+
+  // Return the current usage, the peak usage, the limit and the number of refused
+  // allocations
+  void usage(MemoryUsage* usage);
+
+ private:
+  // Private constructor (reads the limit from MEMORY_LIMIT_VARIABLE)
+  MemoryBudget();
+
+  // The limit in byte (or 0)
+  volatile uint64_t limit_;
+
+  // The number of bytes currently charged and the highest number so far
+  uint64_t used_;
+  uint64_t peak_;
+
+  // The number of allocations that have been refused
+  uint64_t failures_;
+
+  DISALLOW_COPY_AND_ASSIGN(MemoryBudget);
+};
+
+// Charges a number of bytes for as long as it exists (throws std::bad_alloc like
+// MemoryBudget::Charge())
+class MemoryReservation{
+ public:
+  explicit MemoryReservation(size_t bytes) : bytes_(bytes){
+    MemoryBudget::getInstance().Charge(bytes);
+  };
+
+  ~MemoryReservation(){
+    MemoryBudget::getInstance().Release(bytes_);
+  };
+
+ private:
+  size_t bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(MemoryReservation);
+};
+
+#endif // _MEMORY_BUDGET_H_
@@ -0,0 +1,151 @@
+// Collects the contention profiles of all locks (see Mutex.h)
+
+#include "Mutex.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+// Protects the list of all profiles (a plain pthread mutex, so that it is
+// initialized before any static lock registers itself)
+static pthread_mutex_t profiles_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// The list of all profiles (new profiles are added at its head)
+static LockProfile* volatile profiles = NULL;
+
+LockProfile::LockProfile(const char* name){
+  char* copy = new char[strlen(name) + 1];
+  strcpy(copy, name);
+  name_ = copy;
+  acquisitions_ = 0;
+  contended_ = 0;
+  wait_ns_ = 0;
+  hold_ns_ = 0;
+  for(int i = 0; i < LOCK_HISTOGRAM_BUCKETS; i++){
+    wait_histogram_[i] = 0;
+    hold_histogram_[i] = 0;
+  }
+  next_ = NULL;
+}
+
+LockProfile* LockProfile::Get(const char* name){
+  LockProfile* profile;
+  pthread_mutex_lock(&profiles_mutex);
+  for(profile = profiles; profile != NULL; profile = profile->next_){
+    if(strcmp(profile->name_, name) == 0)
+      break;
+  }
+  if(profile == NULL){
+    profile = new LockProfile(name);
+    profile->next_ = profiles;
+    __sync_synchronize();
+    profiles = profile;
+  }
+  pthread_mutex_unlock(&profiles_mutex);
+  return profile;
+}
+
+void LockProfile::RecordAcquisition(bool contended, uint64_t wait_ns){
+  __sync_fetch_and_add(&acquisitions_, 1);
+  if(contended){
+    __sync_fetch_and_add(&contended_, 1);
+    __sync_fetch_and_add(&wait_ns_, wait_ns);
+    __sync_fetch_and_add(&wait_histogram_[Bucket(wait_ns)], 1);
+  }
+}
+
+void LockProfile::RecordRelease(uint64_t hold_ns){
+  __sync_fetch_and_add(&hold_ns_, hold_ns);
+  __sync_fetch_and_add(&hold_histogram_[Bucket(hold_ns)], 1);
+}
+
+void LockProfile::GetStats(LockStats* stats) const{
+  stats->acquisitions = acquisitions_;
+  stats->contended = contended_;
+  stats->wait_ns = wait_ns_;
+}
+
+int LockProfile::Bucket(uint64_t ns){
+  if(ns == 0)
+    return 0;
+  int bucket = 63 - __builtin_clzll(ns);
+  return (bucket < LOCK_HISTOGRAM_BUCKETS) ? bucket : LOCK_HISTOGRAM_BUCKETS - 1;
+}
+
+uint64_t LockProfile::Percentile(const volatile uint64_t* histogram, double fraction){
+  uint64_t total = 0;
+  for(int i = 0; i < LOCK_HISTOGRAM_BUCKETS; i++)
+    total += histogram[i];
+  if(total == 0)
+    return 0;
+
+  uint64_t sum = 0;
+  for(int i = 0; i < LOCK_HISTOGRAM_BUCKETS; i++){
+    sum += histogram[i];
+    if(sum >= fraction * total)
+      return 2ULL << i;
+  }
+  return 2ULL << (LOCK_HISTOGRAM_BUCKETS - 1);
+}
+
+// Orders profiles by their total wait time, the longest first
+static bool MoreWaiting(const LockProfile* a, const LockProfile* b){
+  LockStats sa, sb;
+  a->GetStats(&sa);
+  b->GetStats(&sb);
+  return sa.wait_ns > sb.wait_ns;
+}
+
+bool LockProfile::WriteReport(const char* path){
+  FILE* file = fopen(path, "w");
+  if(file == NULL)
+    return false;
+
+  // Profiles are never removed, so the list can be walked without the mutex
+  std::vector<LockProfile*> ranked;
+  for(LockProfile* profile = profiles; profile != NULL; profile = profile->next_)
+    ranked.push_back(profile);
+  std::stable_sort(ranked.begin(), ranked.end(), MoreWaiting);
+
+  fprintf(file, "Lock contention report (ranked by the total wait time)\n");
+  fprintf(file, "=====================================================\n\n");
+  if(ranked.empty()){
+    fprintf(file, "No locks have been profiled (compile with -DMUTEX_STATS).\n");
+    return fclose(file) == 0;
+  }
+
+  fprintf(file, "%-36s %14s %14s %9s %12s %12s %12s %12s\n", "lock", "acquisitions",
+          "contended", "percent", "wait [ms]", "wait p99", "hold avg", "hold p99");
+  for(size_t i = 0; i < ranked.size(); i++){
+    const LockProfile* p = ranked[i];
+    uint64_t acquisitions = p->acquisitions_;
+    uint64_t contended = p->contended_;
+    fprintf(file, "%-36s %14llu %14llu %8.2f%% %12.3f %9llu ns %9llu ns %9llu ns\n", p->name_,
+            (unsigned long long) acquisitions, (unsigned long long) contended,
+            (acquisitions > 0) ? 100.0 * contended / acquisitions : 0.0,
+            p->wait_ns_ / 1e6,
+            (unsigned long long) Percentile(p->wait_histogram_, 0.99),
+            (unsigned long long) ((acquisitions > 0) ? p->hold_ns_ / acquisitions : 0),
+            (unsigned long long) Percentile(p->hold_histogram_, 0.99));
+  }
+
+  // The histograms of all locks (only the buckets that are not empty)
+  for(size_t i = 0; i < ranked.size(); i++){
+    const LockProfile* p = ranked[i];
+    if(p->acquisitions_ == 0)
+      continue;
+    fprintf(file, "\n%s\n", p->name_);
+    fprintf(file, "  %14s %14s %14s\n", "< ns", "waits", "holds");
+    for(int b = 0; b < LOCK_HISTOGRAM_BUCKETS; b++){
+      if((p->wait_histogram_[b] == 0) && (p->hold_histogram_[b] == 0))
+        continue;
+      fprintf(file, "  %14llu %14llu %14llu\n", 2ULL << b,
+              (unsigned long long) p->wait_histogram_[b],
+              (unsigned long long) p->hold_histogram_[b]);
+    }
+  }
+
+  return fclose(file) == 0;
+}
@@ -1,47 +1,275 @@
 // Author: Lukas M. Maas
 // An abstraction layer for mutexes (to make locks easier to use and to make the implementation more independent of the actual threading library)
+//
+// Every lock is used through the same scoped syntax:
+//   lock(mutex_){ ... }          // exclusive
+//   lock(shared(rwlock_)){ ... } // shared (only for SharedMutex)
+//
+// Every lock has a name (e.g. "IndexStructure::mutex_"). If MUTEX_STATS is defined,
+// all locks with the same name share a LockProfile that counts their acquisitions,
+// the acquisitions that had to wait and keeps histograms of the wait and hold times
+// (see Lockable::GetStats() and LockProfile::WriteReport()).
 #ifndef _REFERENCE_MUTEX_H_
 #define _REFERENCE_MUTEX_H_
 
 #include <pthread.h>
+#include <stdint.h>
+#include <time.h>
 
 #define lock(x) if(Lock _lock_=x){}else
 
-class Mutex{
+// The size of a cache line in byte
+#define CACHE_LINE_SIZE 64
+
+// The number of times a SpinMutex tries to get the lock before it blocks
+#define SPIN_COUNT 100
+
+// The counters of a lock (only collected if MUTEX_STATS is defined)
+struct LockStats{
+	// The number of times the lock has been acquired
+	uint64_t acquisitions;
+
+	// The number of acquisitions that had to wait for another thread
+	uint64_t contended;
+
+	// The total time spent waiting for the lock in nanoseconds
+	uint64_t wait_ns;
+};
+
+// The number of buckets of the wait and hold time histograms (bucket i counts
+// the durations from 2^i to 2^(i+1)-1 ns, the last one all longer ones)
+#define LOCK_HISTOGRAM_BUCKETS 40
+
+// The statistics of all locks with the same name
+class LockProfile{
 	public:
-		Mutex(){
+		// Return the profile of the locks with the given name (profiles are never deleted)
+		static LockProfile* Get(const char* name);
+
+		// Write a report of all profiles to the given file, ranked by the total time
+		// spent waiting (returns false if the file could not be written)
+		static bool WriteReport(const char* path);
+
+		// Record an acquisition (and the time spent waiting for a contended one)
+		void RecordAcquisition(bool contended, uint64_t wait_ns);
+
+		// Record a release after the lock has been held for the given time
+		void RecordRelease(uint64_t hold_ns);
+
+		// Return the counters of this profile
+		void GetStats(LockStats* stats) const;
+
+	private:
+		// Constructor
+		LockProfile(const char* name);
+
+		// Return the bucket of the given duration
+		static int Bucket(uint64_t ns);
+
+		// Return the upper bound of the bucket in which the given fraction of all
+		// durations in the histogram is reached
+		static uint64_t Percentile(const volatile uint64_t* histogram, double fraction);
+
+		// The name of the locks
+		const char* name_;
+
+		volatile uint64_t acquisitions_;
+		volatile uint64_t contended_;
+		volatile uint64_t wait_ns_;
+		volatile uint64_t hold_ns_;
+		volatile uint64_t wait_histogram_[LOCK_HISTOGRAM_BUCKETS];
+		volatile uint64_t hold_histogram_[LOCK_HISTOGRAM_BUCKETS];
+
+		// The next profile in the list of all profiles
+		LockProfile* next_;
+};
+
+// Base class of all locks that can be used with the lock() macro
+class Lockable{
+	public:
+		Lockable(const char* name){
+#ifdef MUTEX_STATS
+			profile_ = LockProfile::Get(name);
+#endif
+		};
+
+		virtual ~Lockable(){};
+
+		// Return the counters of all locks with the name of this one (all zero without
+		// MUTEX_STATS)
+		void GetStats(LockStats* stats) const{
+#ifdef MUTEX_STATS
+			profile_->GetStats(stats);
+#else
+			stats->acquisitions = 0;
+			stats->contended = 0;
+			stats->wait_ns = 0;
+#endif
+		};
+
+		friend class Lock;
+
+	protected:
+		// Acquire the lock without blocking (returns false if it is held by another thread)
+		virtual bool TryAcquire(bool shared) = 0;
+
+		// Acquire the lock and block if necessary
+		virtual void Acquire(bool shared) = 0;
+
+		// Release the lock
+		virtual void Release(bool shared) = 0;
+
+	private:
+#ifdef MUTEX_STATS
+		LockProfile* profile_;
+#endif
+};
+
+// A mutex that blocks right away
+class Mutex : public Lockable{
+	public:
+		Mutex(const char* name = "Mutex"):Lockable(name){
 			pthread_mutex_init(&mutex_, 0);
 		};
-		
+
 		~Mutex(){
 			pthread_mutex_destroy(&mutex_);
 		};
-		
-		friend class Lock;
-		
-	private:
+
+	protected:
 		pthread_mutex_t mutex_;
-		
-		void Lock(){
+
+		bool TryAcquire(bool shared){
+			return pthread_mutex_trylock(&mutex_) == 0;
+		};
+
+		void Acquire(bool shared){
 			pthread_mutex_lock(&mutex_);
 		};
-		
-		void Unlock(){
+
+		void Release(bool shared){
 			pthread_mutex_unlock(&mutex_);
 		};
 };
 
+// A mutex that spins for a while before it blocks (for short critical sections)
+class SpinMutex : public Mutex{
+	public:
+		SpinMutex(const char* name = "SpinMutex"):Mutex(name){};
+
+	protected:
+		void Acquire(bool shared){
+			for(int i = 0; i < SPIN_COUNT; i++){
+				if(pthread_mutex_trylock(&mutex_) == 0)
+					return;
+#if defined(__i386__) || defined(__x86_64__)
+				__asm__ __volatile__("pause");
+#endif
+			}
+			pthread_mutex_lock(&mutex_);
+		};
+};
+
+// A lock that can be held by many readers or by a single writer
+class SharedMutex : public Lockable{
+	public:
+		SharedMutex(const char* name = "SharedMutex"):Lockable(name){
+			pthread_rwlock_init(&rwlock_, 0);
+		};
+
+		~SharedMutex(){
+			pthread_rwlock_destroy(&rwlock_);
+		};
+
+	protected:
+		bool TryAcquire(bool shared){
+			if(shared)
+				return pthread_rwlock_tryrdlock(&rwlock_) == 0;
+			return pthread_rwlock_trywrlock(&rwlock_) == 0;
+		};
+
+		void Acquire(bool shared){
+			if(shared)
+				pthread_rwlock_rdlock(&rwlock_);
+			else
+				pthread_rwlock_wrlock(&rwlock_);
+		};
+
+		void Release(bool shared){
+			pthread_rwlock_unlock(&rwlock_);
+		};
+
+	private:
+		pthread_rwlock_t rwlock_;
+};
+
+// A lock that has a cache line of its own, so that threads taking it do not
+// slow down accesses to the data next to it
+template <typename T>
+class __attribute__ ((aligned (CACHE_LINE_SIZE))) Padded : public T{
+	public:
+		Padded(const char* name):T(name){};
+};
+
+// A request to acquire a SharedMutex in shared mode (see shared())
+struct SharedAccess{
+	SharedMutex* mutex;
+};
+
+// Return a request to acquire the given lock in shared mode
+inline SharedAccess shared(SharedMutex& mutex){
+	SharedAccess access = {&mutex};
+	return access;
+}
+
 class Lock{
 	public:
-		Lock(Mutex& mutex):mutex_(mutex){mutex_.Lock();};
-		~Lock(){mutex_.Unlock();};
-		
+		Lock(Lockable& mutex):mutex_(mutex),shared_(false){Acquire();};
+		Lock(const SharedAccess& access):mutex_(*access.mutex),shared_(true){Acquire();};
+		~Lock(){
+#ifdef MUTEX_STATS
+			mutex_.profile_->RecordRelease(Now() - acquired_);
+#endif
+			mutex_.Release(shared_);
+		};
+
 		operator bool() const {
 			return false;
 		}
-		
+
 	private:
-		Mutex& mutex_;
+		Lockable& mutex_;
+
+		// Whether the lock is held in shared mode
+		bool shared_;
+
+#ifdef MUTEX_STATS
+		// The time the lock has been acquired at
+		uint64_t acquired_;
+
+		// Return the current time in nanoseconds
+		static uint64_t Now(){
+			timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			return now.tv_sec * 1000000000ULL + now.tv_nsec;
+		};
+#endif
+
+		void Acquire(){
+#ifdef MUTEX_STATS
+			if(mutex_.TryAcquire(shared_)){
+				acquired_ = Now();
+				mutex_.profile_->RecordAcquisition(false, 0);
+			} else {
+				uint64_t start = Now();
+				mutex_.Acquire(shared_);
+				acquired_ = Now();
+				mutex_.profile_->RecordAcquisition(true, acquired_ - start);
+			}
+#else
+			mutex_.Acquire(shared_);
+#endif
+		};
 };
 
 #endif // _REFERENCE_MUTEX_H_
@@ -0,0 +1,442 @@
+#include "Transaction.h"
+#include "ConnectionManager.h"
+#include "Index.h"
+#include "Iterator.h"
+#include "MemoryBudget.h"
+#include "Util.h"
+
+#include <db_cxx.h>
+#include <cstdlib>
+#include <new>
+#include <string.h>
+#include <unistd.h>
+
+// The number of times an autocommit operation is retried after a deadlock
+static const int kDeadlockRetries = 8;
+
+// The longest wait before the first retry in microseconds (it doubles with
+// every further retry)
+static const useconds_t kBackoffMicros = 20;
+
+// The counters of all optimistic transactions
+static uint64_t total_commits = 0;
+static uint64_t total_conflicts = 0;
+
+// The counters of the autocommit operations chosen as deadlock victims
+static uint64_t total_retries = 0;
+static uint64_t total_retry_failures = 0;
+
+// The state of the random numbers used by Backoff()
+static uint32_t backoff_state = 0;
+
+// The initial value of a fingerprint
+static const uint64_t kFingerprintBasis = 14695981039346656037ULL;
+
+Transaction::Transaction(DbTxn* txn, IsolationLevel isolation){
+  MemoryBudget::getInstance().Charge(sizeof(Transaction));
+  txn_ = txn;
+  write_txn_ = NULL;
+  isolation_ = isolation;
+  conflict_ = false;
+}
+
+Transaction::~Transaction(){
+  ClosePool();
+  for(size_t i = 0; i < buffers_.size(); i++){
+    delete [] buffers_[i].buffer;
+    MemoryBudget::getInstance().Release(buffers_[i].size);
+  }
+  MemoryBudget::getInstance().Release(sizeof(Transaction));
+}
+
+// Return the Berkeley DB transaction of the given handle
+DbTxn* Transaction::txn(Transaction* tx){
+  if(tx == NULL)
+    return NULL;
+  return (tx->write_txn_ != NULL) ? tx->write_txn_ : tx->txn_;
+}
+
+// Return the flags for opening a cursor in the context of the given handle
+uint32_t Transaction::cursor_flags(Transaction* tx){
+  IsolationLevel isolation = (tx != NULL) ? tx->isolation_ :
+      ConnectionManager::getInstance().isolation();
+  if(isolation == kIsolationReadCommitted)
+    return DB_READ_COMMITTED;
+
+  // Cursors of snapshot transactions read their snapshot, cursors used outside of
+  // transactions read a snapshot of their own that ends when they are closed (the
+  // locking transaction of an optimistic transaction keeps its read locks)
+  return (tx != NULL) ? 0 : DB_TXN_SNAPSHOT;
+}
+
+// Register a modification of the given index structure (returns false if the
+// index is read-only)
+bool Transaction::Register(IndexStructure* structure){
+  // A transaction usually only modifies a few indices
+  for(size_t i = 0; i < structures_.size(); i++){
+    if(structures_[i] == structure)
+      return true;
+  }
+  if(!structure->start_transaction())
+    return false;
+
+  FootprintDelta delta = {0, 0, 0, 0};
+  footprints_.push_back(delta);
+  structures_.push_back(structure);
+  return true;
+}
+
+void Transaction::Account(IndexStructure* structure, const FootprintDelta& delta){
+  for(size_t i = 0; i < structures_.size(); i++){
+    if(structures_[i] == structure){
+      footprints_[i].records += delta.records;
+      footprints_[i].key_bytes += delta.key_bytes;
+      footprints_[i].key_padding += delta.key_padding;
+      footprints_[i].payload_bytes += delta.payload_bytes;
+      return;
+    }
+  }
+}
+
+void Transaction::ApplyFootprints(){
+  for(size_t i = 0; i < structures_.size(); i++){
+    structures_[i]->Account(footprints_[i]);
+    FootprintDelta delta = {0, 0, 0, 0};
+    footprints_[i] = delta;
+  }
+}
+
+// Commit the Berkeley DB transaction and release all modified indices
+bool Transaction::Commit(){
+  if(isolation_ == kIsolationOptimistic){
+    bool valid;
+    try{
+      valid = Flush();
+    } catch(DbDeadlockException &e){
+      valid = false;
+    } catch(DbException &e){
+      Abort();
+      throw;
+    } catch(std::bad_alloc &e){
+      Abort();
+      throw;
+    }
+    if(!valid){
+      __sync_fetch_and_add(&total_conflicts, 1);
+      Abort();
+      return false;
+    }
+
+    // The snapshot has only been read, so it can be ended after the writes
+    try{
+      ClosePool();
+      write_txn_->commit(0);
+    } catch(DbException &e){
+      write_txn_ = NULL;
+      txn_->abort();
+      Release();
+      throw;
+    }
+    write_txn_ = NULL;
+    ApplyFootprints();
+    __sync_fetch_and_add(&total_commits, 1);
+  }
+
+  // The Berkeley DB handle is gone even if the commit fails
+  try{
+    ClosePool();
+    txn_->commit(0);
+  } catch(DbException &e){
+    Release();
+    throw;
+  }
+  ApplyFootprints();
+  Release();
+  return true;
+}
+
+// Abort the Berkeley DB transaction and release all modified indices
+void Transaction::Abort(){
+  try{
+    ClosePool();
+    if(write_txn_ != NULL){
+      DbTxn* write_txn = write_txn_;
+      write_txn_ = NULL;
+      write_txn->abort();
+    }
+    txn_->abort();
+  } catch(DbException &e){
+    Release();
+    throw;
+  }
+  Release();
+}
+
+// Make the buffered writes visible before the given index is used again
+bool Transaction::Prepare(Index* index){
+  if(conflict_)
+    return false;
+
+  for(size_t i = 0; i < writes_.size(); i++){
+    if(writes_[i].index->structure() == index->structure())
+      return Flush();
+  }
+  return true;
+}
+
+// Apply all buffered writes (returns false if a conflict has been detected or a write
+// has failed)
+bool Transaction::Flush(){
+  if(conflict_)
+    return false;
+  if(write_txn_ != NULL)
+    return true;
+
+  // Lock and read the ranges again (the locks are kept until the commit, so they
+  // cannot change anymore)
+  ConnectionManager::getInstance().env()->txn_begin(NULL, &write_txn_, 0);
+  if(!Validate()){
+    conflict_ = true;
+    return false;
+  }
+
+  // The writes are taken out of the buffer, so that they are not buffered again
+  std::vector<Write> writes;
+  writes.swap(writes_);
+  MemoryBudget::getInstance().Release(writes.size() * sizeof(Write));
+  for(size_t i = 0; i < writes.size(); i++){
+    Write& write = writes[i];
+    ErrorCode res;
+    if(write.type == Write::kInsert)
+      res = write.index->Insert(this, write.key, write.current);
+    else if(write.type == Write::kUpdate)
+      res = write.index->Modify(this, write.key, write.current, &write.payload, write.flags);
+    else
+      res = write.index->Modify(this, write.key, write.current, NULL, write.flags);
+
+    // A write that fails leaves the transaction incomplete, so it has to be aborted
+    if(res != kOk){
+      conflict_ = true;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Check that no range that has been read was changed
+bool Transaction::Validate(){
+  bool valid = true;
+  for(size_t i = 0; valid && (i < ranges_.size()); i++){
+    ReadRange* range = ranges_[i];
+    Iterator iterator(this, range->index, range->min, range->max);
+
+    // Read the same number of records and compare them
+    uint64_t fingerprint = kFingerprintBasis;
+    uint32_t count = 0;
+    while(count < range->count){
+      if(!iterator.Next() || iterator.end())
+        break;
+      fingerprint = iterator.Fingerprint(fingerprint);
+      count++;
+    }
+    valid = (count == range->count) && (fingerprint == range->fingerprint);
+
+    // If the end has been reported, no record may have been added behind them
+    if(valid && range->ended)
+      valid = iterator.Next() && iterator.end();
+    if(!iterator.closed())
+      iterator.Close();
+  }
+  return valid;
+}
+
+// Buffer an insert
+ErrorCode Transaction::BufferInsert(Index* index, const CompactAttribute* key, const Block& payload){
+  if(!Register(index->structure()))
+    return kErrorUnknownIndex;
+
+  Write write;
+  write.index = index;
+  write.key = CopyKey(key, index->structure()->attribute_count(), &arena_);
+  write.current = CopyBlock(payload, &arena_);
+  write.payload.data = NULL;
+  write.payload.size = 0;
+  write.flags = 0;
+  write.type = Write::kInsert;
+  AddWrite(write);
+  return kOk;
+}
+
+// Buffer an update (delete if payload is NULL) of the records with the given key
+// and the current payload
+ErrorCode Transaction::BufferModify(Index* index, const CompactAttribute* key, const Block& current,
+                                    Block* payload, uint8_t flags){
+  if(!Register(index->structure()))
+    return kErrorUnknownIndex;
+
+  // Look for a matching record in the snapshot (the read is validated as well, only
+  // the payloads are compared, so the keys are not decoded)
+  bool found = false;
+  Iterator iterator(this, index, key, key);
+  while(!found && iterator.Next() && !iterator.end()){
+    Block found_payload = iterator.payload();
+    found = (flags & kIgnorePayload) ||
+        ((found_payload.size == current.size) &&
+         (memcmp(found_payload.data, current.data, current.size) == 0));
+  }
+  if(!iterator.closed())
+    iterator.Close();
+  if(!found)
+    return kErrorNotFound;
+
+  Write write;
+  write.index = index;
+  write.key = CopyKey(key, index->structure()->attribute_count(), &arena_);
+  write.current = CopyBlock(current, &arena_);
+  write.payload.data = NULL;
+  write.payload.size = 0;
+  if(payload != NULL)
+    write.payload = CopyBlock(*payload, &arena_);
+  write.flags = flags;
+  write.type = (payload != NULL) ? Write::kUpdate : Write::kDelete;
+  AddWrite(write);
+  return kOk;
+}
+
+// Return the range in which an iterator records its reads
+ReadRange* Transaction::AddRange(Index* index, const CompactAttribute* min, const CompactAttribute* max){
+  if(!buffering())
+    return NULL;
+
+  ReadRange* range = arena_.New<ReadRange>();
+  range->index = index;
+  range->min = CopyKey(min, index->structure()->attribute_count(), &arena_);
+  range->max = CopyKey(max, index->structure()->attribute_count(), &arena_);
+  range->count = 0;
+  range->fingerprint = kFingerprintBasis;
+  range->ended = false;
+  MemoryBudget::getInstance().Charge(sizeof(ReadRange*));
+  try{
+    ranges_.push_back(range);
+  } catch(std::bad_alloc &e){
+    MemoryBudget::getInstance().Release(sizeof(ReadRange*));
+    throw;
+  }
+  return range;
+}
+
+// Append a buffered write (the entries of ranges_ and writes_ are charged against the
+// memory budget until the transaction is released)
+void Transaction::AddWrite(const Write& write){
+  MemoryBudget::getInstance().Charge(sizeof(Write));
+  try{
+    writes_.push_back(write);
+  } catch(std::bad_alloc &e){
+    MemoryBudget::getInstance().Release(sizeof(Write));
+    throw;
+  }
+}
+
+// Wait before an autocommit operation is tried again after a deadlock
+bool Transaction::Backoff(int attempt){
+  if(attempt >= kDeadlockRetries){
+    __sync_fetch_and_add(&total_retry_failures, 1);
+    return false;
+  }
+  __sync_fetch_and_add(&total_retries, 1);
+
+  // Threads that deadlocked with each other wait for different times, so that
+  // they do not run into the same deadlock again
+  uint32_t random = __sync_add_and_fetch(&backoff_state, 2654435761U);
+  random ^= random >> 16;
+  random *= 0x45d9f3b;
+  random ^= random >> 16;
+  usleep(random % ((kBackoffMicros << attempt) + 1));
+  return true;
+}
+
+// Return the counters of all optimistic transactions and autocommit retries
+void Transaction::stats(TransactionStats* stats){
+  stats->optimistic_commits = __sync_fetch_and_add(&total_commits, 0);
+  stats->optimistic_conflicts = __sync_fetch_and_add(&total_conflicts, 0);
+  stats->deadlock_retries = __sync_fetch_and_add(&total_retries, 0);
+  stats->deadlock_failures = __sync_fetch_and_add(&total_retry_failures, 0);
+}
+
+// Return a cursor of the given database left behind by a closed iterator
+Dbc* Transaction::TakeCursor(Db* db){
+  DbTxn* current = txn(this);
+  for(size_t i = cursors_.size(); i > 0; i--){
+    if((cursors_[i-1].db == db) && (cursors_[i-1].txn == current)){
+      Dbc* cursor = cursors_[i-1].cursor;
+      cursors_.erase(cursors_.begin() + (i-1));
+      return cursor;
+    }
+  }
+  return NULL;
+}
+
+// Keep the cursor of a closed iterator for the next iterator on the same database
+void Transaction::ReturnCursor(Db* db, Dbc* cursor){
+  if(cursor_flags(this) == DB_READ_COMMITTED){
+    cursor->close();
+    return;
+  }
+
+  PooledCursor pooled;
+  pooled.db = db;
+  pooled.txn = txn(this);
+  pooled.cursor = cursor;
+  try{
+    cursors_.push_back(pooled);
+  } catch(std::bad_alloc &e){
+    cursor->close();
+  }
+}
+
+// Return a batch buffer of the given size left behind by a closed iterator
+char* Transaction::TakeBuffer(size_t size){
+  for(size_t i = buffers_.size(); i > 0; i--){
+    if(buffers_[i-1].size == size){
+      char* buffer = buffers_[i-1].buffer;
+      buffers_.erase(buffers_.begin() + (i-1));
+      return buffer;
+    }
+  }
+  return NULL;
+}
+
+// Keep the batch buffer of a closed iterator
+void Transaction::ReturnBuffer(char* buffer, size_t size){
+  PooledBuffer pooled;
+  pooled.buffer = buffer;
+  pooled.size = size;
+  try{
+    buffers_.push_back(pooled);
+  } catch(std::bad_alloc &e){
+    delete [] buffer;
+    MemoryBudget::getInstance().Release(size);
+  }
+}
+
+// Close the pooled cursors
+void Transaction::ClosePool(){
+  std::vector<PooledCursor> cursors;
+  cursors.swap(cursors_);
+  for(size_t i = 0; i < cursors.size(); i++)
+    cursors[i].cursor->close();
+}
+
+// Release all modified index structures and the memory of the transaction
+void Transaction::Release(){
+  for(size_t i = 0; i < structures_.size(); i++)
+    structures_[i]->end_transaction();
+  structures_.clear();
+  footprints_.clear();
+  MemoryBudget::getInstance().Release(ranges_.size() * sizeof(ReadRange*)
+                                      + writes_.size() * sizeof(Write));
+  ranges_.clear();
+  writes_.clear();
+  arena_.Release();
+  txn_ = NULL;
+}
@@ -0,0 +1,209 @@
+#ifndef _TRANSACTION_H_
+#define _TRANSACTION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <contest_interface.h>
+#include <contest_extensions.h>
+#include <common/macros.h>
+
+#include "Arena.h"
+
+class Db;
+class Dbc;
+class DbTxn;
+class Index;
+class IndexStructure;
+struct CompactAttribute;
+
+// A range of an index that has been read by an optimistic transaction
+struct ReadRange{
+  // The index handle and (compact copies of) the keys limiting the range
+  Index* index;
+  CompactAttribute* min;
+  CompactAttribute* max;
+
+  // The number of records that have been returned and a hash over them
+  uint32_t count;
+  uint64_t fingerprint;
+
+  // Whether the end of the range has been reported
+  bool ended;
+};
+
+// The change of the footprint of an index structure caused by writes (see
+// IndexFootprint)
+struct FootprintDelta{
+  int64_t records;
+  int64_t key_bytes;
+  int64_t key_padding;
+  int64_t payload_bytes;
+};
+
+// Class representing a transaction handle
+//
+// Every transaction remembers the index structures it has modified, so
+// that committing or aborting it only has to release those, and how it has
+// changed their footprints, which is only added to them when it commits. It also keeps the
+// cursors and buffers of closed iterators, so that the next iterator on the same
+// index only has to reposition a cursor. The keys, records and iterator state it
+// creates are allocated from its arena, which is freed at once when it ends.
+//
+// Optimistic transactions (kIsolationOptimistic) read a snapshot without taking
+// locks and remember every range they have read, while their writes are buffered.
+// Update and delete find out whether a record matches by reading the snapshot as
+// well. The buffered writes are applied by Flush(), which starts a second, locking
+// Berkeley DB transaction, validates the ranges by reading them again inside of it
+// and then applies the writes. This happens at the commit, or earlier, if an index
+// with buffered writes is read, updated or deleted from, so that the transaction
+// sees its own writes (from then on all its operations use the locking transaction).
+class Transaction{
+ public:
+  // Constructor
+  Transaction(DbTxn* txn, IsolationLevel isolation);
+
+  // Destructor
+  ~Transaction();
+
+  // Return the Berkeley DB transaction of the given handle (NULL for autocommit)
+  static DbTxn* txn(Transaction* tx);
+
+  // Return the flags for opening a cursor in the context of the given handle
+  // (NULL for autocommit)
+  static uint32_t cursor_flags(Transaction* tx);
+
+  // Register a modification of the given index structure (returns false if the
+  // index is read-only)
+  bool Register(IndexStructure* structure);
+
+  // Commit or abort the Berkeley DB transaction and release all modified indices
+  // (Commit() returns false if an optimistic transaction had to be aborted, because
+  // a range it has read has been changed)
+  bool Commit();
+  void Abort();
+
+  // Add a change of the footprint of a registered index structure (it becomes
+  // visible when the transaction commits)
+  void Account(IndexStructure* structure, const FootprintDelta& delta);
+
+  // Return the arena holding the memory of this transaction (it is released when
+  // the transaction ends)
+  Arena* arena(){ return &arena_; };
+
+  // Return whether the writes of this transaction are buffered
+  bool buffering() const { return (isolation_ == kIsolationOptimistic) && (write_txn_ == NULL); };
+
+  // Make the buffered writes visible before the given index is read again (returns
+  // false if a conflict has been detected)
+  bool Prepare(Index* index);
+
+  // Apply all buffered writes (returns false if a conflict has been detected or a
+  // write has failed)
+  bool Flush();
+
+  // Buffer an insert, or an update (delete if payload is NULL) of the records with
+  // the given key and the current payload
+  ErrorCode BufferInsert(Index* index, const CompactAttribute* key, const Block& payload);
+  ErrorCode BufferModify(Index* index, const CompactAttribute* key, const Block& current,
+                         Block* payload, uint8_t flags);
+
+  // Return the range in which an iterator records its reads (NULL if the reads of
+  // this transaction need no validation)
+  ReadRange* AddRange(Index* index, const CompactAttribute* min, const CompactAttribute* max);
+
+  // Wait before an autocommit operation that has been chosen as a deadlock victim
+  // is tried again for the given time (counting from 0), using a randomized
+  // exponential backoff (returns false if it should not be tried again)
+  static bool Backoff(int attempt);
+
+  // Return the counters of all optimistic transactions and autocommit retries
+  static void stats(TransactionStats* stats);
+
+  // Return a cursor of the given database that a closed iterator of this transaction
+  // has left behind (or NULL)
+  Dbc* TakeCursor(Db* db);
+
+  // Keep the cursor of a closed iterator for the next iterator on the same database
+  // (cursors of read committed transactions are closed instead, as they release their
+  // read locks only when they are closed)
+  void ReturnCursor(Db* db, Dbc* cursor);
+
+  // Return a batch buffer of the given size left behind by a closed iterator (or NULL)
+  // and keep the buffer of a closed iterator
+  char* TakeBuffer(size_t size);
+  void ReturnBuffer(char* buffer, size_t size);
+
+ private:
+  // A buffered write
+  struct Write{
+    Index* index;
+    CompactAttribute* key;
+    Block current;
+    Block payload;
+    uint8_t flags;
+
+    // Whether the write is an insert, an update or a delete
+    enum { kInsert, kUpdate, kDelete } type;
+  };
+
+  // Check that no range that has been read was changed
+  bool Validate();
+
+  // Append a buffered write
+  void AddWrite(const Write& write);
+
+  // Add the changes of the footprints to the modified index structures
+  void ApplyFootprints();
+
+  // Release all modified index structures and the memory of the transaction
+  void Release();
+
+  // A cursor or a batch buffer kept for the next iterator
+  struct PooledCursor{
+    Db* db;
+    DbTxn* txn;
+    Dbc* cursor;
+  };
+  struct PooledBuffer{
+    char* buffer;
+    size_t size;
+  };
+
+  // Close the pooled cursors (they have to be closed before the transaction ends)
+  void ClosePool();
+
+  // The Berkeley DB transaction
+  DbTxn* txn_;
+
+  // The locking Berkeley DB transaction of an optimistic transaction (NULL until
+  // the writes are applied)
+  DbTxn* write_txn_;
+
+  // The isolation level of the transaction
+  IsolationLevel isolation_;
+
+  // Whether an optimistic transaction has detected a conflict
+  bool conflict_;
+
+  // The index structures modified by this transaction and how their footprints
+  // have changed
+  std::vector<IndexStructure*> structures_;
+  std::vector<FootprintDelta> footprints_;
+
+  // The ranges read and the writes buffered by an optimistic transaction
+  std::vector<ReadRange*> ranges_;
+  std::vector<Write> writes_;
+
+  // The cursors and batch buffers of closed iterators
+  std::vector<PooledCursor> cursors_;
+  std::vector<PooledBuffer> buffers_;
+
+  // The memory of the ranges, the buffered writes and the iterators
+  Arena arena_;
+
+  DISALLOW_COPY_AND_ASSIGN(Transaction);
+};
+
+#endif // _TRANSACTION_H_
@@ -0,0 +1,279 @@
+#include "Tree.h"
+#include "BTreeIndex.h"
+
+#include <stdint.h>
+#include <cstdlib>
+#include <string.h>
+#include <new>
+
+Entry* NewEntry(const Block& payload){
+  Entry* entry = new Entry;
+  entry->payload.data = NULL;
+  entry->payload.size = 0;
+  entry->pending.data = NULL;
+  entry->pending.size = 0;
+  entry->owner = NULL;
+  entry->flags = 0;
+  entry->next = NULL;
+  AssignBlock(entry->payload, payload);
+  return entry;
+}
+
+void FreeEntry(Entry* entry){
+  free(entry->payload.data);
+  free(entry->pending.data);
+  delete entry;
+}
+
+void AssignBlock(Block& dst, const Block& src){
+  void* data = NULL;
+  if(src.size > 0){
+    data = malloc(src.size);
+    if(data == NULL)
+      throw std::bad_alloc();
+    memcpy(data, src.data, src.size);
+  }
+  free(dst.data);
+  dst.data = data;
+  dst.size = src.size;
+}
+
+// Write an unsigned integer of the given width in big-endian byte order
+static inline void EncodeUnsigned(char* buf, uint64_t value, int width){
+  for(int i = width - 1; i >= 0; i--){
+    buf[i] = (char) (value & 0xFF);
+    value >>= 8;
+  }
+}
+
+// Read an unsigned integer of the given width in big-endian byte order
+static inline uint64_t DecodeUnsigned(const char* buf, int width){
+  uint64_t value = 0;
+  for(int i = 0; i < width; i++)
+    value = (value << 8) | (uint8_t) buf[i];
+  return value;
+}
+
+Tree::Tree(uint8_t attribute_count, KeyType type)
+    : mutex_("Tree::mutex_"), transaction_mutex_("Tree::transaction_mutex_"){
+  attribute_count_ = attribute_count;
+  type_ = new AttributeType[attribute_count];
+  offset_ = new size_t[attribute_count + 1];
+  key_size_ = 0;
+  read_only_ = false;
+  records_ = 0;
+  keys_ = 0;
+  key_padding_ = 0;
+  payload_bytes_ = 0;
+  node_bytes_ = 0;
+  iterator_bytes_ = 0;
+
+  // Build the key layout and copy the type array
+  for(int i = 0; i < attribute_count; i++){
+    offset_[i] = key_size_;
+    if(type[i] == kShort)
+      key_size_ += 4;
+    else if(type[i] == kInt)
+      key_size_ += 8;
+    else
+      key_size_ += MAX_VARCHAR_LENGTH+1;
+
+    type_[i] = type[i];
+  }
+  offset_[attribute_count] = key_size_;
+}
+
+Tree::~Tree(){
+  // Close all open Handles of this structure
+  CloseHandles();
+  delete[] offset_;
+  delete[] type_;
+}
+
+void Tree::FreeChain(Entry* chain){
+  while(chain != NULL){
+    Entry* next = chain->next;
+    FreeEntry(chain);
+    chain = next;
+  }
+}
+
+void Tree::EncodeKey(const Key& key, char* buf, bool max) const{
+  for(int i = 0; i < attribute_count_; i++){
+    char* slot = buf + offset_[i];
+    size_t width = offset_[i+1] - offset_[i];
+
+    // If the key value is NULL we have to set a wildcard
+    // depending on if it is a maximum or minimum key
+    if(key.value[i] == NULL){
+      memset(slot, (max ? 0xFF : 0x00), width);
+      continue;
+    }
+
+    // Integers are stored big-endian with a flipped sign bit,
+    // strings are padded with '\0' (both keep the order under memcmp)
+    if(type_[i] == kShort){
+      EncodeUnsigned(slot, (uint32_t) key.value[i]->short_value ^ 0x80000000U, 4);
+    } else if(type_[i] == kInt){
+      EncodeUnsigned(slot, (uint64_t) key.value[i]->int_value ^ 0x8000000000000000ULL, 8);
+    } else {
+      size_t length = strnlen(key.value[i]->char_value, MAX_VARCHAR_LENGTH);
+      memcpy(slot, key.value[i]->char_value, length);
+      memset(slot + length, '\0', width - length);
+    }
+  }
+}
+
+void Tree::DecodeKey(const char* buf, Attribute** value) const{
+  for(int i = 0; i < attribute_count_; i++){
+    const char* slot = buf + offset_[i];
+    value[i]->type = type_[i];
+    if(type_[i] == kShort)
+      value[i]->short_value = (int32_t) ((uint32_t) DecodeUnsigned(slot, 4) ^ 0x80000000U);
+    else if(type_[i] == kInt)
+      value[i]->int_value = (int64_t) (DecodeUnsigned(slot, 8) ^ 0x8000000000000000ULL);
+    else
+      memcpy(value[i]->char_value, slot, MAX_VARCHAR_LENGTH+1);
+  }
+}
+
+int Tree::CompareAttribute(const char* a, const char* b, int i) const{
+  return memcmp(a + offset_[i], b + offset_[i], offset_[i+1] - offset_[i]);
+}
+
+void Tree::InsertBatch(const char* const* keys, Entry* const* entries, size_t count,
+                       size_t* inserted){
+  for(*inserted = 0; *inserted < count; (*inserted)++)
+    Insert(keys[*inserted], entries[*inserted]);
+}
+
+void Tree::register_handle(Index* handle){
+  lock(mutex_){
+    handles_.insert(handle);
+  }
+}
+
+void Tree::unregister_handle(Index* handle){
+  lock(mutex_){
+    handles_.erase(handle);
+  }
+}
+
+void Tree::CloseHandles(){
+  // Closing a handle unregisters it, so work on a copy of the set
+  std::set<Index*> handles;
+  lock(mutex_){
+    handles = handles_;
+  }
+  std::set<Index*>::iterator it;
+  for(it = handles.begin(); it != handles.end(); it++){
+    if(*it != NULL)
+      (*it)->Close();
+  }
+}
+
+// Start a new modifying transaction on this index (returns false if index is read-only)
+bool Tree::start_transaction(Transaction* tx){
+  lock(transaction_mutex_){
+    if(read_only_)
+      return false;
+
+    transactions_.insert(tx);
+  }
+  return true;
+}
+
+// End a modifying transaction on this index
+void Tree::end_transaction(Transaction* tx){
+  lock(transaction_mutex_){
+    transactions_.erase(tx);
+  }
+}
+
+// Try to make this index read-only (will return false if open transactions have written to this index)
+bool Tree::MakeReadOnly(){
+  lock(transaction_mutex_){
+    if(transactions_.size() > 0){
+      return false;
+    }
+    read_only_ = true;
+  }
+  return true;
+}
+
+// Read a counter that is changed atomically (the changes of concurrent operations
+// may arrive in any order, a counter that is negative for a moment is reported as 0)
+static inline uint64_t ReadCounter(const int64_t* counter){
+  int64_t value = __sync_fetch_and_add(const_cast<int64_t*>(counter), 0);
+  return (value > 0) ? (uint64_t) value : 0;
+}
+
+void Tree::footprint(IndexFootprint* footprint) const{
+  footprint->records = ReadCounter(&records_);
+  footprint->keys = ReadCounter(&keys_);
+  footprint->key_bytes = footprint->keys * key_size_;
+  footprint->key_padding = ReadCounter(&key_padding_);
+  footprint->payload_bytes = ReadCounter(&payload_bytes_);
+  footprint->duplicates = (footprint->records > footprint->keys) ? footprint->records - footprint->keys : 0;
+  footprint->chain_bytes = footprint->records * sizeof(Entry);
+  footprint->tree_bytes = ReadCounter(&node_bytes_);
+  footprint->tree_overhead = (footprint->tree_bytes > footprint->key_bytes) ? footprint->tree_bytes - footprint->key_bytes : 0;
+  footprint->iterator_bytes = ReadCounter(&iterator_bytes_);
+}
+
+void Tree::CountEntry(const Entry* entry, int sign){
+  __sync_fetch_and_add(&records_, sign);
+  __sync_fetch_and_add(&payload_bytes_, sign * (int64_t) (entry->payload.size + entry->pending.size));
+}
+
+void Tree::CountIteratorBytes(int64_t bytes){
+  __sync_fetch_and_add(&iterator_bytes_, bytes);
+}
+
+void Tree::CountKey(const char* key, int sign){
+  // Only varchar slots are padded (with '\0' behind the string)
+  int64_t padding = 0;
+  for(int i = 0; i < attribute_count_; i++){
+    if(type_[i] == kVarchar)
+      padding += (int64_t) (MAX_VARCHAR_LENGTH+1 - strnlen(key + offset_[i], MAX_VARCHAR_LENGTH));
+  }
+  __sync_fetch_and_add(&keys_, sign);
+  __sync_fetch_and_add(&key_padding_, sign * padding);
+}
+
+void Tree::CountNodeBytes(int64_t bytes){
+  __sync_fetch_and_add(&node_bytes_, bytes);
+}
+
+// Add up the entries of a chain and their payloads
+static void MeasureChain(const Entry* chain, int64_t* entries, int64_t* bytes){
+  *entries = 0;
+  *bytes = 0;
+  for(; chain != NULL; chain = chain->next){
+    (*entries)++;
+    *bytes += chain->payload.size + chain->pending.size;
+  }
+}
+
+void Tree::CountChain(const Entry* chain, int64_t entries, int64_t bytes){
+  int64_t new_entries, new_bytes;
+  MeasureChain(chain, &new_entries, &new_bytes);
+  __sync_fetch_and_add(&records_, new_entries - entries);
+  __sync_fetch_and_add(&payload_bytes_, new_bytes - bytes);
+}
+
+ErrorCode Tree::ModifyChain(Entry** chain, ChainModifier* modifier){
+  int64_t entries, bytes;
+  MeasureChain(*chain, &entries, &bytes);
+
+  // A modifier that runs out of memory may already have changed some entries
+  ErrorCode result;
+  try {
+    result = modifier->Modify(chain);
+  } catch(std::bad_alloc &e){
+    CountChain(*chain, entries, bytes);
+    throw;
+  }
+  CountChain(*chain, entries, bytes);
+  return result;
+}
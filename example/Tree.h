@@ -0,0 +1,248 @@
+#ifndef _TREE_H_
+#define _TREE_H_
+
+#include <pthread.h>
+#include <set>
+
+#include <contest_interface.h>
+#include <contest_extensions.h>
+#include <common/macros.h>
+
+#include "Mutex.h"
+
+class Index;
+
+// Flags describing the uncommitted state of an entry
+enum EntryFlags {
+  // The entry has been inserted by its owner
+  kEntryInserted = 1,
+  // The entry has been given a new (pending) payload by its owner
+  kEntryUpdated = 2,
+  // The entry has been deleted by its owner
+  kEntryDeleted = 4
+};
+
+// A single record stored under a key of the tree.
+//
+// All records with the same key form a chain (duplicates are kept in insertion order).
+// An entry that has been modified by a running transaction is owned by that transaction
+// until it commits or aborts; all other transactions still see its committed state.
+struct Entry {
+  // The committed payload (or the payload of an uncommitted insert)
+  Block payload;
+
+  // The uncommitted payload of an update
+  Block pending;
+
+  // The transaction that currently modifies this entry (or NULL)
+  Transaction* owner;
+
+  // A combination of EntryFlags
+  uint8_t flags;
+
+  // The next entry with the same key
+  Entry* next;
+};
+
+// Return whether the given entry is visible to the given transaction (or NULL)
+inline bool Visible(const Entry* entry, const Transaction* tx){
+  if(entry->owner == NULL)
+    return true;
+  if(entry->owner == tx)
+    return !(entry->flags & kEntryDeleted);
+  return !(entry->flags & kEntryInserted);
+}
+
+// Return the payload of the given entry as seen by the given transaction (or NULL)
+inline const Block& VisiblePayload(const Entry* entry, const Transaction* tx){
+  if((entry->owner == tx) && (entry->flags & kEntryUpdated))
+    return entry->pending;
+  return entry->payload;
+}
+
+// Appends an entry to the end of a chain
+inline void AppendEntry(Entry** chain, Entry* entry){
+  while(*chain != NULL)
+    chain = &((*chain)->next);
+  *chain = entry;
+}
+
+// Allocates a new entry holding a copy of the given payload
+Entry* NewEntry(const Block& payload);
+
+// Frees an entry and its payloads
+void FreeEntry(Entry* entry);
+
+// Replaces the content of dst with a copy of src
+void AssignBlock(Block& dst, const Block& src);
+
+// Interface used to modify the chain of entries stored under a key
+class ChainModifier {
+ public:
+  virtual ~ChainModifier(){};
+
+  // Modifies the given chain (the head may be set to NULL to drop the key)
+  virtual ErrorCode Modify(Entry** chain) = 0;
+};
+
+// Interface used to read the chains of a key range
+class ChainVisitor {
+ public:
+  virtual ~ChainVisitor(){};
+
+  // Visits the chain stored under the given key (return false to stop the scan)
+  virtual bool Visit(const char* key, const Entry* chain) = 0;
+};
+
+// The position of a search between two calls of Tree::Search()
+//
+// Structures that cannot continue a search faster than by starting behind the last
+// visited key leave it NULL.
+class SearchState {
+ public:
+  virtual ~SearchState(){};
+
+  // Return the memory held by the state in byte
+  virtual size_t size() const = 0;
+};
+
+/**
+ * The base class of the in-memory index structures.
+ *
+ * It defines the binary key layout shared by all structures: every attribute gets a
+ * fixed slot (4 byte for kShort, 8 byte for kInt, MAX_VARCHAR_LENGTH+1 byte for kVarchar)
+ * encoded in a way that memcmp() orders the keys attribute by attribute (integers by
+ * value, strings like strcmp()). It also keeps track
+ * of the open handles and of the transactions that write to the index.
+ */
+class Tree {
+ public:
+  // Constructor
+  Tree(uint8_t attribute_count, KeyType type);
+
+  // Destructor
+  virtual ~Tree();
+
+  // Converts the given key into its binary representation (NULL attributes are set to
+  // the minimum or maximum value of their slot)
+  void EncodeKey(const Key& key, char* buf, bool max = false) const;
+
+  // Converts the given binary key into the given (preallocated) attributes
+  void DecodeKey(const char* buf, Attribute** value) const;
+
+  // Compares the attribute with index i of two binary keys
+  int CompareAttribute(const char* a, const char* b, int i) const;
+
+  // Appends an entry to the chain of the given key (creating the key if necessary)
+  virtual void Insert(const char* key, Entry* entry) = 0;
+
+  // Appends the entries to the chains of the given keys, which have to be sorted in
+  // ascending order (inserted counts the entries that are part of the tree, also if
+  // std::bad_alloc is thrown)
+  virtual void InsertBatch(const char* const* keys, Entry* const* entries, size_t count,
+                           size_t* inserted);
+
+  // Runs the modifier on the chain of the given key (returns kErrorNotFound if the key is unknown)
+  virtual ErrorCode Modify(const char* key, ChainModifier* modifier) = 0;
+
+  // Visits the keys behind after (or all keys if after is NULL) in ascending order that
+  // may have all of their attributes inside [min, max]. Keys outside of that box may be
+  // visited as well, the visitor has to check them. Returns true if all keys have been visited.
+  //
+  // A search that has been stopped is continued by passing the last visited key as after
+  // together with the state of the previous call (*state is NULL for a new search and
+  // has to be deleted by the caller once the search is over).
+  virtual bool Search(const char* min, const char* max, const char* after, ChainVisitor* visitor,
+                      SearchState** state) = 0;
+
+  // Register a new index handle
+  void register_handle(Index* handle);
+
+  // Unregister an index handle
+  void unregister_handle(Index* handle);
+
+  // Close all registered handles
+  void CloseHandles();
+
+  // Start a new modifying transaction on this index (returns false if index is read-only)
+  bool start_transaction(Transaction* tx);
+
+  // End a modifying transaction on this index
+  void end_transaction(Transaction* tx);
+
+  // Try to make this index read-only (will return false if open transactions have written to this index)
+  bool MakeReadOnly();
+
+  // Return the memory footprint of the tree (only reads the counters below)
+  void footprint(IndexFootprint* footprint) const;
+
+  // Account for an entry that is about to be added to a chain (sign 1) or has been
+  // removed from it (sign -1)
+  void CountEntry(const Entry* entry, int sign);
+
+  // Account for memory held by an iterator over the tree
+  void CountIteratorBytes(int64_t bytes);
+
+  uint8_t attribute_count() const { return attribute_count_; };
+  AttributeType type(int i) const { return type_[i]; };
+  size_t key_size() const { return key_size_; };
+
+ protected:
+  // Frees all entries of a chain
+  static void FreeChain(Entry* chain);
+
+  // Account for a key that has been added to a leaf (sign 1) or dropped from it (sign -1)
+  void CountKey(const char* key, int sign);
+
+  // Account for the memory of a node that has been allocated or freed
+  void CountNodeBytes(int64_t bytes);
+
+  // Runs the modifier on a chain and accounts for the entries and payloads it has
+  // changed (by measuring the chain before and after, chains are short)
+  ErrorCode ModifyChain(Entry** chain, ChainModifier* modifier);
+
+  // The number of attributes that form a key of this index
+  uint8_t attribute_count_;
+
+  // An array of attribute types
+  AttributeType* type_;
+
+  // The offset of every attribute inside a binary key
+  size_t* offset_;
+
+  // The size of a binary key in byte
+  size_t key_size_;
+
+ private:
+  // Whether the index is readonly
+  bool read_only_;
+
+  // A set of all open handles of this index
+  std::set<Index*> handles_;
+
+  // A set of open transactions that have modified this index
+  std::set<Transaction*> transactions_;
+
+  // A mutex for protecting the insert and read operations on the handle set
+  Mutex mutex_;
+
+  // A mutex for protecting the insert and read operations on the transaction set
+  Mutex transaction_mutex_;
+
+  // Account for the difference between a chain and the number of entries and payload
+  // bytes it had before
+  void CountChain(const Entry* chain, int64_t entries, int64_t bytes);
+
+  // The counters of the footprint (changed atomically, so that they can be read
+  // without latching the tree)
+  int64_t records_;
+  int64_t keys_;
+  int64_t key_padding_;
+  int64_t payload_bytes_;
+  int64_t node_bytes_;
+  int64_t iterator_bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(Tree);
+};
+
+#endif // _TREE_H_
@@ -1,105 +1,24 @@
 #include "Util.h"
+#include "Arena.h"
 #include "Index.h"
 
 #include <assert.h>
 #include <string.h>
 #include <cstdlib>
 
-IndexStructure* test = NULL;
-/**
-Compares two attributes
- */
-int attcmp(const Attribute &a, const Attribute &b){
-  switch(a.type){
-    case kShort:
-      if(a.short_value < b.short_value )
-        return -1;
-      else if (a.short_value > b.short_value )
-        return 1;
-      break;
-    case kInt:
-      if(a.int_value < b.int_value )
-        return -1;
-      else if (a.int_value > b.int_value )
-        return 1;
-      break;
-    case kVarchar:
-      return strcmp(a.char_value, b.char_value);
-    }
-  return 0;
-}
-
 //
 // Compares two Berkeley DB keys (used for the b-tree)
 //
+// The structure of the index is attached to the db handle (see IndexStructure::Create), so
+// no catalog lookup is needed and the binary keys are compared in place.
+//
 int keycmp(Db *db, const Dbt *a,  const Dbt *b){
-  const char* fileName;
-  const char* name;
-  IndexStructure *is;// = test;
-  // Get database name
-  //if(test == NULL){
-    assert(db->get_dbname((const char **)&fileName,(const char**)&name) == 0);
-  
-  
-  // Try to get the structure of the index
-  /*IndexStructure *is*//*test*/is = IndexManager::getInstance().Find(name);
-  //is = test;
-  //}
-
+  const IndexStructure *is = (const IndexStructure*) db->get_app_private();
   assert(is != NULL);
-  
-  // Compare the keys
-  Key ak = is->GetKey(a);
-  Key bk = is->GetKey(b);
-
-  int rt = keycmp(ak, bk);
-  int i;
-
-  for (i = 0; i < ak.attribute_count; i++){
-	  delete ak.value[i];
-  }
-  delete[] ak.value;
-
-  for (i = 0; i < bk.attribute_count; i++){
-	  delete bk.value[i];
-	}
-	delete[] bk.value;
 
-  return rt;
+  return is->Compare(a, b);
 }
 
-int keycmp(const Key &a, const Key &b){
-  assert(a.attribute_count == b.attribute_count);
-
-  // Compare the keys
-  for(int i = 0; i < a.attribute_count; i++){
-    assert(a.value[i] != NULL);
-    assert(b.value[i] != NULL);
-    int res = attcmp(*(a.value[i]),*(b.value[i]));
-    if (res != 0)
-      return res;
-  }
-  return 0;
-}
-
-// Checks whether every attribute of key a is smaller than or equal to key b
-bool CheckBounds(const Key &a, const Key &b, int *index){
-  assert(a.attribute_count == b.attribute_count);
-
-  for(int i = 0; i < a.attribute_count; i++ ){
-    if((a.value[i] != NULL) && (b.value[i] != NULL) && (attcmp(*(a.value[i]), *(b.value[i])) > 0)){
-      if(index)
-        *index = i;
-      return false;
-    }
-    // Check whether 
-    //if((a.value[i] != NULL) && (b.value[i] != NULL) && (attcmp(*(a.value[i]), *(b.value[i])) > 0)){
-    //  return false;
-    //}
-  }
-  return true;
-};
-
 void release (const Dbt *dbt){
     if ((dbt != NULL) && (dbt->get_data() != NULL))
     {
@@ -109,50 +28,58 @@ void release (const Dbt *dbt){
     }
 }
 
-void CopyKey(Key &a, const Key &b){
-  a.value = new Attribute*[b.attribute_count];
-  a.attribute_count = b.attribute_count;
-  for(int i = 0; i < a.attribute_count; i++){
-    if(b.value[i] != NULL){
-      a.value[i] = new Attribute();
-      memcpy(a.value[i],b.value[i],sizeof(Attribute));      
+void Compact(CompactAttribute *dst, const Attribute *src, AttributeType type, Arena *arena){
+  dst->type = type;
+  dst->null = (src == NULL);
+  dst->length = 0;
+  if(src == NULL)
+    return;
+
+  if(type == kShort){
+    dst->short_value = src->short_value;
+  } else if(type == kInt){
+    dst->int_value = src->int_value;
+  } else {
+    size_t length = strnlen(src->char_value, MAX_VARCHAR_LENGTH);
+    dst->length = (uint16_t) length;
+    if(length <= COMPACT_INLINE_LENGTH){
+      memcpy(dst->inline_value, src->char_value, length);
+    } else if(arena == NULL){
+      dst->spilled_value = src->char_value;
     } else {
-      a.value[i] = NULL;
+      char* chars = arena->NewArray<char>(length);
+      memcpy(chars, src->char_value, length);
+      dst->spilled_value = chars;
     }
   }
 }
 
-void CopyRecord(Record *dst, Record *src)
-{
-	dst->payload.size = src->payload.size;
-	dst->payload.data = malloc(src->payload.size);
-	memcpy(dst->payload.data, src->payload.data, src->payload.size);
-	CopyKey(dst->key, src->key);
+CompactAttribute* CompactKey(const Key &key, const AttributeType *types, Arena *arena, bool copy){
+  CompactAttribute* attributes = arena->NewArray<CompactAttribute>(key.attribute_count);
+  for(int i = 0; i < key.attribute_count; i++)
+    Compact(&attributes[i], key.value[i], types[i], copy ? arena : NULL);
+  return attributes;
 }
 
-// Deletes a key
-void DeleteKey(Key* key){
-	//if (key.value == 0)
-		//return;
-  for (int i = 0; i < key->attribute_count; i++){
-    if(key->value[i] != NULL){
-		  delete key->value[i];
-    }
-	}
-
-	delete[] key->value;
-};
+CompactAttribute* CopyKey(const CompactAttribute *key, int count, Arena *arena){
+  CompactAttribute* attributes = arena->NewArray<CompactAttribute>(count);
+  memcpy(attributes, key, count * sizeof(CompactAttribute));
 
-// Deletes a record
-void DeleteRecord(Record **record){
-  if(*record == NULL)
-    return;
-
-  DeleteKey(&((*record)->key));
-
-  free((*record)->payload.data);
-  delete (*record);
-
-  (*record) = NULL;
+  // Only long varchars live outside of the attributes
+  for(int i = 0; i < count; i++){
+    if(!key[i].null && (key[i].length > COMPACT_INLINE_LENGTH)){
+      char* chars = arena->NewArray<char>(key[i].length);
+      memcpy(chars, key[i].spilled_value, key[i].length);
+      attributes[i].spilled_value = chars;
+    }
+  }
+  return attributes;
 }
 
+Block CopyBlock(const Block &block, Arena *arena){
+  Block copy;
+  copy.data = arena->Allocate(block.size);
+  copy.size = block.size;
+  memcpy(copy.data, block.data, block.size);
+  return copy;
+}
@@ -5,29 +5,57 @@
 #include <contest_interface.h>
 #include <db_cxx.h>
 
-// Compares two attributes
-int attcmp(const Attribute &a, const Attribute &b);
-
-// Compares two keys
-int keycmp(const Key &a, const Key &b);
+class Arena;
+
+// The number of characters of a varchar that a CompactAttribute holds itself
+#define COMPACT_INLINE_LENGTH 24
+
+// The representation of an attribute inside the engine
+//
+// The public Attribute reserves MAX_VARCHAR_LENGTH+1 characters whatever its type
+// is. A CompactAttribute takes 32 byte: integers are stored as they are, varchars
+// with their length, inside the attribute if they are short and in an arena (or in
+// the attribute they have been converted from) otherwise. Public attributes are only
+// built when a record is returned to the user.
+struct CompactAttribute{
+  // The AttributeType of the attribute and whether it is a wildcard (NULL)
+  uint8_t type;
+  bool null;
+
+  // The length of a varchar
+  uint16_t length;
+
+  union{
+    int32_t short_value;
+    int64_t int_value;
+    char inline_value[COMPACT_INLINE_LENGTH];
+    const char* spilled_value;
+  };
+
+  // Return the characters of a varchar (not terminated)
+  const char* chars() const {
+    return (length <= COMPACT_INLINE_LENGTH) ? inline_value : spilled_value;
+  };
+};
 
 // Compares two Berkeley DB keys (used for the b-tree)
 int keycmp(Db *db, const Dbt *a, const Dbt *b);
 
-// Returns 0 if every attribute of key a is smaller than or equal to key b
-// or a value > 0 if the attribute with index i in a is greater than in b
-bool CheckBounds(const Key &a, const Key &b, int *index = NULL);
+// Converts the given attribute (NULL for a wildcard) of an index with the given attribute
+// type into a compact one (long varchars are copied into the arena, or refer to the
+// attribute if arena is NULL)
+void Compact(CompactAttribute *dst, const Attribute *src, AttributeType type, Arena *arena);
 
-// Copys key b to key a
-void CopyKey(Key &a, const Key &b);
+// Converts the given key of an index with the given attribute types into compact
+// attributes allocated from the arena (with copy == false long varchars refer to the
+// key, which then has to outlive them)
+CompactAttribute* CompactKey(const Key &key, const AttributeType *types, Arena *arena, bool copy = true);
 
-void CopyRecord(Record *dst, Record *src);
+// Copys count compact attributes (the copy is allocated from the arena)
+CompactAttribute* CopyKey(const CompactAttribute *key, int count, Arena *arena);
 
-// Deletes a key
-void DeleteKey(Key *key);
-  
-// Deletes a record
-void DeleteRecord(Record **record);
+// Copys the given block (the copy is allocated from the arena)
+Block CopyBlock(const Block &block, Arena *arena);
 
 // Frees all memory that is used by dbt
 void release(const Dbt *dbt);
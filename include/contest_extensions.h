@@ -0,0 +1,429 @@
+/*
+Copyright (c) 2011 TU Dresden - Database Technology Group
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/** @file
+Defines extensions to the API of include/contest_interface.h.
+
+These functions are not part of the contest interface. They are provided by
+both implementations in example/ to tune and measure them, so programs that
+use them cannot be linked against other implementations.
+*/
+
+#ifndef _CONTEST_EXTENSIONS_H_
+#define _CONTEST_EXTENSIONS_H_
+
+#include <contest_interface.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+Counts how iterators moved through their indices.
+*/
+typedef struct IteratorStats {
+  /// The number of times an iterator moved on to the directly following record
+  uint64_t steps;
+
+  /// The number of times an iterator repositioned itself by searching for a key
+  uint64_t seeks;
+} IteratorStats;
+
+/**
+Returns the movements of all iterators that have been closed so far.
+
+@param[out] stats
+  returns the summed up counters
+
+@return ErrorCode
+  - \ref kOk
+         if the counters were successfully retrieved
+  - \ref kErrorGenericFailure
+         if stats is NULL
+*/
+ErrorCode GetIteratorStats(IteratorStats *stats);
+
+/**
+The order in which an index stores its keys.
+*/
+typedef enum KeyLayout {
+  /// Keys are ordered by their first attribute, then by their second one and so on
+  kLayoutLexicographic = 0,
+
+  /// Keys are ordered along a Z-order curve: the bits of all attributes are interleaved,
+  /// so keys that are close in every attribute are stored close to each other. Ranges
+  /// that leave the first attributes open then read far fewer keys. Only indices
+  /// that consist of kShort and kInt attributes can use this layout.
+  ///
+  /// Note that GetNext() returns the records of such an index in the order of the
+  /// curve, not in ascending order by their key. Only the Berkeley DB implementation
+  /// supports this layout.
+  kLayoutZOrder = 1,
+
+  /// Keys are stored in a k-d tree that partitions the space of all attributes, so
+  /// ranges that leave the first attributes open only visit the regions intersecting
+  /// them. Records are still returned in ascending order by their key. Only indices
+  /// that consist of kShort and kInt attributes can use this layout, it pays off for
+  /// indices with three or more attributes. The Berkeley DB implementation stores
+  /// such indices lexicographically.
+  kLayoutKdTree = 2
+} KeyLayout;
+
+/**
+Options that can be passed to CreateIndexWithOptions().
+
+A zero-initialized structure selects the behaviour of CreateIndex().
+*/
+typedef struct IndexOptions {
+  /// The number of attributes listed in secondary
+  uint8_t secondary_count;
+
+  /// The positions of the attributes (inside the key) that get a secondary index
+  ///
+  /// A secondary index maps the value of one attribute to the keys of all records
+  /// with that value. It is used by GetRecords() for ranges that restrict this
+  /// attribute to a single value but leave the first attribute open, which would
+  /// otherwise require a scan over the whole index.
+  const uint8_t *secondary;
+
+  /// The order in which the keys are stored (an index with secondary indices
+  /// has to use \ref kLayoutLexicographic)
+  KeyLayout layout;
+} IndexOptions;
+
+/**
+Creates an empty index like CreateIndex() using the given options.
+
+Options only change how the index answers operations, not their results, so an
+implementation may ignore options it cannot make use of. The only exception is
+\ref kLayoutZOrder, which changes the order in which GetNext() returns the records;
+an implementation that does not support it rejects it.
+
+@param[in] name
+  the name of the new index
+
+@param[in] column_count
+  the number of attributes of every key of the index
+
+@param[in] types
+  the types of these attributes
+
+@param[in] options
+  the options of the index (or NULL for the default options)
+
+@return ErrorCode
+  - \ref kOk
+         if the index was successfully created
+  - \ref kErrorIndexExists
+         if an index with the given name already exists
+  - \ref kErrorGenericFailure
+         if the options are invalid (a secondary attribute is out of range, the first
+         attribute or listed twice, or the layout is unknown, not supported or does
+         not fit the attributes) or the index could not be created for some other reason
+*/
+ErrorCode CreateIndexWithOptions(const char* name, uint8_t column_count, KeyType types,
+                                 const IndexOptions *options);
+
+/**
+Inserts a batch of records into an index.
+
+The result is the same as calling InsertRecord() for every record, but the keys are
+encoded only once and the records are inserted in ascending order by their keys
+(records with equal keys keep their order). Loading an empty index this way is much
+faster than inserting its records one by one.
+
+If tx is NULL, the records are not inserted atomically: the batch is split into parts
+that are committed on their own, so if an error is returned, some of the records may
+already have been inserted.
+
+@param[in] tx
+  the transaction in which context the records should be inserted (or NULL)
+
+@param[in] idx
+  the index into which the records should be inserted
+
+@param[in] records
+  an array holding the records
+
+@param[in] count
+  the number of records inside the array
+
+@return ErrorCode
+  - \ref kOk
+         if all records were successfully inserted
+  - \ref kErrorUnknownIndex
+         if the given index is unknown or closed
+  - \ref kErrorIncompatibleKey
+         if the key of a record does not fit the index (no record is inserted then)
+  - \ref kErrorDeadlock
+         if a deadlock occurred while inserting the records
+  - \ref kErrorOutOfMemory
+         if there is not enough memory to insert the records
+  - \ref kErrorGenericFailure
+         if records is NULL or some other error occurred
+*/
+ErrorCode InsertRecords(Transaction *tx, Index *idx, Record *records, uint32_t count);
+
+/**
+Writes a report on the contention of all locks inside the library to a file.
+
+Locks with the same name (e.g. the mutexes of all index handles) are reported
+together, ranked by the total time threads spent waiting for them, along with
+histograms of their wait and hold times. Locks are only profiled if the library
+has been compiled with MUTEX_STATS defined; otherwise the report says so.
+
+@param[in] path
+  the name of the file to write (an existing file is overwritten)
+
+@return ErrorCode
+  - \ref kOk
+         if the report was successfully written
+  - \ref kErrorGenericFailure
+         if path is NULL or the file could not be written
+*/
+ErrorCode WriteLockReport(const char *path);
+
+/**
+The isolation level of transactions and of the iterators used outside of them.
+
+The Berkeley DB implementation reads the level of the first transactions from the
+environment variable CONTEST_ISOLATION when the library is first used
+("read_committed", "snapshot" or "optimistic"; read committed if it is unset).
+Only if it is \ref kIsolationSnapshot or \ref kIsolationOptimistic, Berkeley DB
+keeps the old versions of modified pages that snapshots read, so that writers
+copy a page before changing it while a snapshot may still need it. Otherwise
+SetIsolationLevel() supports read committed only.
+*/
+typedef enum IsolationLevel {
+  /// Reads see all committed changes and take locks, so readers and writers of the
+  /// same records wait for each other (the default without CONTEST_ISOLATION)
+  kIsolationReadCommitted = 0,
+
+  /// Reads see the state of the indices when the transaction (or, outside of
+  /// transactions, the iterator) started and never take locks, so they neither wait
+  /// for writers nor make them wait. Writes still take locks; a transaction that
+  /// modifies a record changed since its snapshot was taken fails with a deadlock.
+  kIsolationSnapshot = 1,
+
+  /// Transactions read a snapshot without taking locks and buffer their writes.
+  /// CommitTransaction() checks that none of the ranges the transaction has read
+  /// (including the records looked up by updates and deletes) has been changed in
+  /// the meantime and only then applies the writes; otherwise it returns
+  /// \ref kTransactionAborted. Iterators used outside of transactions behave like
+  /// with \ref kIsolationSnapshot. The index handles used by such a transaction
+  /// have to stay open until it has ended.
+  kIsolationOptimistic = 2
+} IsolationLevel;
+
+/**
+Sets the isolation level of all transactions and iterators started afterwards.
+
+Transactions and iterators that are already open keep their level.
+
+@param[in] level
+  the isolation level
+
+@return ErrorCode
+  - \ref kOk
+         if the level was successfully set
+  - \ref kErrorGenericFailure
+         if the implementation does not support the level (with Berkeley DB, if
+         it reads snapshots but the library has been started at read committed)
+*/
+ErrorCode SetIsolationLevel(IsolationLevel level);
+
+/**
+The counters of the transactions using \ref kIsolationOptimistic and of the
+operations running outside of transactions.
+
+The Berkeley DB implementation retries InsertRecord(), UpdateRecord() and
+DeleteRecord() a few times (after a short random wait that grows with every
+attempt) if they are called without a transaction and chosen as the victim of
+a deadlock. Only if all attempts fail, \ref kErrorDeadlock is returned.
+*/
+typedef struct TransactionStats {
+  /// The number of optimistic transactions that have been committed
+  uint64_t optimistic_commits;
+
+  /// The number of optimistic transactions whose validation (or one of whose
+  /// buffered writes) failed, so that CommitTransaction() aborted them
+  uint64_t optimistic_conflicts;
+
+  /// The number of times an operation outside of a transaction has been
+  /// retried after a deadlock
+  uint64_t deadlock_retries;
+
+  /// The number of operations outside of transactions that returned
+  /// \ref kErrorDeadlock because all of their attempts failed
+  uint64_t deadlock_failures;
+} TransactionStats;
+
+/**
+Returns the counters of all transactions and operations that have ended so far.
+
+@param[out] stats
+  receives the counters
+
+@return ErrorCode
+  - \ref kOk
+         if the counters were returned
+  - \ref kErrorGenericFailure
+         if stats is NULL
+*/
+ErrorCode GetTransactionStats(TransactionStats *stats);
+
+/**
+The memory accounted for by the library.
+
+The Berkeley DB implementation charges the memory whose size depends on the data
+(keys and records copied by transactions, the buffers of iterators and of bulk
+inserts, index handles, its cache and log buffer) against a budget. An operation
+that would exceed it fails with \ref kErrorOutOfMemory instead of allocating the
+memory. The limit is read from the environment variable CONTEST_MEMORY_LIMIT when
+the library is first used (in byte, a suffix K, M or G multiplies it by 2^10, 2^20
+or 2^30) and can be changed with SetMemoryLimit(). With a limit, the cache of
+Berkeley DB gets half of it (at most 4 GB, as without a limit). The native
+implementation does not account for its memory and reports zeros.
+*/
+typedef struct MemoryUsage {
+  /// The number of bytes currently in use
+  uint64_t used;
+
+  /// The highest number of bytes that have been in use at the same time
+  uint64_t peak;
+
+  /// The limit in byte (0 if there is none)
+  uint64_t limit;
+
+  /// The number of allocations that have been refused because of the limit
+  uint64_t failures;
+} MemoryUsage;
+
+/**
+Returns the memory currently used by the library.
+
+@param[out] usage
+  receives the counters
+
+@return ErrorCode
+  - \ref kOk
+         if the counters were returned
+  - \ref kErrorGenericFailure
+         if usage is NULL
+*/
+ErrorCode GetMemoryUsage(MemoryUsage *usage);
+
+/**
+Sets the memory limit of the library.
+
+Memory that is already in use is not freed; if it exceeds the new limit, further
+allocations fail until enough of it has been given back. The size of the cache of
+Berkeley DB is chosen when the library is first used and does not change afterwards.
+
+@param[in] bytes
+  the new limit in byte (0 removes the limit)
+
+@return ErrorCode
+  - \ref kOk
+         if the limit was set
+  - \ref kErrorGenericFailure
+         if the implementation does not account for its memory
+*/
+ErrorCode SetMemoryLimit(uint64_t bytes);
+
+/**
+Where the memory of an index goes.
+
+The numbers are kept up to date by the operations on the index, so reading them
+does not visit its records. They include the uncommitted changes of running
+transactions in the native implementation; the Berkeley DB implementation only
+adds the changes of a transaction when it commits.
+
+The native implementation stores every key in a fixed slot (4 byte for kShort, 8
+byte for kInt, MAX_VARCHAR_LENGTH+1 byte for kVarchar) and all records with the
+same key in a chain. Berkeley DB stores its keys without padding and keeps no
+chains of its own, so keys, duplicates and chain_bytes are 0 for it, and its key
+padding are the bytes its encoding adds to the strings (terminators and escapes).
+*/
+typedef struct IndexFootprint {
+  /// The number of records (native: including the records that are inserted or
+  /// deleted by running transactions)
+  uint64_t records;
+
+  /// The number of distinct keys
+  uint64_t keys;
+
+  /// The bytes taken by the stored keys, including their padding
+  uint64_t key_bytes;
+
+  /// The bytes of key_bytes that do not hold data (unused parts of varchar slots)
+  uint64_t key_padding;
+
+  /// The bytes of all payloads (native: including the pending payloads of updates)
+  uint64_t payload_bytes;
+
+  /// The number of records that share their key with a record stored before them
+  uint64_t duplicates;
+
+  /// The bytes taken by the entries forming the chains of duplicates (one per
+  /// record, without the payloads)
+  uint64_t chain_bytes;
+
+  /// The bytes taken by the nodes (native) or pages (Berkeley DB) of the tree
+  uint64_t tree_bytes;
+
+  /// The bytes of tree_bytes that hold neither keys nor payloads (node headers,
+  /// pointers, inner node separators and free space)
+  uint64_t tree_overhead;
+
+  /// The bytes held by the open iterators of the index (their state and batches)
+  uint64_t iterator_bytes;
+} IndexFootprint;
+
+/**
+Returns the memory footprint of an index.
+
+It is cheap enough to be polled regularly: the native implementation only reads
+counters, the Berkeley DB implementation also reads the page counts of its trees
+from their metadata.
+
+@param[in] name
+  the name of the index
+
+@param[out] footprint
+  receives the numbers
+
+@return ErrorCode
+  - \ref kOk
+         if the numbers were returned
+  - \ref kErrorUnknownIndex
+         if no index with that name exists
+  - \ref kErrorGenericFailure
+         if name or footprint is NULL
+*/
+ErrorCode GetIndexFootprint(const char* name, IndexFootprint *footprint);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CONTEST_EXTENSIONS_H_ */
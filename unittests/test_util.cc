@@ -156,6 +156,16 @@ bool Tester::RegisterTest(const char* name, void (*func)()){
   return true;
 };
 
+/**
+Report that the running test has been skipped.
+
+@param message
+  the reason why the test has been skipped
+*/
+void Tester::Skip(const char* message){
+  std::cerr << "  Test skipped: " << message << std::endl << std::flush;
+};
+
 /**
 Run all registered tests.
 */
@@ -48,6 +48,9 @@ class Tester{
     // Assert the given condition
     void Assert(const bool condition, const char* file, const int line, const char* message);
 
+    // Report that the running test has been skipped
+    void Skip(const char* message);
+
     // Setter functions
     Tester& set_num_errors(unsigned int num_errors){num_errors_=num_errors; return *this;}
 
@@ -90,4 +93,7 @@ class Tester{
 #define ASSERT_LT(a,b,message) Tester::getInstance().Assert(((a)<(b)),__FILE__,__LINE__,message)
 #define ASSERT_LEQ(a,b,message) Tester::getInstance().Assert(((a)<=(b)),__FILE__,__LINE__,message)
 
+// Macro used to skip a test that the implementation cannot run
+#define SKIP(message) Tester::getInstance().Skip(message)
+
 #endif // _UNITTESTS_TEST_UTIL_H_
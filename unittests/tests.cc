@@ -33,8 +33,17 @@ the contest interface.
 */
 
 #include <contest_interface.h>
+#include <contest_extensions.h>
 #include <common/macros.h>
 
+#include <pthread.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "test_util.h"
 
 #define PRIMARY_INDEX "primary_index"
@@ -43,6 +52,32 @@ the contest interface.
 // Create new records for the primary and for the secondary index
 Record* CreateRecord(const int32_t k_1, const int64_t k_2, const char* k_3, const char* payload);
 Record* CreateRecord(const char* key, const char* payload);
+
+// The keys and records of the integer indices used by the range tests (the tests
+// keep their records to compute the results of GetRecords() by brute force)
+typedef std::vector<int64_t> IntKey;
+typedef std::vector<std::pair<IntKey, std::string> > IntRecords;
+
+// Create records and keys for an integer index (attributes whose bit is set in
+// wildcards are left open)
+Record* CreateRecord(const AttributeType* types, const IntKey &key, const std::string &payload);
+Key CreateKey(const AttributeType* types, const IntKey &key, uint32_t wildcards);
+
+// Compare the records returned by GetRecords() with the expected records
+void CheckRange(Transaction *tx, Index *idx, const AttributeType* types, const IntRecords &records,
+                const IntKey &min, const IntKey &max, uint32_t wildcards, bool ordered = true);
+
+// The keys and records of an index of a varchar and an integer attribute
+typedef std::pair<std::string, int64_t> TextKey;
+typedef std::vector<std::pair<TextKey, std::string> > TextRecords;
+
+// Create records and keys for such an index (a NULL text leaves both attributes open)
+Record* CreateRecord(const TextKey &key, const std::string &payload);
+Key CreateKey(const char* text, int64_t number);
+
+// Compare the records returned by GetRecords() with the expected records
+void CheckRange(Transaction *tx, Index *idx, const TextRecords &records, const char* min_text,
+                int64_t min_number, const char* max_text, int64_t max_number);
 Block* CreateBlock(const char* val){
   Block* block = new Block;
   block->data = (void*) val;
@@ -365,6 +400,686 @@ TEST(IndexDeletionTest){
 
 };
 
+/**
+Test 6: Test ranges with wildcards
+
+Queries that only restrict the last attributes skip the keys that do not match
+(the iterator seeks behind them), which must not change their results.
+*/
+TEST(WildcardRangeTest){
+  AttributeType types[] = {kInt, kShort, kInt};
+  Transaction *tx;
+  Index *idx;
+  IntRecords records;
+
+  ASSERT_EQUALS(kOk, CreateIndex("wildcard_index", COUNT_OF(types), types), "Could not create the wildcard index.");
+  ASSERT_EQUALS(kOk, OpenIndex("wildcard_index", &idx), "Could not open the wildcard index.");
+
+  // A grid of keys, every fifth of them with a duplicate
+  ASSERT_EQUALS(kOk, BeginTransaction(&tx), "Could not begin a new transaction.");
+  for(int i = 0; i < 12; i++){
+    for(int j = -4; j < 4; j++){
+      for(int k = 0; k < 6; k++){
+        IntKey key;
+        key.push_back(i * 100);
+        key.push_back(j);
+        key.push_back(k * 7 - 20);
+        int copies = ((i + j + k) % 5 == 0) ? 2 : 1;
+        for(int c = 0; c < copies; c++){
+          char payload[32];
+          sprintf(payload, "r%d.%d.%d.%d", i, j, k, c);
+          records.push_back(std::make_pair(key, std::string(payload)));
+          ASSERT_EQUALS(kOk, InsertRecord(tx, idx, CreateRecord(types, key, payload)), "Could not insert a record.");
+        }
+      }
+    }
+  }
+  ASSERT_EQUALS(kOk, CommitTransaction(&tx), "Could not commit the transaction.");
+
+  // Delete every seventh record
+  IntRecords remaining;
+  for(size_t i = 0; i < records.size(); i++){
+    if(i % 7 == 3){
+      ASSERT_EQUALS(kOk, DeleteRecord(NULL, idx, CreateRecord(types, records[i].first, records[i].second), 0),
+                    "Could not delete a record.");
+    } else {
+      remaining.push_back(records[i]);
+    }
+  }
+
+  IteratorStats before, after;
+  ASSERT_EQUALS(kOk, GetIteratorStats(&before), "Could not get the iterator statistics.");
+
+  // Only the second attribute (a single value and a range)
+  IntKey min(3, 0), max(3, 0);
+  min[1] = 2; max[1] = 2;
+  CheckRange(NULL, idx, types, remaining, min, max, 5);
+  min[1] = -1; max[1] = 0;
+  CheckRange(NULL, idx, types, remaining, min, max, 5);
+
+  // Only the last attribute
+  min[2] = 1; max[2] = 15;
+  CheckRange(NULL, idx, types, remaining, min, max, 3);
+
+  ASSERT_EQUALS(kOk, GetIteratorStats(&after), "Could not get the iterator statistics.");
+  ASSERT_LT((after.steps - before.steps) + (after.seeks - before.seeks), 3 * remaining.size(),
+            "The iterators did not skip the keys that do not match.");
+
+  // The last two attributes, and all of them inside a transaction
+  min[1] = -3; max[1] = 1;
+  min[2] = -20; max[2] = 1;
+  CheckRange(NULL, idx, types, remaining, min, max, 1);
+  min[0] = 250; max[0] = 800;
+  ASSERT_EQUALS(kOk, BeginTransaction(&tx), "Could not begin a new transaction.");
+  CheckRange(tx, idx, types, remaining, min, max, 0);
+  CheckRange(tx, idx, types, remaining, min, max, 7);
+  ASSERT_EQUALS(kOk, CommitTransaction(&tx), "Could not commit the transaction.");
+
+  ASSERT_EQUALS(kOk, CloseIndex(&idx), "Could not close the wildcard index.");
+  ASSERT_EQUALS(kOk, DeleteIndex("wildcard_index"), "Could not delete the wildcard index.");
+};
+
+/**
+Test 7: Test secondary indices
+
+Ranges that restrict an attribute with a secondary index to a single value are
+answered from it; the index has to follow the inserts and deletes of duplicates.
+*/
+TEST(SecondaryAttributeTest){
+  AttributeType types[] = {kInt, kInt, kShort};
+  uint8_t secondary[] = {1, 2};
+  IndexOptions options = {COUNT_OF(secondary), secondary, kLayoutLexicographic};
+  Transaction *tx;
+  Index *idx;
+  IntRecords records;
+
+  ASSERT_EQUALS(kOk, CreateIndexWithOptions("secondary_attribute_index", COUNT_OF(types), types, &options),
+                "Could not create the index with secondary indices.");
+  ASSERT_EQUALS(kOk, OpenIndex("secondary_attribute_index", &idx), "Could not open the index with secondary indices.");
+
+  ASSERT_EQUALS(kOk, BeginTransaction(&tx), "Could not begin a new transaction.");
+  for(int i = 0; i < 400; i++){
+    IntKey key;
+    key.push_back((i * 37) % 101);
+    key.push_back(i % 13);
+    key.push_back(i % 5 - 2);
+    char payload[32];
+    sprintf(payload, "r%d", i);
+    records.push_back(std::make_pair(key, std::string(payload)));
+    ASSERT_EQUALS(kOk, InsertRecord(tx, idx, CreateRecord(types, key, payload)), "Could not insert a record.");
+
+    // Every tenth key gets a duplicate
+    if(i % 10 == 0){
+      sprintf(payload, "d%d", i);
+      records.push_back(std::make_pair(key, std::string(payload)));
+      ASSERT_EQUALS(kOk, InsertRecord(tx, idx, CreateRecord(types, key, payload)), "Could not insert a duplicate.");
+    }
+  }
+  ASSERT_EQUALS(kOk, CommitTransaction(&tx), "Could not commit the transaction.");
+
+  // Delete one record of some duplicated keys and all records of some other keys
+  IntRecords remaining;
+  for(size_t i = 0; i < records.size(); i++){
+    bool duplicate = (records[i].second[0] == 'd');
+    int n = atoi(records[i].second.c_str() + 1);
+    if((duplicate && (n % 20 == 0)) || (n % 30 == 0) || (n % 11 == 4)){
+      ASSERT_EQUALS(kOk, DeleteRecord(NULL, idx, CreateRecord(types, records[i].first, records[i].second), 0),
+                    "Could not delete a record.");
+    } else {
+      remaining.push_back(records[i]);
+    }
+  }
+
+  // Single values of the secondary attributes, alone and together with other restrictions
+  IntKey min(3, 0), max(3, 0);
+  for(int v = 0; v < 13; v += 3){
+    min[1] = v; max[1] = v;
+    CheckRange(NULL, idx, types, remaining, min, max, 5);
+  }
+  min[2] = -1; max[2] = -1;
+  CheckRange(NULL, idx, types, remaining, min, max, 3);
+  min[1] = 4; max[1] = 4;
+  CheckRange(NULL, idx, types, remaining, min, max, 1);
+  min[0] = 10; max[0] = 60;
+  ASSERT_EQUALS(kOk, BeginTransaction(&tx), "Could not begin a new transaction.");
+  CheckRange(tx, idx, types, remaining, min, max, 4);
+  min[1] = 2; max[1] = 9;
+  CheckRange(tx, idx, types, remaining, min, max, 5);
+  ASSERT_EQUALS(kOk, CommitTransaction(&tx), "Could not commit the transaction.");
+
+  ASSERT_EQUALS(kOk, CloseIndex(&idx), "Could not close the index with secondary indices.");
+  ASSERT_EQUALS(kOk, DeleteIndex("secondary_attribute_index"), "Could not delete the index with secondary indices.");
+};
+
+/**
+Test 8: Test the Z-order layout
+
+Records of a Z-order index are returned in the order of the curve, but a range has
+to return the same records as with the lexicographic layout.
+*/
+TEST(ZOrderRangeTest){
+  AttributeType types[] = {kInt, kShort, kInt, kInt};
+  IndexOptions options = {0, NULL, kLayoutZOrder};
+  Transaction *tx;
+  Index *idx;
+  IntRecords records;
+
+  // The native implementation does not support this layout
+  ErrorCode ret = CreateIndexWithOptions("zorder_index", COUNT_OF(types), types, &options);
+  if(ret == kErrorGenericFailure)
+    return;
+  ASSERT_EQUALS(kOk, ret, "Could not create the Z-order index.");
+  ASSERT_EQUALS(kOk, OpenIndex("zorder_index", &idx), "Could not open the Z-order index.");
+
+  srand(6);
+  ASSERT_EQUALS(kOk, BeginTransaction(&tx), "Could not begin a new transaction.");
+  for(int i = 0; i < 1500; i++){
+    IntKey key;
+    key.push_back(rand() % 2000 - 1000);
+    key.push_back(rand() % 64 - 32);
+    key.push_back(((int64_t) rand() << 20) - ((int64_t) RAND_MAX << 19));
+    key.push_back(rand() % 16);
+    int copies = (i % 9 == 0) ? 3 : 1;
+    for(int c = 0; c < copies; c++){
+      char payload[32];
+      sprintf(payload, "r%d.%d", i, c);
+      records.push_back(std::make_pair(key, std::string(payload)));
+      ASSERT_EQUALS(kOk, InsertRecord(tx, idx, CreateRecord(types, key, payload)), "Could not insert a record.");
+    }
+  }
+  ASSERT_EQUALS(kOk, CommitTransaction(&tx), "Could not commit the transaction.");
+
+  IntRecords remaining;
+  for(size_t i = 0; i < records.size(); i++){
+    if(i % 5 == 1){
+      ASSERT_EQUALS(kOk, DeleteRecord(NULL, idx, CreateRecord(types, records[i].first, records[i].second), 0),
+                    "Could not delete a record.");
+    } else {
+      remaining.push_back(records[i]);
+    }
+  }
+
+  // Boxes that are loose on the first attribute, with and without wildcards
+  for(int q = 0; q < 40; q++){
+    IntKey min, max;
+    int64_t low[] = {-1000, -32, -((int64_t) RAND_MAX << 19), 0};
+    int64_t domain[] = {2000, 64, (int64_t) RAND_MAX << 20, 16};
+    int64_t width[] = {1500, 16, (int64_t) RAND_MAX << 18, 6};
+    for(int i = 0; i < 4; i++){
+      int64_t from = low[i] + (int64_t) ((double) rand() / RAND_MAX * (domain[i] - width[i]));
+      min.push_back(from);
+      max.push_back(from + width[i]);
+    }
+    CheckRange(NULL, idx, types, remaining, min, max, q % 4, false);
+  }
+
+  ASSERT_EQUALS(kOk, CloseIndex(&idx), "Could not close the Z-order index.");
+  ASSERT_EQUALS(kOk, DeleteIndex("zorder_index"), "Could not delete the Z-order index.");
+};
+
+/**
+Test 9: Test the k-d tree layout
+
+The layout partitions the space of all attributes, but ranges still have to return
+their records in ascending order by their key.
+*/
+TEST(KdTreeRangeTest){
+  AttributeType types[] = {kShort, kInt, kInt};
+  IndexOptions options = {0, NULL, kLayoutKdTree};
+  Transaction *tx;
+  Index *idx;
+  IntRecords records;
+
+  ASSERT_EQUALS(kOk, CreateIndexWithOptions("kdtree_index", COUNT_OF(types), types, &options),
+                "Could not create the k-d tree index.");
+  ASSERT_EQUALS(kOk, OpenIndex("kdtree_index", &idx), "Could not open the k-d tree index.");
+
+  // Enough keys to split the leaves many times, with some duplicates
+  srand(7);
+  ASSERT_EQUALS(kOk, BeginTransaction(&tx), "Could not begin a new transaction.");
+  for(int i = 0; i < 3000; i++){
+    IntKey key;
+    key.push_back(rand() % 40 - 20);
+    key.push_back(rand() % 500);
+    key.push_back((int64_t) (rand() % 300) << 40);
+    int copies = (i % 8 == 0) ? 2 : 1;
+    for(int c = 0; c < copies; c++){
+      char payload[32];
+      sprintf(payload, "r%d.%d", i, c);
+      records.push_back(std::make_pair(key, std::string(payload)));
+      ASSERT_EQUALS(kOk, InsertRecord(tx, idx, CreateRecord(types, key, payload)), "Could not insert a record.");
+    }
+  }
+  ASSERT_EQUALS(kOk, CommitTransaction(&tx), "Could not commit the transaction.");
+
+  // Delete some records and give others a new payload
+  IntRecords remaining;
+  for(size_t i = 0; i < records.size(); i++){
+    Record* record = CreateRecord(types, records[i].first, records[i].second);
+    if(i % 6 == 2){
+      ASSERT_EQUALS(kOk, DeleteRecord(NULL, idx, record, 0), "Could not delete a record.");
+      continue;
+    }
+    if(i % 10 == 5){
+      std::string payload = records[i].second + "u";
+      ASSERT_EQUALS(kOk, UpdateRecord(NULL, idx, record, CreateBlock(strdup(payload.c_str())), 0),
+                    "Could not update a record.");
+      records[i].second = payload;
+    }
+    remaining.push_back(records[i]);
+  }
+
+  IntKey min(3, 0), max(3, 0);
+  CheckRange(NULL, idx, types, remaining, min, max, 7);
+  for(int q = 0; q < 30; q++){
+    min[0] = rand() % 40 - 25; max[0] = min[0] + rand() % 20;
+    min[1] = rand() % 500; max[1] = min[1] + rand() % 200;
+    min[2] = (int64_t) (rand() % 300) << 40; max[2] = min[2] + ((int64_t) (rand() % 150) << 40);
+    CheckRange(NULL, idx, types, remaining, min, max, q % 4);
+  }
+
+  ASSERT_EQUALS(kOk, CloseIndex(&idx), "Could not close the k-d tree index.");
+  ASSERT_EQUALS(kOk, DeleteIndex("kdtree_index"), "Could not delete the k-d tree index.");
+};
+
+/**
+Test 10: Test bulk inserts
+
+A batch of records has to end up in the index just like records inserted one by
+one, whether the index is still empty or not.
+*/
+TEST(BulkInsertTest){
+  AttributeType types[] = {kInt, kShort};
+  Transaction *tx;
+  Index *idx;
+  IntRecords records;
+
+  ASSERT_EQUALS(kOk, CreateIndex("bulk_index", COUNT_OF(types), types), "Could not create the bulk index.");
+  ASSERT_EQUALS(kOk, OpenIndex("bulk_index", &idx), "Could not open the bulk index.");
+
+  // Three batches: the first fills the empty index, the others add records between
+  // and next to its keys (including duplicates of them and within the batch)
+  for(int b = 0; b < 3; b++){
+    std::vector<Record> batch;
+    for(int i = 0; i < 500; i++){
+      IntKey key;
+      key.push_back((i * 7 + b * 3) % 900 - 300);
+      key.push_back(i % 4 - b);
+      char payload[32];
+      sprintf(payload, "b%d.%d", b, i);
+      records.push_back(std::make_pair(key, std::string(payload)));
+      batch.push_back(*CreateRecord(types, key, payload));
+      if(i % 50 == 0){
+        sprintf(payload, "b%d.%dd", b, i);
+        records.push_back(std::make_pair(key, std::string(payload)));
+        batch.push_back(*CreateRecord(types, key, payload));
+      }
+    }
+
+    if(b == 1){
+      ASSERT_EQUALS(kOk, InsertRecords(NULL, idx, &batch[0], batch.size()), "Could not insert a batch.");
+    } else {
+      ASSERT_EQUALS(kOk, BeginTransaction(&tx), "Could not begin a new transaction.");
+      ASSERT_EQUALS(kOk, InsertRecords(tx, idx, &batch[0], batch.size()), "Could not insert a batch.");
+      ASSERT_EQUALS(kOk, CommitTransaction(&tx), "Could not commit the transaction.");
+    }
+  }
+
+  // A batch with a key that does not fit the index is rejected as a whole
+  AttributeType wrong[] = {kInt, kShort, kInt};
+  IntKey key(2, 1), longer(3, 1);
+  Record invalid[] = {*CreateRecord(types, key, "valid"), *CreateRecord(wrong, longer, "invalid")};
+  ASSERT_EQUALS(kErrorIncompatibleKey, InsertRecords(NULL, idx, invalid, COUNT_OF(invalid)),
+                "InsertRecords() does not return kErrorIncompatibleKey, when a key does not fit the index.");
+
+  // Delete some of the records again
+  IntRecords remaining;
+  for(size_t i = 0; i < records.size(); i++){
+    if(i % 9 == 4){
+      ASSERT_EQUALS(kOk, DeleteRecord(NULL, idx, CreateRecord(types, records[i].first, records[i].second), 0),
+                    "Could not delete a record.");
+    } else {
+      remaining.push_back(records[i]);
+    }
+  }
+
+  IntKey min(2, 0), max(2, 0);
+  CheckRange(NULL, idx, types, remaining, min, max, 3);
+  min[0] = -120; max[0] = 333;
+  CheckRange(NULL, idx, types, remaining, min, max, 2);
+  min[1] = -1; max[1] = 1;
+  CheckRange(NULL, idx, types, remaining, min, max, 0);
+
+  ASSERT_EQUALS(kOk, CloseIndex(&idx), "Could not close the bulk index.");
+  ASSERT_EQUALS(kOk, DeleteIndex("bulk_index"), "Could not delete the bulk index.");
+};
+
+/**
+Test 11: Test optimistic transactions
+
+Of two optimistic transactions that read the same range and write into it, only
+the first one to commit succeeds; transactions reading other ranges do not
+conflict. This level is skipped if the implementation does not support it.
+*/
+TEST(OptimisticConflictTest){
+  AttributeType types[] = {kInt, kInt};
+  Transaction *tx, *first, *second;
+  Index *idx;
+  IntRecords records;
+
+  if(SetIsolationLevel(kIsolationOptimistic) != kOk){
+    SKIP("optimistic transactions are not supported (see CONTEST_ISOLATION)");
+    return;
+  }
+
+  ASSERT_EQUALS(kOk, CreateIndex("optimistic_index", COUNT_OF(types), types), "Could not create the optimistic index.");
+  ASSERT_EQUALS(kOk, OpenIndex("optimistic_index", &idx), "Could not open the optimistic index.");
+  for(int i = 0; i < 20; i++){
+    IntKey key(2, i);
+    char payload[32];
+    sprintf(payload, "r%d", i);
+    records.push_back(std::make_pair(key, std::string(payload)));
+    ASSERT_EQUALS(kOk, InsertRecord(NULL, idx, CreateRecord(types, key, payload)), "Could not insert a record.");
+  }
+
+  TransactionStats before, after;
+  ASSERT_EQUALS(kOk, GetTransactionStats(&before), "Could not get the transaction statistics.");
+
+  // Both transactions read the same range and insert into it
+  IntKey min(2, 5), max(2, 9), key(2, 7);
+  ASSERT_EQUALS(kOk, BeginTransaction(&first), "Could not begin a new transaction.");
+  ASSERT_EQUALS(kOk, BeginTransaction(&second), "Could not begin a new transaction.");
+  CheckRange(first, idx, types, records, min, max, 0);
+  CheckRange(second, idx, types, records, min, max, 0);
+  ASSERT_EQUALS(kOk, InsertRecord(first, idx, CreateRecord(types, key, "first")), "Could not insert a record.");
+  ASSERT_EQUALS(kOk, InsertRecord(second, idx, CreateRecord(types, key, "second")), "Could not insert a record.");
+  ASSERT_EQUALS(kOk, CommitTransaction(&first), "Could not commit the first transaction.");
+  ASSERT_EQUALS(kTransactionAborted, CommitTransaction(&second),
+                "CommitTransaction() does not return kTransactionAborted, when the range read by the transaction has changed.");
+  records.push_back(std::make_pair(key, std::string("first")));
+
+  // Transactions reading other ranges both commit
+  IntKey low(2, 2), high(2, 16);
+  ASSERT_EQUALS(kOk, BeginTransaction(&first), "Could not begin a new transaction.");
+  ASSERT_EQUALS(kOk, BeginTransaction(&second), "Could not begin a new transaction.");
+  min[0] = 15; min[1] = 15; max[0] = 19; max[1] = 19;
+  CheckRange(first, idx, types, records, min, max, 0);
+  ASSERT_EQUALS(kOk, InsertRecord(first, idx, CreateRecord(types, high, "high")), "Could not insert a record.");
+  ASSERT_EQUALS(kOk, UpdateRecord(second, idx, CreateRecord(types, low, "r2"), CreateBlock(strdup("low")), 0),
+                "Could not update a record.");
+  ASSERT_EQUALS(kOk, CommitTransaction(&second), "Could not commit the second transaction.");
+  ASSERT_EQUALS(kOk, CommitTransaction(&first), "Could not commit the first transaction.");
+  records.push_back(std::make_pair(high, std::string("high")));
+  records[2].second = "low";
+
+  ASSERT_EQUALS(kOk, GetTransactionStats(&after), "Could not get the transaction statistics.");
+  ASSERT_EQUALS(before.optimistic_conflicts + 1, after.optimistic_conflicts,
+                "The conflict has not been counted.");
+
+  // Only the writes of the committed transactions are visible
+  ASSERT_EQUALS(kOk, BeginTransaction(&tx), "Could not begin a new transaction.");
+  CheckRange(tx, idx, types, records, min, max, 3);
+  ASSERT_EQUALS(kOk, CommitTransaction(&tx), "Could not commit the transaction.");
+
+  ASSERT_EQUALS(kOk, SetIsolationLevel(kIsolationReadCommitted), "Could not reset the isolation level.");
+  ASSERT_EQUALS(kOk, CloseIndex(&idx), "Could not close the optimistic index.");
+  ASSERT_EQUALS(kOk, DeleteIndex("optimistic_index"), "Could not delete the optimistic index.");
+};
+
+/**
+Test 12.1: Modify both halves of the snapshot index in autocommit mode.
+
+@param arg
+  the records of the index
+*/
+static volatile bool snapshot_writer_done = false;
+static void* SnapshotWriterTest(void* arg){
+  AttributeType types[] = {kInt, kInt};
+  IntRecords &records = *((IntRecords*) arg);
+  Index *idx;
+  ASSERT_EQUALS(kOk, OpenIndex("snapshot_index", &idx), "Could not open the snapshot index.");
+  ASSERT_EQUALS(kOk, InsertRecord(NULL, idx, CreateRecord(types, IntKey(2, 5), "inserted")),
+                "Could not insert a record.");
+  ASSERT_EQUALS(kOk, InsertRecord(NULL, idx, CreateRecord(types, IntKey(2, 30), "inserted")),
+                "Could not insert a record.");
+  ASSERT_EQUALS(kOk, DeleteRecord(NULL, idx, CreateRecord(types, records[32].first, records[32].second), 0),
+                "Could not delete a record.");
+  ASSERT_EQUALS(kOk, UpdateRecord(NULL, idx, CreateRecord(types, records[35].first, records[35].second),
+                                  CreateBlock(strdup("updated")), 0), "Could not update a record.");
+  ASSERT_EQUALS(kOk, CloseIndex(&idx), "Could not close the snapshot index.");
+  snapshot_writer_done = true;
+  return 0;
+}
+
+/**
+Test 12: Test snapshot isolation
+
+A scan of a snapshot transaction returns the records of its snapshot, even if
+another thread modifies the range while the scan is running, and the writer does
+not wait for the reader. This level is skipped if the implementation does not
+support it.
+*/
+TEST(SnapshotScanTest){
+  AttributeType types[] = {kInt, kInt};
+  Transaction *tx;
+  Index *idx;
+  Iterator *it;
+  Record *record;
+  IntRecords records, found;
+  pthread_t writer_thread;
+
+  if(SetIsolationLevel(kIsolationSnapshot) != kOk){
+    SKIP("snapshot transactions are not supported (see CONTEST_ISOLATION)");
+    return;
+  }
+
+  // Large payloads make the scan return to the index after the writes
+  ASSERT_EQUALS(kOk, CreateIndex("snapshot_index", COUNT_OF(types), types), "Could not create the snapshot index.");
+  ASSERT_EQUALS(kOk, OpenIndex("snapshot_index", &idx), "Could not open the snapshot index.");
+  for(int i = 0; i < 40; i++){
+    IntKey key(2, i);
+    std::string payload(MAX_PAYLOAD_LENGTH - 96, 'a' + (i % 26));
+    records.push_back(std::make_pair(key, payload));
+    ASSERT_EQUALS(kOk, InsertRecord(NULL, idx, CreateRecord(types, key, payload)), "Could not insert a record.");
+  }
+
+  IntKey min(2, 0), max(2, 39);
+  ASSERT_EQUALS(kOk, BeginTransaction(&tx), "Could not begin a new transaction.");
+  ASSERT_EQUALS(kOk, GetRecords(tx, idx, CreateKey(types, min, 0), CreateKey(types, max, 0), &it),
+                "Could not open the iterator.");
+  while(GetNext(it, &record) == kOk){
+    IntKey key;
+    for(int i = 0; i < record->key.attribute_count; i++)
+      key.push_back(record->key.value[i]->int_value);
+    found.push_back(std::make_pair(key, std::string((const char*) record->payload.data, record->payload.size)));
+
+    // Let the writer finish while the scan is in the middle of the range
+    if(found.size() == records.size() / 2){
+      snapshot_writer_done = false;
+      ASSERT_EQUALS(0, pthread_create(&writer_thread, NULL, SnapshotWriterTest, &records),
+                    "Could not create a new thread for the SnapshotWriterTest.");
+      for(int i = 0; (i < 500) && !snapshot_writer_done; i++)
+        usleep(10000);
+      ASSERT_EQUALS(true, snapshot_writer_done, "The writer had to wait for the snapshot transaction.");
+    }
+  }
+  ASSERT_EQUALS(kOk, CloseIterator(&it), "Could not close the iterator.");
+  ASSERT_EQUALS(records.size(), found.size(), "The scan did not return the expected number of records.");
+  ASSERT_EQUALS(true, records == found, "The scan did not return the records of its snapshot.");
+
+  // Later reads of the transaction still see its snapshot
+  CheckRange(tx, idx, types, records, min, max, 0);
+  ASSERT_EQUALS(kOk, CommitTransaction(&tx), "Could not commit the transaction.");
+  pthread_join(writer_thread, NULL);
+
+  // New transactions see the writes
+  records.push_back(std::make_pair(IntKey(2, 5), std::string("inserted")));
+  records.push_back(std::make_pair(IntKey(2, 30), std::string("inserted")));
+  records[35].second = "updated";
+  records.erase(records.begin() + 32);
+  ASSERT_EQUALS(kOk, BeginTransaction(&tx), "Could not begin a new transaction.");
+  CheckRange(tx, idx, types, records, min, max, 0);
+  ASSERT_EQUALS(kOk, CommitTransaction(&tx), "Could not commit the transaction.");
+
+  ASSERT_EQUALS(kOk, SetIsolationLevel(kIsolationReadCommitted), "Could not reset the isolation level.");
+  ASSERT_EQUALS(kOk, CloseIndex(&idx), "Could not close the snapshot index.");
+  ASSERT_EQUALS(kOk, DeleteIndex("snapshot_index"), "Could not delete the snapshot index.");
+};
+
+/**
+Test 13: Test the order of varchar and integer keys
+
+Strings that are prefixes of each other, the empty string and strings of the
+maximum length are ordered like strcmp() orders them, integers across their full
+range, and all of them are returned unchanged.
+*/
+TEST(VarcharKeyTest){
+  AttributeType types[] = {kVarchar, kInt};
+  Transaction *tx;
+  Index *idx;
+  TextRecords records;
+
+  std::string longest(MAX_VARCHAR_LENGTH, 'z');
+  const char* texts[] = {"", "\x01", "ab", "ab\x01", "ab\x01\x01", "ab\x02", "abc", "b", "\xff", longest.c_str()};
+  const int64_t numbers[] = {INT64_MIN, -1, 0, 1, INT64_MAX};
+
+  ASSERT_EQUALS(kOk, CreateIndex("varchar_index", COUNT_OF(types), types), "Could not create the varchar index.");
+  ASSERT_EQUALS(kOk, OpenIndex("varchar_index", &idx), "Could not open the varchar index.");
+  for(size_t i = 0; i < COUNT_OF(texts); i++){
+    for(size_t j = 0; j < COUNT_OF(numbers); j++){
+      char payload[32];
+      sprintf(payload, "t%d/n%d", (int) i, (int) j);
+      TextKey key(texts[i], numbers[j]);
+      records.push_back(std::make_pair(key, std::string(payload)));
+      ASSERT_EQUALS(kOk, InsertRecord(NULL, idx, CreateRecord(key, payload)), "Could not insert a record.");
+    }
+  }
+
+  ASSERT_EQUALS(kOk, BeginTransaction(&tx), "Could not begin a new transaction.");
+
+  // The whole index, the ranges of a few prefixes and a single string
+  CheckRange(tx, idx, records, NULL, 0, NULL, 0);
+  CheckRange(tx, idx, records, "ab", INT64_MIN, "ab\x01\x01", INT64_MAX);
+  CheckRange(tx, idx, records, "", -1, "ab", 0);
+  CheckRange(tx, idx, records, "ab\x01", 0, "\xff", 1);
+  CheckRange(tx, idx, records, "b", -1, longest.c_str(), INT64_MAX);
+
+  // Every key on its own
+  for(size_t i = 0; i < records.size(); i++){
+    const TextKey &key = records[i].first;
+    CheckRange(tx, idx, records, key.first.c_str(), key.second, key.first.c_str(), key.second);
+  }
+
+  ASSERT_EQUALS(kOk, CommitTransaction(&tx), "Could not commit the transaction.");
+  ASSERT_EQUALS(kOk, CloseIndex(&idx), "Could not close the varchar index.");
+  ASSERT_EQUALS(kOk, DeleteIndex("varchar_index"), "Could not delete the varchar index.");
+};
+
+/**
+Test 14.1: Insert a record in autocommit mode that waits for the locks of the
+transaction of DeadlockRetryTest.
+
+@param arg
+  the key of the record
+*/
+static volatile bool retry_writer_done = false;
+static ErrorCode retry_writer_result;
+static void* AutocommitRetryTest(void* arg){
+  AttributeType types[] = {kInt, kInt};
+  Index *idx;
+  ASSERT_EQUALS(kOk, OpenIndex("retry_index", &idx), "Could not open the retry index.");
+  retry_writer_result = InsertRecord(NULL, idx, CreateRecord(types, *((IntKey*) arg), "writer"));
+  ASSERT_EQUALS(kOk, CloseIndex(&idx), "Could not close the retry index.");
+  retry_writer_done = true;
+  return 0;
+}
+
+/**
+Test 14: Test the retries of autocommit operations after deadlocks
+
+The transaction writes the first primary and the last secondary entry, the
+writer locks the last primary entry and waits for the secondary one, and then
+the transaction reads the record of the writer. The writer is chosen as the
+deadlock victim (it holds fewer write locks), is retried and succeeds once the
+transaction has committed. This is skipped if writers do not wait for locks.
+*/
+TEST(DeadlockRetryTest){
+  AttributeType types[] = {kInt, kInt};
+  uint8_t secondary[] = {1};
+  IndexOptions options = {COUNT_OF(secondary), secondary, kLayoutLexicographic};
+  Transaction *tx;
+  Index *idx;
+  Iterator *it;
+  Record *record;
+  IntRecords records;
+  pthread_t writer_thread;
+
+  // Snapshot transactions would not lock what they read
+  ASSERT_EQUALS(kOk, SetIsolationLevel(kIsolationReadCommitted), "Could not set the isolation level.");
+
+  // Enough records for the first and the last key to be on different pages
+  ASSERT_EQUALS(kOk, CreateIndexWithOptions("retry_index", COUNT_OF(types), types, &options),
+                "Could not create the retry index.");
+  ASSERT_EQUALS(kOk, OpenIndex("retry_index", &idx), "Could not open the retry index.");
+  ASSERT_EQUALS(kOk, BeginTransaction(&tx), "Could not begin a new transaction.");
+  for(int i = 0; i < 2000; i++){
+    IntKey key;
+    key.push_back(i);
+    key.push_back(i % 100);
+    std::string payload(100, 'a' + (i % 26));
+    records.push_back(std::make_pair(key, payload));
+    ASSERT_EQUALS(kOk, InsertRecord(tx, idx, CreateRecord(types, key, payload)), "Could not insert a record.");
+  }
+  ASSERT_EQUALS(kOk, CommitTransaction(&tx), "Could not commit the transaction.");
+
+  TransactionStats before, after;
+  ASSERT_EQUALS(kOk, GetTransactionStats(&before), "Could not get the transaction statistics.");
+
+  IntKey first, last;
+  first.push_back(-1);
+  first.push_back(1000);
+  last.push_back(100000);
+  last.push_back(1000);
+  ASSERT_EQUALS(kOk, BeginTransaction(&tx), "Could not begin a new transaction.");
+  ASSERT_EQUALS(kOk, InsertRecord(tx, idx, CreateRecord(types, first, "transaction")), "Could not insert a record.");
+  retry_writer_done = false;
+  ASSERT_EQUALS(0, pthread_create(&writer_thread, NULL, AutocommitRetryTest, &last),
+                "Could not create a new thread for the AutocommitRetryTest.");
+  usleep(200000);
+
+  bool waited = !retry_writer_done;
+  if(waited){
+    // Close the cycle (the read waits for the writer until it has been aborted)
+    ASSERT_EQUALS(kOk, GetRecords(tx, idx, CreateKey(types, last, 0), CreateKey(types, last, 0), &it),
+                  "Could not open the iterator.");
+    while(GetNext(it, &record) == kOk)
+      ;
+    ASSERT_EQUALS(kOk, CloseIterator(&it), "Could not close the iterator.");
+  }
+  ASSERT_EQUALS(kOk, CommitTransaction(&tx), "Could not commit the transaction.");
+  pthread_join(writer_thread, NULL);
+  ASSERT_EQUALS(kOk, retry_writer_result, "The autocommit insert did not succeed after the deadlock.");
+  records.push_back(std::make_pair(first, std::string("transaction")));
+  records.push_back(std::make_pair(last, std::string("writer")));
+
+  if(waited){
+    ASSERT_EQUALS(kOk, GetTransactionStats(&after), "Could not get the transaction statistics.");
+    ASSERT_GT(after.deadlock_retries, before.deadlock_retries, "The retry has not been counted.");
+    ASSERT_EQUALS(before.deadlock_failures, after.deadlock_failures, "A failed retry has been counted.");
+  } else {
+    SKIP("writers do not wait for the locks of transactions");
+  }
+
+  // Both records have been written exactly once
+  IntKey min(2, 1000), max(2, 1000);
+  ASSERT_EQUALS(kOk, BeginTransaction(&tx), "Could not begin a new transaction.");
+  CheckRange(tx, idx, types, records, min, max, 1);
+  ASSERT_EQUALS(kOk, CommitTransaction(&tx), "Could not commit the transaction.");
+
+  ASSERT_EQUALS(kOk, CloseIndex(&idx), "Could not close the retry index.");
+  ASSERT_EQUALS(kOk, DeleteIndex("retry_index"), "Could not delete the retry index.");
+};
+
 /**
 Creates a new record for the primary index
 
@@ -429,3 +1144,231 @@ Record* CreateRecord(const char* key, const char* payload){
    return record;
 };
 
+
+/**
+Creates a new record for an index consisting of kShort and kInt attributes
+
+@param types
+  the types of the attributes of the index
+
+@param key
+  the values of the attributes
+
+@param payload
+  the payload to be assigned to the record
+
+@return
+  a pointer to the created record
+*/
+Record* CreateRecord(const AttributeType* types, const IntKey &key, const std::string &payload){
+   Record* record = new Record;
+   record->key = CreateKey(types, key, 0);
+   record->payload = *CreateBlock(strdup(payload.c_str()));
+   return record;
+};
+
+/**
+Creates a key for an index consisting of kShort and kInt attributes
+
+@param types
+  the types of the attributes of the index
+
+@param key
+  the values of the attributes
+
+@param wildcards
+  the attributes that should be left open (bit i stands for attribute i)
+
+@return
+  the created key
+*/
+Key CreateKey(const AttributeType* types, const IntKey &key, uint32_t wildcards){
+   Key result;
+   result.value = new Attribute*[key.size()];
+   result.attribute_count = key.size();
+
+   for(size_t i = 0; i < key.size(); i++){
+     if(wildcards & (1 << i)){
+       result.value[i] = NULL;
+       continue;
+     }
+
+     result.value[i] = new Attribute;
+     result.value[i]->type = types[i];
+     if(types[i] == kShort)
+       result.value[i]->short_value = key[i];
+     else
+       result.value[i]->int_value = key[i];
+   }
+   return result;
+};
+
+/**
+Retrieves the records inside a range and compares them with the records of the
+index that are inside it (which are found by a scan over all of them)
+
+@param tx
+  the transaction to be used (or NULL)
+
+@param idx
+  the index
+
+@param types
+  the types of the attributes of the index
+
+@param records
+  all records of the index
+
+@param min
+  the minimum key
+
+@param max
+  the maximum key
+
+@param wildcards
+  the attributes that are left open (bit i stands for attribute i)
+
+@param ordered
+  whether the records have to be returned in ascending order by their key
+*/
+void CheckRange(Transaction *tx, Index *idx, const AttributeType* types, const IntRecords &records,
+                const IntKey &min, const IntKey &max, uint32_t wildcards, bool ordered){
+  IntRecords expected;
+  for(size_t i = 0; i < records.size(); i++){
+    bool inside = true;
+    for(size_t j = 0; j < min.size(); j++){
+      if(!(wildcards & (1 << j)) && ((records[i].first[j] < min[j]) || (records[i].first[j] > max[j])))
+        inside = false;
+    }
+    if(inside)
+      expected.push_back(records[i]);
+  }
+
+  IntRecords found;
+  Iterator *it;
+  Record *record;
+  bool ascending = true;
+  ASSERT_EQUALS(kOk, GetRecords(tx, idx, CreateKey(types, min, wildcards), CreateKey(types, max, wildcards), &it),
+                "Could not open the iterator.");
+  while(GetNext(it, &record) == kOk){
+    IntKey key;
+    for(int i = 0; i < record->key.attribute_count; i++){
+      if(types[i] == kShort)
+        key.push_back(record->key.value[i]->short_value);
+      else
+        key.push_back(record->key.value[i]->int_value);
+    }
+    if(!found.empty() && (key < found.back().first))
+      ascending = false;
+    found.push_back(std::make_pair(key, std::string((const char*) record->payload.data, record->payload.size)));
+  }
+  ASSERT_EQUALS(kOk, CloseIterator(&it), "Could not close the iterator.");
+
+  if(ordered)
+    ASSERT_EQUALS(true, ascending, "The records were not returned in ascending order by their key.");
+
+  std::sort(expected.begin(), expected.end());
+  std::sort(found.begin(), found.end());
+  ASSERT_EQUALS(expected.size(), found.size(), "The range did not return the expected number of records.");
+  ASSERT_EQUALS(true, expected == found, "The range did not return the expected records.");
+};
+
+/**
+Creates a new record for an index of a varchar and an integer attribute
+
+@param key
+  the key of the record
+
+@param payload
+  the payload to be assigned to the record
+
+@return
+  a pointer to the created record
+*/
+Record* CreateRecord(const TextKey &key, const std::string &payload){
+  Record* record = new Record;
+  record->key = CreateKey(key.first.c_str(), key.second);
+  record->payload = *CreateBlock(strdup(payload.c_str()));
+  return record;
+};
+
+/**
+Creates a new key for an index of a varchar and an integer attribute
+
+@param text
+  the value of the varchar attribute (or NULL to leave both attributes open)
+
+@param number
+  the value of the integer attribute
+
+@return
+  the created key
+*/
+Key CreateKey(const char* text, int64_t number){
+  Key key;
+  key.value = new Attribute*[2];
+  key.attribute_count = 2;
+  key.value[0] = NULL;
+  key.value[1] = NULL;
+  if(text != NULL){
+    key.value[0] = new Attribute;
+    key.value[0]->type = kVarchar;
+    strcpy(key.value[0]->char_value, text);
+    key.value[1] = new Attribute;
+    key.value[1]->type = kInt;
+    key.value[1]->int_value = number;
+  }
+  return key;
+};
+
+/**
+Retrieves the records inside a range of an index of a varchar and an integer
+attribute and compares them with the records of the index that are inside it
+
+@param tx
+  the transaction to be used (or NULL)
+
+@param idx
+  the index
+
+@param records
+  all records of the index
+
+@param min_text
+  the minimum of the varchar attribute (or NULL to retrieve all records)
+
+@param min_number
+  the minimum of the integer attribute
+
+@param max_text
+  the maximum of the varchar attribute (or NULL to retrieve all records)
+
+@param max_number
+  the maximum of the integer attribute
+*/
+void CheckRange(Transaction *tx, Index *idx, const TextRecords &records, const char* min_text,
+                int64_t min_number, const char* max_text, int64_t max_number){
+  TextRecords expected;
+  for(size_t i = 0; i < records.size(); i++){
+    const TextKey &key = records[i].first;
+    if((min_text == NULL) || ((key.first >= min_text) && (key.first <= max_text)
+                              && (key.second >= min_number) && (key.second <= max_number)))
+      expected.push_back(records[i]);
+  }
+  std::sort(expected.begin(), expected.end());
+
+  TextRecords found;
+  Iterator *it;
+  Record *record;
+  ASSERT_EQUALS(kOk, GetRecords(tx, idx, CreateKey(min_text, min_number), CreateKey(max_text, max_number), &it),
+                "Could not open the iterator.");
+  while(GetNext(it, &record) == kOk){
+    TextKey key(record->key.value[0]->char_value, record->key.value[1]->int_value);
+    found.push_back(std::make_pair(key, std::string((const char*) record->payload.data, record->payload.size)));
+  }
+  ASSERT_EQUALS(kOk, CloseIterator(&it), "Could not close the iterator.");
+
+  // Both are in ascending order (std::string compares like strcmp())
+  ASSERT_EQUALS(expected.size(), found.size(), "The range did not return the expected number of records.");
+  ASSERT_EQUALS(true, expected == found, "The range did not return the expected records in ascending order.");
+};